@@ -5,16 +5,29 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../ARM_decode_table.c \
+../acctrace.c \
+../boottime.c \
+../chan.c \
+../compress.c \
+../coredump.c \
 ../gdb.c \
+../hyp.c \
 ../instr.c \
 ../instr_comm.c \
 ../instr_util.c \
 ../loader.c \
+../loadpipe.c \
 ../log.c \
+../memdump.c \
+../pmu.c \
 ../rpi2.c \
+../semihost.c \
 ../serial.c \
+../stackmon.c \
 ../start1.c \
 ../target_xml.c \
+../trace.c \
+../unwind.c \
 ../util.c 
 
 S_UPPER_SRCS += \
@@ -22,31 +35,57 @@ S_UPPER_SRCS += \
 
 OBJS += \
 ./ARM_decode_table.o \
+./acctrace.o \
+./boottime.o \
+./chan.o \
+./compress.o \
+./coredump.o \
 ./gdb.o \
+./hyp.o \
 ./instr.o \
 ./instr_comm.o \
 ./instr_util.o \
 ./loader.o \
+./loadpipe.o \
 ./log.o \
+./memdump.o \
+./pmu.o \
 ./rpi2.o \
+./semihost.o \
 ./serial.o \
+./stackmon.o \
 ./start.o \
 ./start1.o \
 ./target_xml.o \
+./trace.o \
+./unwind.o \
 ./util.o 
 
 C_DEPS += \
 ./ARM_decode_table.d \
+./acctrace.d \
+./boottime.d \
+./chan.d \
+./compress.d \
+./coredump.d \
 ./gdb.d \
+./hyp.d \
 ./instr.d \
 ./instr_comm.d \
 ./instr_util.d \
 ./loader.d \
+./loadpipe.d \
 ./log.d \
+./memdump.d \
+./pmu.d \
 ./rpi2.d \
+./semihost.d \
 ./serial.d \
+./stackmon.d \
 ./start1.d \
 ./target_xml.d \
+./trace.d \
+./unwind.d \
 ./util.d 
 
 S_UPPER_DEPS += \
@@ -0,0 +1,523 @@
+/*
+acctrace.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Data access trace for a memory region by MMU faults.
+// The pages of the traced region are mapped no-access (AP = 00), so each
+// debuggee load and store to them gives a permission fault. The data abort
+// handler passes those to acctrace_fault(), which decodes the instruction,
+// does the access with domain 0 set to manager (no permission checks),
+// records it and continues after the instruction. Unlike with the four
+// watchpoints, the region can be as big as the RAM.
+// The sections fully in the region get their AP bits cleared, the partly
+// covered ones at the ends are replaced with a coarse page table each.
+// Only ARM state single, doubleword and multiple loads and stores are
+// emulated (the decoder has no Thumb support); anything else stops the
+// debuggee. Code must not be in the traced pages.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "gdb.h"
+#include "instr_comm.h"
+#include "acctrace.h"
+
+// section descriptor: AP[1:0] (bits 10-11) and AP[2] (bit 15)
+#define ACCTRACE_SECT_AP 0x8c00
+// small page descriptor: AP[1:0] (bits 4-5) and AP[2] (bit 9)
+#define ACCTRACE_PAGE_AP 0x0230
+
+extern char __code_begin;
+
+volatile unsigned int acctrace_active;
+
+static acctrace_rec_t acctrace_ring[ACCTRACE_RING_SIZE];
+static uint32_t acctrace_head; // total number of accesses recorded
+static uint32_t acctrace_outside; // emulated, but not in the region
+static uint32_t acctrace_stops; // not emulated - debuggee stopped
+static uint32_t acctrace_start; // traced region [start, end)
+static uint32_t acctrace_end;
+// coarse page tables for the partly covered sections
+static __attribute__ ((aligned (1024))) uint32_t acctrace_pages[2][256];
+static uint32_t acctrace_edge_desc[2]; // the original section descriptors
+
+// maps the region no-access (on = 1) or back to normal
+static void acctrace_protect(int on)
+{
+	volatile uint32_t *tbl = rpi2_mmu_table();
+	uint32_t meg, first, last, lo, hi, addr, desc;
+	int i, n = 0;
+
+	first = acctrace_start >> 20;
+	last = (acctrace_end - 1) >> 20;
+	for (meg = first; meg <= last; meg++)
+	{
+		lo = (meg == first) ? acctrace_start : meg << 20;
+		hi = (meg == last) ? acctrace_end : (meg + 1) << 20;
+		if ((lo == (meg << 20)) && (hi == ((meg + 1) << 20)))
+		{
+			// whole section
+			if (on)
+			{
+				tbl[meg] &= ~ACCTRACE_SECT_AP;
+			}
+			else
+			{
+				tbl[meg] |= 0xc00; // AP = 11, full access
+			}
+			continue;
+		}
+		if (!on)
+		{
+			tbl[meg] = acctrace_edge_desc[n++];
+			continue;
+		}
+		desc = tbl[meg];
+		acctrace_edge_desc[n] = desc;
+		for (i=0; i<256; i++)
+		{
+			addr = (meg << 20) | (i << 12);
+			acctrace_pages[n][i] = rpi2_mmu_page_desc(desc, addr);
+			if ((addr + 0x1000 > lo) && (addr < hi))
+			{
+				acctrace_pages[n][i] &= ~ACCTRACE_PAGE_AP;
+			}
+		}
+		// coarse page table entry: NS and domain from the section
+		tbl[meg] = (uint32_t)acctrace_pages[n] | 1 | ((desc >> 16) & 8)
+				| (desc & 0x1e0);
+		n++;
+	}
+	rpi2_mmu_update();
+}
+
+void acctrace_open(int open)
+{
+	if (!acctrace_active)
+	{
+		return;
+	}
+	// domain 0: manager (access permissions not checked) or client
+	asm volatile ("mcr p15, 0, %0, c3, c0, 0\n\t" :: "r" (open ? 3 : 1));
+	SYNC;
+}
+
+// register value as the instruction sees it
+static uint32_t acctrace_reg(int n)
+{
+	if (n == 15)
+	{
+		return rpi2_reg_context.reg.r15 + 8;
+	}
+	return rpi2_reg_context.storage[n];
+}
+
+// the shifted register offset of LDR/STR
+static uint32_t acctrace_shift(uint32_t instr)
+{
+	uint32_t val = acctrace_reg(bitrng(instr, 3, 0));
+	uint32_t amount = bitrng(instr, 11, 7);
+
+	switch (bitrng(instr, 6, 5))
+	{
+	case 0: // LSL
+		return val << amount;
+	case 1: // LSR
+		return amount ? (val >> amount) : 0;
+	case 2: // ASR
+		return (uint32_t)((int)val >> (amount ? amount : 31));
+	default: // ROR, RRX
+		if (amount == 0)
+		{
+			return (bit(rpi2_reg_context.reg.cpsr, 29) << 31) | (val >> 1);
+		}
+		return (val >> amount) | (val << (32 - amount));
+	}
+}
+
+// does one access and records it if it's in the region
+static uint32_t acctrace_access(uint32_t addr, int size, int write, uint32_t value)
+{
+	acctrace_rec_t *rec;
+
+	switch (size)
+	{
+	case 1:
+		if (write) *((volatile uint8_t *)addr) = (uint8_t)value;
+		else value = *((volatile uint8_t *)addr);
+		break;
+	case 2:
+		if (write) *((volatile uint16_t *)addr) = (uint16_t)value;
+		else value = *((volatile uint16_t *)addr);
+		break;
+	default:
+		if (write) *((volatile uint32_t *)addr) = value;
+		else value = *((volatile uint32_t *)addr);
+		break;
+	}
+	if ((addr + size <= acctrace_start) || (addr >= acctrace_end))
+	{
+		acctrace_outside++;
+		return value;
+	}
+	rec = &acctrace_ring[acctrace_head & (ACCTRACE_RING_SIZE - 1)];
+	acctrace_head++;
+	rec->time = *((volatile uint32_t *)SYSTMR_CLO);
+	rec->pc = rpi2_reg_context.reg.r15;
+	rec->addr = addr;
+	rec->value = value;
+	rec->info = size | (write ? ACCTRACE_WRITE : 0);
+	return value;
+}
+
+// LDR to the PC - interworking as in ARMv7
+static uint32_t acctrace_load_pc(uint32_t value)
+{
+	if (value & 1)
+	{
+		rpi2_reg_context.reg.cpsr |= (1 << 5); // Thumb
+		return value & ~1;
+	}
+	return value & ~3;
+}
+
+// LDM, STM (not the user register or exception return forms)
+static int acctrace_block(uint32_t instr, uint32_t *next)
+{
+	uint32_t list, rn, addr, values[16];
+	int i, n;
+
+	list = bitrng(instr, 15, 0);
+	for (n = 0, i = 0; i < 16; i++)
+	{
+		if (list & (1 << i)) n++;
+	}
+	if (n == 0)
+	{
+		return 0;
+	}
+	rn = acctrace_reg(bitrng(instr, 19, 16));
+	if (bit(instr, 23))
+	{
+		addr = rn + (bit(instr, 24) ? 4 : 0); // IB, IA
+		rn += 4 * n;
+	}
+	else
+	{
+		addr = rn - 4 * n + (bit(instr, 24) ? 0 : 4); // DB, DA
+		rn -= 4 * n;
+	}
+	for (i=0; i<16; i++)
+	{
+		if (list & (1 << i))
+		{
+			values[i] = acctrace_access(addr, 4, !bit(instr, 20), acctrace_reg(i));
+			addr += 4;
+		}
+	}
+	if (bit(instr, 21))
+	{
+		rpi2_reg_context.storage[bitrng(instr, 19, 16)] = rn;
+	}
+	if (bit(instr, 20))
+	{
+		for (i=0; i<15; i++)
+		{
+			if (list & (1 << i))
+			{
+				rpi2_reg_context.storage[i] = values[i];
+			}
+		}
+		if (list & (1 << 15))
+		{
+			*next = acctrace_load_pc(values[15]);
+		}
+	}
+	return 1;
+}
+
+// single and doubleword loads and stores
+static int acctrace_single(uint32_t instr, uint32_t *next)
+{
+	uint32_t rn, offset, addr, value;
+	int rt, size, load, sign = 0;
+
+	load = bit(instr, 20);
+	if (bitrng(instr, 27, 26) == 1)
+	{
+		// LDR, STR, LDRB, STRB and the unprivileged forms
+		offset = bit(instr, 25) ? acctrace_shift(instr) : bitrng(instr, 11, 0);
+		size = bit(instr, 22) ? 1 : 4;
+	}
+	else
+	{
+		// LDRH, STRH, LDRSB, LDRSH, LDRD, STRD
+		offset = bit(instr, 22)
+				? ((bitrng(instr, 11, 8) << 4) | bitrng(instr, 3, 0))
+				: acctrace_reg(bitrng(instr, 3, 0));
+		switch (bitrng(instr, 6, 5))
+		{
+		case 1: // LDRH, STRH
+			size = 2;
+			break;
+		case 2: // LDRSB, LDRD
+			size = load ? 1 : 8;
+			sign = load;
+			load = 1;
+			break;
+		default: // LDRSH, STRD
+			size = load ? 2 : 8;
+			sign = load;
+			break;
+		}
+	}
+	rt = bitrng(instr, 15, 12);
+	if ((size == 8) && ((rt & 1) || (rt == 14)))
+	{
+		return 0; // unpredictable
+	}
+	rn = acctrace_reg(bitrng(instr, 19, 16));
+	offset = bit(instr, 23) ? rn + offset : rn - offset;
+	addr = bit(instr, 24) ? offset : rn;
+
+	if (size == 8)
+	{
+		if (load)
+		{
+			rpi2_reg_context.storage[rt] = acctrace_access(addr, 4, 0, 0);
+			rpi2_reg_context.storage[rt + 1] = acctrace_access(addr + 4, 4, 0, 0);
+		}
+		else
+		{
+			acctrace_access(addr, 4, 1, acctrace_reg(rt));
+			acctrace_access(addr + 4, 4, 1, acctrace_reg(rt + 1));
+		}
+	}
+	if (!bit(instr, 24) || bit(instr, 21))
+	{
+		rpi2_reg_context.storage[bitrng(instr, 19, 16)] = offset; // writeback
+	}
+	if (size == 8)
+	{
+		return 1;
+	}
+	if (!load)
+	{
+		acctrace_access(addr, size, 1, acctrace_reg(rt));
+		return 1;
+	}
+	value = acctrace_access(addr, size, 0, 0);
+	if (sign)
+	{
+		value = (size == 1) ? (uint32_t)(int8_t)value : (uint32_t)(int16_t)value;
+	}
+	if (rt == 15)
+	{
+		*next = acctrace_load_pc(value);
+	}
+	else
+	{
+		rpi2_reg_context.storage[rt] = value;
+	}
+	return 1;
+}
+
+int acctrace_fault()
+{
+	uint32_t instr, next;
+	int done = 0;
+
+	// ARM state only
+	if (rpi2_reg_context.reg.cpsr & ((1 << 5) | (1 << 24)))
+	{
+		acctrace_stops++;
+		return 0;
+	}
+	acctrace_open(1);
+	instr = *((volatile uint32_t *)rpi2_reg_context.reg.r15);
+	next = rpi2_reg_context.reg.r15 + 4;
+	if ((instr & INSTR_COND_MASK) == INSTR_COND_NV)
+	{
+		done = 0; // unconditional space: PLD, VLD, ...
+	}
+	else if ((bitrng(instr, 27, 26) == 1) && !(bit(instr, 25) && bit(instr, 4)))
+	{
+		done = acctrace_single(instr, &next);
+	}
+	else if ((bitrng(instr, 27, 25) == 0) && ((instr & 0x90) == 0x90)
+			&& (bitrng(instr, 6, 5) != 0))
+	{
+		done = acctrace_single(instr, &next);
+	}
+	else if ((bitrng(instr, 27, 25) == 4) && !bit(instr, 22))
+	{
+		done = acctrace_block(instr, &next);
+	}
+	acctrace_open(0);
+	if (!done)
+	{
+		acctrace_stops++;
+		return 0;
+	}
+	rpi2_reg_context.reg.r15 = next;
+	return 1;
+}
+
+static void acctrace_print_count(char *name, uint32_t val)
+{
+	char scratchpad[16];
+
+	gdb_mon_print(name);
+	gdb_mon_print(": ");
+	util_word_to_dec(scratchpad, val);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print("\n");
+}
+
+static void acctrace_stats()
+{
+	char line[40];
+
+	if (acctrace_active)
+	{
+		util_str_copy(line, "acctrace: ", 40);
+		util_word_to_hex(line + util_str_len(line), acctrace_start);
+		util_append_str(line, " - ", 40);
+		util_word_to_hex(line + util_str_len(line), acctrace_end);
+		util_append_str(line, "\n", 40);
+		gdb_mon_print(line);
+	}
+	else
+	{
+		gdb_mon_print("acctrace: off\n");
+	}
+	acctrace_print_count("accesses", acctrace_head);
+	acctrace_print_count("outside region", acctrace_outside);
+	acctrace_print_count("stops", acctrace_stops);
+}
+
+static void acctrace_dump(uint32_t count)
+{
+	uint32_t first, i;
+	acctrace_rec_t *rec;
+	char line[80];
+
+	if (count > acctrace_head) count = acctrace_head;
+	if (count > ACCTRACE_RING_SIZE) count = ACCTRACE_RING_SIZE;
+	first = acctrace_head - count;
+	gdb_mon_print("time(us)  pc        addr     value    access\n");
+	for (i=first; i<first+count; i++)
+	{
+		rec = &acctrace_ring[i & (ACCTRACE_RING_SIZE - 1)];
+		util_word_to_dec(line, rec->time);
+		util_append_str(line, "  ", 80);
+		util_word_to_hex(line + util_str_len(line), rec->pc);
+		util_append_str(line, "  ", 80);
+		util_word_to_hex(line + util_str_len(line), rec->addr);
+		util_append_str(line, " ", 80);
+		util_word_to_hex(line + util_str_len(line), rec->value);
+		util_append_str(line, (rec->info & ACCTRACE_WRITE) ? " w" : " r", 80);
+		util_word_to_dec(line + util_str_len(line), rec->info & 0xf);
+		util_append_str(line, "\n", 80);
+		gdb_mon_print(line);
+	}
+}
+
+static void acctrace_off()
+{
+	if (acctrace_active)
+	{
+		acctrace_protect(0);
+		acctrace_open(0); // we're in the stub - back to client
+		acctrace_active = 0;
+	}
+}
+
+static int acctrace_on(uint32_t addr, uint32_t len)
+{
+	uint32_t stub = (uint32_t)&__code_begin & 0xfff00000;
+
+	if (!rpi2_use_mmu)
+	{
+		gdb_mon_print("acctrace needs the MMU ('rpi_stub_mmu')\n");
+		return -1;
+	}
+	// normal RAM only, not the vector page or the stub's section
+	if ((len == 0) || (addr < 0x1000) || (addr + len < addr)
+			|| (addr + len > rpi2_strict_start)
+			|| ((addr < stub + 0x100000) && (addr + len > stub)))
+	{
+		gdb_mon_print("acctrace: bad region\n");
+		return -1;
+	}
+	acctrace_off();
+	acctrace_start = addr;
+	acctrace_end = addr + len;
+	acctrace_protect(1);
+	acctrace_active = 1;
+	acctrace_open(1); // the stub keeps access until the debuggee runs
+	return 0;
+}
+
+int acctrace_mon_cmd(char *args)
+{
+	unsigned int addr, len;
+	int cnt;
+
+	while (*args == ' ') args++;
+	if (util_str_cmp(args, "off") == 0)
+	{
+		acctrace_off();
+	}
+	else if (util_str_cmp(args, "clear") == 0)
+	{
+		acctrace_head = 0;
+		acctrace_outside = 0;
+		acctrace_stops = 0;
+	}
+	else if (*args == '\0')
+	{
+		acctrace_stats();
+	}
+	else if (util_cmp_substr(args, "dump") == util_str_len("dump"))
+	{
+		args += util_str_len("dump");
+		cnt = util_read_num(args, &len);
+		if (cnt == 0)
+		{
+			len = 32;
+		}
+		acctrace_dump(len);
+	}
+	else
+	{
+		cnt = util_read_num(args, &addr);
+		if (cnt == 0)
+		{
+			return -1;
+		}
+		args += cnt;
+		if (util_read_num(args, &len) == 0)
+		{
+			return -1;
+		}
+		return acctrace_on(addr, len);
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+acctrace.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ACCTRACE_H_
+#define ACCTRACE_H_
+
+#define ACCTRACE_RING_SIZE 512 // must be power of 2
+#define ACCTRACE_WRITE 0x80 // in acctrace_rec_t.info, the size is in bits 0-3
+
+typedef struct {
+	unsigned int time; // system timer (us)
+	unsigned int pc; // accessing instruction
+	unsigned int addr;
+	unsigned int value; // value read or written
+	unsigned int info; // size in bytes | ACCTRACE_WRITE
+} acctrace_rec_t;
+
+// non-zero while tracing - the data abort handler checks this
+extern volatile unsigned int acctrace_active;
+
+// Emulates and records the access that caused a permission fault in a
+// traced page. Returns 1 if the debuggee can continue, 0 if it must stop
+int acctrace_fault();
+
+// Gives the stub access to the traced pages (1) or takes it away (0)
+void acctrace_open(int open);
+
+// monitor acctrace [addr len|off|clear|dump [n]]
+int acctrace_mon_cmd(char *args);
+
+#endif /* ACCTRACE_H_ */
@@ -0,0 +1,84 @@
+/*
+boottime.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Boot timeline: the system timer (1 MHz, running since the firmware
+// started) is stamped at the end of each init phase, so the time from
+// power-on to gdb-ready can be seen with 'monitor boottime'.
+// start.S stamps the first two phases before .bss is usable.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "gdb.h"
+#include "boottime.h"
+
+unsigned int boottime_reset;
+unsigned int boottime_reloc;
+
+static char *boottime_phase[BOOTTIME_MAX_MARKS];
+static uint32_t boottime_stamp[BOOTTIME_MAX_MARKS];
+static int boottime_num_marks;
+
+void boottime_mark(char *phase)
+{
+	if (boottime_num_marks < BOOTTIME_MAX_MARKS)
+	{
+		boottime_stamp[boottime_num_marks] = *((volatile uint32_t *)SYSTMR_CLO);
+		boottime_phase[boottime_num_marks++] = phase;
+	}
+}
+
+static void boottime_print(char *phase, uint32_t stamp, uint32_t prev)
+{
+	char line[64];
+	char scratchpad[16];
+
+	util_str_copy(line, phase, 64);
+	util_append_str(line, ": ", 64);
+	util_word_to_dec(scratchpad, stamp - boottime_reset);
+	util_append_str(line, scratchpad, 64);
+	util_append_str(line, " us (+", 64);
+	util_word_to_dec(scratchpad, stamp - prev);
+	util_append_str(line, scratchpad, 64);
+	util_append_str(line, ")\n", 64);
+	gdb_mon_print(line);
+}
+
+// monitor boottime
+int boottime_mon_cmd(char *args)
+{
+	char scratchpad[16];
+	uint32_t prev;
+	int i;
+
+	(void) args;
+	gdb_mon_print("reset at ");
+	util_word_to_dec(scratchpad, boottime_reset);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" us after power-on\n");
+	boottime_print("relocated", boottime_reloc, boottime_reset);
+	prev = boottime_reloc;
+	for (i = 0; i < boottime_num_marks; i++)
+	{
+		boottime_print(boottime_phase[i], boottime_stamp[i], prev);
+		prev = boottime_stamp[i];
+	}
+	return 0;
+}
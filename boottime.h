@@ -0,0 +1,36 @@
+/*
+boottime.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOOTTIME_H_
+#define BOOTTIME_H_
+
+#define BOOTTIME_MAX_MARKS 16
+
+// system timer (us) at _start and after the relocation copy - from start.S
+extern unsigned int boottime_reset;
+extern unsigned int boottime_reloc;
+
+// stamp the end of a boot phase (name must be a constant string)
+void boottime_mark(char *phase);
+
+// monitor boottime
+int boottime_mon_cmd(char *args);
+
+#endif /* BOOTTIME_H_ */
@@ -0,0 +1,195 @@
+/*
+chan.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Logical channels on the gdb UART.
+// The debuggee writes to a channel with semihosting SYS_WRITE to a
+// handle got with SYS_OPEN ":chanN" - that is handled in the stub without
+// stopping, the data just gets queued. serial_tx() sends the gdb bytes
+// first and only when there are none and no gdb packet is half sent,
+// it takes a frame from here. So a bulk stream delays a gdb packet by one
+// frame at most. The channels are off until the host side turns them on
+// (QRpiChannels:1 or monitor channels on), so plain gdb never sees frames.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "gdb.h"
+#include "serial.h"
+#include "chan.h"
+
+// written by chan_write (tail) and serial_tx (head) - like the serial rings
+typedef struct {
+	int head;
+	int tail;
+	uint32_t sent;
+	uint32_t dropped;
+	char buff[CHAN_BUFF_SIZE];
+} chan_ring_t;
+
+static chan_ring_t chan_ring[CHAN_NUM];
+static int chan_turn = 0; // the channel to look at first
+static volatile int chan_on = 0;
+
+static int chan_used(chan_ring_t *ring)
+{
+	return (LOAD_ACQUIRE(ring->tail) - LOAD_ACQUIRE(ring->head) + CHAN_BUFF_SIZE)
+			% CHAN_BUFF_SIZE;
+}
+
+int chan_write(int ch, const char *buf, int n)
+{
+	chan_ring_t *ring;
+	int free;
+	int i;
+
+	if ((ch < 1) || (ch > CHAN_NUM) || (n <= 0))
+	{
+		return 0;
+	}
+	ring = &chan_ring[ch - 1];
+	if (!chan_on)
+	{
+		ring->dropped += n;
+		return 0;
+	}
+	free = CHAN_BUFF_SIZE - 1 - chan_used(ring);
+	if (n > free)
+	{
+		ring->dropped += n - free;
+		n = free;
+	}
+	for (i = 0; i < n; i++)
+	{
+		ring->buff[(ring->tail + i) % CHAN_BUFF_SIZE] = buf[i];
+	}
+	STORE_RELEASE(ring->tail, (ring->tail + n) % CHAN_BUFF_SIZE);
+	if (n > 0)
+	{
+		serial_start_tx();
+	}
+	return n;
+}
+
+int chan_pending()
+{
+	int i;
+
+	for (i = 0; i < CHAN_NUM; i++)
+	{
+		if (LOAD_ACQUIRE(chan_ring[i].tail) != chan_ring[i].head)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int chan_next_frame(char *buf)
+{
+	chan_ring_t *ring;
+	int i, j, ch, len;
+	uint32_t checksum = 0;
+
+	for (i = 0; i < CHAN_NUM; i++)
+	{
+		ch = (chan_turn + i) % CHAN_NUM;
+		ring = &chan_ring[ch];
+		len = chan_used(ring);
+		if (len == 0)
+		{
+			continue;
+		}
+		if (len > CHAN_FRAME_MAX)
+		{
+			len = CHAN_FRAME_MAX;
+		}
+		buf[0] = CHAN_ESC;
+		buf[1] = (char)(ch + 1);
+		buf[2] = (char)len;
+		for (j = 0; j < len; j++)
+		{
+			buf[3 + j] = ring->buff[(ring->head + j) % CHAN_BUFF_SIZE];
+			checksum += (uint8_t)buf[3 + j];
+		}
+		STORE_RELEASE(ring->head, (ring->head + len) % CHAN_BUFF_SIZE);
+		buf[3 + len] = (char)(checksum & 0xff);
+		ring->sent += len;
+		chan_turn = (ch + 1) % CHAN_NUM; // next time the next one first
+		return len + 4;
+	}
+	return 0;
+}
+
+void chan_enable(int on)
+{
+	int i;
+
+	chan_on = on;
+	if (!on)
+	{
+		// drop the queued data
+		for (i = 0; i < CHAN_NUM; i++)
+		{
+			STORE_RELEASE(chan_ring[i].head, LOAD_ACQUIRE(chan_ring[i].tail));
+		}
+	}
+}
+
+// monitor channels [on|off]
+int chan_mon_cmd(char *args)
+{
+	char scratchpad[16];
+	int i;
+
+	while (*args == ' ') args++;
+	if (util_str_cmp(args, "on") == 0)
+	{
+		chan_enable(1);
+		return 0;
+	}
+	if (util_str_cmp(args, "off") == 0)
+	{
+		chan_enable(0);
+		return 0;
+	}
+	if (*args != '\0')
+	{
+		return -1;
+	}
+	gdb_mon_print(chan_on ? "channels: on\n" : "channels: off\n");
+	for (i = 0; i < CHAN_NUM; i++)
+	{
+		gdb_mon_print("chan ");
+		util_word_to_dec(scratchpad, i + 1);
+		gdb_mon_print(scratchpad);
+		gdb_mon_print(": queued ");
+		util_word_to_dec(scratchpad, chan_used(&chan_ring[i]));
+		gdb_mon_print(scratchpad);
+		gdb_mon_print(", sent ");
+		util_word_to_dec(scratchpad, chan_ring[i].sent);
+		gdb_mon_print(scratchpad);
+		gdb_mon_print(", dropped ");
+		util_word_to_dec(scratchpad, chan_ring[i].dropped);
+		gdb_mon_print(scratchpad);
+		gdb_mon_print("\n");
+	}
+	return 0;
+}
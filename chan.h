@@ -0,0 +1,55 @@
+/*
+chan.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHAN_H_
+#define CHAN_H_
+
+// Logical channels multiplexed with gdb on UART0.
+// A channel frame is: CHAN_ESC, channel, length, data, checksum
+// (8-bit sum of the data). Frames go only between gdb packets, where
+// gdb RSP never has CHAN_ESC, so the host can split the stream.
+
+#define CHAN_ESC 0x10 // DLE
+#define CHAN_NUM 4 // channels 1 - 4, 0 is gdb
+#define CHAN_BUFF_SIZE 1024 // per channel
+#define CHAN_FRAME_MAX 64 // data bytes in a frame
+#define CHAN_FRAME_LEN (CHAN_FRAME_MAX + 4)
+
+// semihosting handles for the channels (SYS_OPEN ":chan1" - ":chan4")
+#define CHAN_HANDLE_BASE 0x100
+
+// Queues data for channel ch (1 - CHAN_NUM) and starts tx. Doesn't block:
+// returns the number of bytes queued, the rest are dropped
+int chan_write(int ch, const char *buf, int n);
+
+// 1 if there is data to frame
+int chan_pending();
+
+// Builds the next frame into buf (CHAN_FRAME_LEN bytes) taking the
+// channels in turn. Returns the frame length, 0 if nothing to send
+int chan_next_frame(char *buf);
+
+// Turns the channels on (1) or off (0) - when off, the data is dropped
+void chan_enable(int on);
+
+// monitor channels [on|off]
+int chan_mon_cmd(char *args);
+
+#endif /* CHAN_H_ */
@@ -0,0 +1,147 @@
+/*
+compress.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A small LZ77-compressor producing LZ4 block format, so that the
+// host side can use any LZ4 block decoder (rpi_stub.py has one).
+// Greedy parsing with a single-entry hash table - fast rather than
+// tight. The input is read bytewise, because without MMU the memory
+// is strongly ordered, and unaligned accesses would fault.
+
+#include <stdint.h>
+#include "compress.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MFLIMIT 12 // last match must start before this from the end
+#define LZ_LAST_LITERALS 5 // the block must end with literals
+
+static uint16_t lz_hash_tbl[1 << LZ_HASH_BITS];
+
+static inline uint32_t lz_read32(uint8_t *p)
+{
+	return ((uint32_t)p[0]) | (((uint32_t)p[1]) << 8)
+			| (((uint32_t)p[2]) << 16) | (((uint32_t)p[3]) << 24);
+}
+
+static inline uint32_t lz_hash(uint32_t val)
+{
+	return (val * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// write one sequence: literals + match (match_len 0 = last sequence)
+// returns the new output pointer or 0 if out of space
+static uint8_t *lz_put_sequence(uint8_t *dst, uint8_t *dst_end, uint8_t *lit,
+		int lit_len, int offset, int match_len)
+{
+	uint8_t *token;
+	int len;
+
+	if (dst + 1 + lit_len + (lit_len / 255) + 1 + 2 + (match_len / 255) + 1 > dst_end)
+	{
+		return 0;
+	}
+	token = dst++;
+	if (lit_len >= 15)
+	{
+		*token = 0xf0;
+		for (len = lit_len - 15; len >= 255; len -= 255)
+		{
+			*(dst++) = 255;
+		}
+		*(dst++) = (uint8_t)len;
+	}
+	else
+	{
+		*token = (uint8_t)(lit_len << 4);
+	}
+	for (len = 0; len < lit_len; len++)
+	{
+		*(dst++) = *(lit++);
+	}
+	if (match_len == 0)
+	{
+		return dst; // last sequence
+	}
+	*(dst++) = (uint8_t)(offset & 0xff);
+	*(dst++) = (uint8_t)(offset >> 8);
+	len = match_len - LZ_MIN_MATCH;
+	if (len >= 15)
+	{
+		*token |= 0x0f;
+		for (len -= 15; len >= 255; len -= 255)
+		{
+			*(dst++) = 255;
+		}
+		*(dst++) = (uint8_t)len;
+	}
+	else
+	{
+		*token |= (uint8_t)len;
+	}
+	return dst;
+}
+
+int lz_compress(unsigned char *src, int len, unsigned char *dst, int max)
+{
+	uint8_t *ip = src;
+	uint8_t *anchor = src;
+	uint8_t *ref;
+	uint8_t *mflimit = src + len - LZ_MFLIMIT;
+	uint8_t *matchlimit = src + len - LZ_LAST_LITERALS;
+	uint8_t *op = dst;
+	uint8_t *op_end = dst + max;
+	uint32_t seq;
+	uint32_t h;
+	int mlen;
+
+	if ((len < 0) || (len > LZ_MAX_BLOCK)) return -1;
+
+	// stale table entries are harmless - candidates are verified
+	if (len > LZ_MFLIMIT)
+	{
+		while (ip < mflimit)
+		{
+			seq = lz_read32(ip);
+			h = lz_hash(seq);
+			ref = src + lz_hash_tbl[h];
+			lz_hash_tbl[h] = (uint16_t)(ip - src);
+			if ((ref < ip) && (lz_read32(ref) == seq))
+			{
+				mlen = LZ_MIN_MATCH;
+				while ((ip + mlen < matchlimit) && (ref[mlen] == ip[mlen]))
+				{
+					mlen++;
+				}
+				op = lz_put_sequence(op, op_end, anchor, (int)(ip - anchor),
+						(int)(ip - ref), mlen);
+				if (op == 0) return -1;
+				ip += mlen;
+				anchor = ip;
+			}
+			else
+			{
+				ip++;
+			}
+		}
+	}
+	op = lz_put_sequence(op, op_end, anchor, (int)(src + len - anchor), 0, 0);
+	if (op == 0) return -1;
+	return (int)(op - dst);
+}
@@ -0,0 +1,35 @@
+/*
+compress.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+// maximum input block size (match offsets are 16-bit)
+#define LZ_MAX_BLOCK 65535
+
+// worst case output size for len bytes of input
+#define LZ_BOUND(len) ((len) + ((len) / 255) + 16)
+
+// Compresses a block in LZ4 block format.
+// Returns the compressed length, or -1 if the result doesn't fit
+// in max bytes (or the input is too long).
+int lz_compress(unsigned char *src, int len, unsigned char *dst, int max);
+
+#endif /* COMPRESS_H_ */
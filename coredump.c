@@ -0,0 +1,343 @@
+/*
+coredump.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Core dump of the debuggee, generated on the target.
+// The stream read by the host (qXfer:rpi-core:read) is:
+//   "RPICORE1", u32 prefix length, ELF prefix (headers + notes)
+//   page records: u32 vaddr, u32 info, data
+//   end record: vaddr = 0xffffffff
+// All-zero pages are left out and the others are LZ4-compressed
+// (or raw if they don't compress). The host writes the pages at
+// their file offsets, which gives an ordinary ELF core file.
+// The stream is generated page by page while it's being read, so
+// nothing needs to be buffered beyond one page.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "gdb.h"
+#include "compress.h"
+#include "coredump.h"
+
+// ELF definitions needed for the core file
+#define ELF_EHDR_SIZE 52
+#define ELF_PHDR_SIZE 32
+#define ELF_ET_CORE 4
+#define ELF_EM_ARM 40
+#define ELF_EF_ARM_EABI5 0x05000000
+#define ELF_PT_LOAD 1
+#define ELF_PT_NOTE 4
+#define ELF_PF_RWX 7
+
+// notes as in linux ARM cores
+#define NT_PRSTATUS 1
+#define NT_ARM_VFP 0x400
+#define PRSTATUS_SIZE 148
+#define PRSTATUS_CURSIG 12
+#define PRSTATUS_PID 24
+#define PRSTATUS_REG 72
+#define PRSTATUS_FPVALID 144
+#define ARM_VFP_SIZE 260 // d0-d31 + fpscr
+
+#define COREDUMP_MAGIC "RPICORE1"
+#define COREDUMP_HDR_SIZE 12 // magic + prefix length
+#define COREDUMP_REC_SIZE 8 // vaddr + info
+
+// headers + PRSTATUS-note + VFP-note
+#define COREDUMP_MAX_PREFIX (ELF_EHDR_SIZE \
+		+ ELF_PHDR_SIZE * (COREDUMP_MAX_SEGS + 1) \
+		+ (12 + 8 + PRSTATUS_SIZE) + (12 + 8 + ARM_VFP_SIZE))
+
+// generator states
+#define CD_IDLE 0
+#define CD_PAGES 1
+#define CD_DONE 2
+
+typedef struct {
+	uint32_t start;
+	uint32_t end;
+} coredump_seg_t;
+
+static coredump_seg_t cd_segs[COREDUMP_MAX_SEGS];
+static int cd_num_segs;
+static int cd_state = CD_IDLE;
+static int cd_seg; // segment being dumped
+static uint32_t cd_addr; // next page to dump
+
+// the current chunk of the stream
+static uint8_t cd_win[COREDUMP_REC_SIZE + COREDUMP_PAGE];
+static uint32_t cd_win_offs; // stream offset of cd_win
+static uint32_t cd_win_len;
+
+static uint32_t cd_page[COREDUMP_PAGE / 4]; // the page being compressed
+
+static void cd_put16(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)(val & 0xff);
+	p[1] = (uint8_t)((val >> 8) & 0xff);
+}
+
+static void cd_put32(uint8_t *p, uint32_t val)
+{
+	cd_put16(p, val & 0xffff);
+	cd_put16(p + 2, val >> 16);
+}
+
+static uint8_t *cd_put_phdr(uint8_t *p, uint32_t type, uint32_t offset,
+		uint32_t vaddr, uint32_t size, uint32_t align)
+{
+	cd_put32(p, type);
+	cd_put32(p + 4, offset);
+	cd_put32(p + 8, vaddr);
+	cd_put32(p + 12, vaddr); // paddr
+	cd_put32(p + 16, size); // filesz
+	cd_put32(p + 20, size); // memsz
+	cd_put32(p + 24, (type == ELF_PT_LOAD) ? ELF_PF_RWX : 0);
+	cd_put32(p + 28, align);
+	return p + ELF_PHDR_SIZE;
+}
+
+// note header with the name padded to 4 bytes (name is max 7 chars)
+static uint8_t *cd_put_note_hdr(uint8_t *p, char *name, uint32_t descsz,
+		uint32_t type)
+{
+	int i;
+	int namesz = util_str_len(name) + 1;
+
+	cd_put32(p, (uint32_t)namesz);
+	cd_put32(p + 4, descsz);
+	cd_put32(p + 8, type);
+	p += 12;
+	for (i=0; i<8; i++)
+	{
+		*(p++) = (i < namesz) ? (uint8_t)name[i] : 0;
+	}
+	return p;
+}
+
+// builds the stream header and the ELF-prefix into cd_win
+static void cd_build_prefix(int signal)
+{
+	uint8_t *p;
+	uint8_t *note;
+	uint32_t phnum, notesz, prefix_len, offset;
+	uint32_t *vfp;
+	int i;
+
+	phnum = (uint32_t)cd_num_segs + 1;
+	notesz = 12 + 8 + PRSTATUS_SIZE;
+	if (rpi2_neon_used)
+	{
+		notesz += 12 + 8 + ARM_VFP_SIZE;
+	}
+	prefix_len = ELF_EHDR_SIZE + ELF_PHDR_SIZE * phnum + notesz;
+
+	for (i=0; i<(int)sizeof(cd_win); i++)
+	{
+		cd_win[i] = 0;
+	}
+	p = cd_win;
+	util_str_copy((char *)p, COREDUMP_MAGIC, 8);
+	cd_put32(p + 8, prefix_len);
+	p += COREDUMP_HDR_SIZE;
+
+	// ELF header
+	p[0] = 0x7f;
+	p[1] = 'E';
+	p[2] = 'L';
+	p[3] = 'F';
+	p[4] = 1; // ELFCLASS32
+	p[5] = 1; // ELFDATA2LSB
+	p[6] = 1; // EV_CURRENT
+	cd_put16(p + 16, ELF_ET_CORE);
+	cd_put16(p + 18, ELF_EM_ARM);
+	cd_put32(p + 20, 1); // version
+	cd_put32(p + 28, ELF_EHDR_SIZE); // phoff
+	cd_put32(p + 36, ELF_EF_ARM_EABI5);
+	cd_put16(p + 40, ELF_EHDR_SIZE);
+	cd_put16(p + 42, ELF_PHDR_SIZE);
+	cd_put16(p + 44, phnum);
+	p += ELF_EHDR_SIZE;
+
+	// program headers - memory contents start at the next page boundary
+	p = cd_put_phdr(p, ELF_PT_NOTE, ELF_EHDR_SIZE + ELF_PHDR_SIZE * phnum,
+			0, notesz, 4);
+	offset = (prefix_len + COREDUMP_PAGE - 1) & ~(COREDUMP_PAGE - 1);
+	for (i=0; i<cd_num_segs; i++)
+	{
+		p = cd_put_phdr(p, ELF_PT_LOAD, offset, cd_segs[i].start,
+				cd_segs[i].end - cd_segs[i].start, COREDUMP_PAGE);
+		offset += cd_segs[i].end - cd_segs[i].start;
+	}
+
+	// NT_PRSTATUS: signal, pid and registers (r0-r15, cpsr, orig_r0)
+	p = cd_put_note_hdr(p, "CORE", PRSTATUS_SIZE, NT_PRSTATUS);
+	note = p;
+	cd_put16(note + PRSTATUS_CURSIG, (uint32_t)signal);
+	cd_put32(note + PRSTATUS_PID, 1);
+	for (i=0; i<17; i++)
+	{
+		cd_put32(note + PRSTATUS_REG + 4 * i, rpi2_reg_context.storage[i]);
+	}
+	cd_put32(note + PRSTATUS_REG + 4 * 17, rpi2_reg_context.reg.r0);
+	cd_put32(note + PRSTATUS_FPVALID, rpi2_neon_used ? 1 : 0);
+	p += PRSTATUS_SIZE;
+
+	// NT_ARM_VFP: d0-d31 + fpscr
+	if (rpi2_neon_used)
+	{
+		p = cd_put_note_hdr(p, "LINUX", ARM_VFP_SIZE, NT_ARM_VFP);
+		vfp = (uint32_t *)rpi2_neon_context.storage;
+		for (i=0; i<64; i++)
+		{
+			cd_put32(p + 4 * i, vfp[i]);
+		}
+		cd_put32(p + 256, rpi2_neon_context.fpscr);
+	}
+
+	cd_win_offs = 0;
+	cd_win_len = COREDUMP_HDR_SIZE + prefix_len;
+}
+
+// fills cd_win with the next non-zero page or the end record
+// returns 0 if the stream is complete
+static int cd_next_chunk()
+{
+	uint32_t i, acc;
+	int len;
+
+	cd_win_offs += cd_win_len;
+	cd_win_len = 0;
+	if (cd_state == CD_DONE)
+	{
+		return 0;
+	}
+	while (cd_seg < cd_num_segs)
+	{
+		if (cd_addr >= cd_segs[cd_seg].end)
+		{
+			cd_seg++;
+			if (cd_seg < cd_num_segs)
+			{
+				cd_addr = cd_segs[cd_seg].start;
+			}
+			continue;
+		}
+		// as gdb would see it - without breakpoints
+		gdb_copy_mem(cd_addr, (uint8_t *)cd_page, COREDUMP_PAGE);
+		cd_addr += COREDUMP_PAGE;
+		acc = 0;
+		for (i=0; i<COREDUMP_PAGE / 4; i++)
+		{
+			acc |= cd_page[i];
+		}
+		if (acc == 0)
+		{
+			continue; // left as a hole in the core file
+		}
+		cd_put32(cd_win, cd_addr - COREDUMP_PAGE);
+		len = lz_compress((uint8_t *)cd_page, COREDUMP_PAGE,
+				cd_win + COREDUMP_REC_SIZE, COREDUMP_PAGE - 1);
+		if (len < 0)
+		{
+			for (i=0; i<COREDUMP_PAGE; i++)
+			{
+				cd_win[COREDUMP_REC_SIZE + i] = ((uint8_t *)cd_page)[i];
+			}
+			len = COREDUMP_PAGE;
+			cd_put32(cd_win + 4, COREDUMP_RAW | (uint32_t)len);
+		}
+		else
+		{
+			cd_put32(cd_win + 4, (uint32_t)len);
+		}
+		cd_win_len = COREDUMP_REC_SIZE + (uint32_t)len;
+		return 1;
+	}
+	cd_put32(cd_win, COREDUMP_END);
+	cd_put32(cd_win + 4, 0);
+	cd_win_len = COREDUMP_REC_SIZE;
+	cd_state = CD_DONE;
+	return 1;
+}
+
+int coredump_start(char *args, int signal)
+{
+	uint32_t start, len;
+	int i;
+
+	cd_state = CD_IDLE;
+	cd_num_segs = 0;
+	while (*args != '\0')
+	{
+		i = util_read_num(args, (unsigned int *)&start);
+		if (i == 0) break;
+		args += i;
+		i = util_read_num(args, (unsigned int *)&len);
+		if (i == 0) return -1;
+		args += i;
+		if (cd_num_segs >= COREDUMP_MAX_SEGS) return -1;
+		// whole pages, and no peripherals - reads could have side effects
+		len = (start & (COREDUMP_PAGE - 1)) + len;
+		start &= ~(COREDUMP_PAGE - 1);
+		len = (len + COREDUMP_PAGE - 1) & ~(COREDUMP_PAGE - 1);
+		if ((len == 0) || (start + len < start) || (start + len > PERIPH_BASE))
+		{
+			return -1;
+		}
+		cd_segs[cd_num_segs].start = start;
+		cd_segs[cd_num_segs].end = start + len;
+		cd_num_segs++;
+	}
+	while (*args == ' ') args++;
+	if (*args != '\0') return -1;
+	if (cd_num_segs == 0)
+	{
+		cd_segs[0].start = COREDUMP_DEF_START;
+		cd_segs[0].end = COREDUMP_DEF_END;
+		cd_num_segs = 1;
+	}
+	cd_seg = 0;
+	cd_addr = cd_segs[0].start;
+	cd_build_prefix(signal);
+	cd_state = CD_PAGES;
+	return 0;
+}
+
+int coredump_read(unsigned int offset, unsigned char **data)
+{
+	if (cd_state == CD_IDLE)
+	{
+		return -1;
+	}
+	if (offset == cd_win_offs + cd_win_len)
+	{
+		if (!cd_next_chunk())
+		{
+			return 0;
+		}
+	}
+	if ((offset < cd_win_offs) || (offset >= cd_win_offs + cd_win_len))
+	{
+		return -1; // can't go back to earlier chunks
+	}
+	*data = cd_win + (offset - cd_win_offs);
+	return (int)(cd_win_len - (offset - cd_win_offs));
+}
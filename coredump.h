@@ -0,0 +1,48 @@
+/*
+coredump.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COREDUMP_H_
+#define COREDUMP_H_
+
+#define COREDUMP_MAX_SEGS 8
+#define COREDUMP_PAGE 4096
+
+// default dump range: all memory below the stub
+#define COREDUMP_DEF_START 0x00000000
+#define COREDUMP_DEF_END 0x1f000000
+
+// page record info-word
+#define COREDUMP_RAW (1 << 31) // page is stored uncompressed
+#define COREDUMP_LEN_MASK 0xffff
+#define COREDUMP_END 0xffffffff // vaddr of the end record
+
+// Prepares a core dump of the current debuggee state.
+// args: "[addr len]..." - segments to dump, default = all RAM below the stub
+// signal: the stop signal to put in the core
+// returns 0 on success, -1 on bad arguments
+int coredump_start(char *args, int signal);
+
+// Gives the dump stream from offset onwards. The stream is generated
+// on the fly, so offsets must advance sequentially (re-reading the
+// latest chunk is OK).
+// returns number of bytes available at *data, 0 at the end, -1 on error
+int coredump_read(unsigned int offset, unsigned char **data);
+
+#endif /* COREDUMP_H_ */
@@ -26,6 +26,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "instr.h"
 #include "log.h"
 #include "target_xml.h"
+#include "semihost.h"
+#include "coredump.h"
+#include "memdump.h"
+#include "pmu.h"
+#include "trace.h"
+#include "acctrace.h"
+#include "chan.h"
+#include "loadpipe.h"
+#include "stackmon.h"
+#include "unwind.h"
+#include "boottime.h"
+#include "hyp.h"
 
 #ifdef RPI2_NEON_SUPPORTED
 // tell stub to send architecture description xml
@@ -40,6 +52,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // SIG_USR1 = unhandled HW interrupt
 // SIG_USR2 = unhandled SW interrupt
 // SIG_STOP = Any undefined reason
+// SEMIHOSTING = semihosting call (handled with File-I/O)
+// BUDGET = monitor run-for budget used up
+// REATTACH = detached-run hook (UART break or GPIO) stopped the debuggee
+// CALL_RETURN = a function run with 'monitor call' returned
 
 // 'reasons' for target halt
 #define SIG_INT  RPI2_REASON_SIGINT
@@ -52,6 +68,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define ALOHA 32
 #define FINISHED 33
 #define PANIC 34
+#define SEMIHOSTING 35
+#define BUDGET RPI2_REASON_BUDGET
+#define REATTACH RPI2_REASON_REATTACH
+#define CALL_RETURN 38
 
 #define GDB_MAX_BREAKPOINTS 64
 #define GDB_MAX_WATCHPOINTS 4
@@ -67,7 +87,8 @@ typedef struct {
 	uint16_t thumb;
 	} instruction;
 	int trap_kind;
-	int valid;	// 1=valid
+	int valid;	// 1=valid (gdb's view)
+	int inserted; // 1=trap is in memory (see gdb_apply_breakpoints)
 } gdb_trap_rec;
 
 #ifdef GDB_FEATURE_XML
@@ -76,9 +97,12 @@ uint32_t gdb_xmlregs; // flag: whether neon regs are sent or not
 #endif
 
 // debug breakpoints set by user
-volatile gdb_trap_rec gdb_usr_breakpoint[GDB_MAX_BREAKPOINTS];
+gdb_trap_rec gdb_usr_breakpoint[GDB_MAX_BREAKPOINTS];
 // number of breakpoints in use
-volatile int gdb_num_bkpts = 0;
+int gdb_num_bkpts = 0;
+// slots from here up are unused - the loops run at each stop and resume
+// don't need to go through all of them (less of the stub in the caches)
+static int gdb_bkpt_top = 0;
 
 // watchpoint
 typedef struct {
@@ -92,16 +116,53 @@ typedef struct {
 } gdb_watch_rec;
 
 // debug breakpoints set by user
-volatile gdb_watch_rec gdb_usr_watchpoint[GDB_MAX_WATCHPOINTS];
+gdb_watch_rec gdb_usr_watchpoint[GDB_MAX_WATCHPOINTS];
 // number of breakpoints in use
-volatile int gdb_num_watchps = 0;
+int gdb_num_watchps = 0;
 
 // breakpoint for single-stepping
-volatile gdb_trap_rec gdb_step_bkpt;
+gdb_trap_rec gdb_step_bkpt;
 volatile int gdb_single_stepping = 0; // flag: 1 = currently single stepping
 static volatile uint32_t gdb_single_stepping_address = 0xffffffff; // step until this
 static volatile int gdb_trap_num = -1; // breakpoint number in case of bkpt
 static int gdb_resuming = -1; // flag for single stepping over resumed breakpoint
+// step policy: IRQ/FIQ masked during the step (rpi2_step_masked)
+#define GDB_PSR_IF 0xc0 // CPSR I and F bits
+static uint32_t gdb_step_masked; // flag: mask bits forced for the step
+static uint32_t gdb_step_saved_if; // original I/F of the stepped context
+static uint32_t gdb_step_saved_mode; // processor mode before the step
+static uint32_t gdb_step_instr; // the stepped instruction
+static uint32_t gdb_step_executed; // condition passed
+// step-to-address policy: run straight-line blocks with one breakpoint
+#define GDB_MAX_BLOCK_INSTRS 64
+static uint32_t gdb_step_blocks = 1;
+// stub memory non-cacheable (monitor stub-nocache)
+static uint32_t gdb_stub_nocache = 0;
+#define GDB_CACHEBENCH_RUNS 4
+// monitor call: the function runs in the debuggee context and returns
+// to the trampoline, which traps back into the stub
+#define GDB_CALL_MAX_ARGS 4
+#define GDB_CALL_MAX_RUNS 256
+static const uint32_t gdb_call_trampoline[1] = {RPI2_INTERNAL_BKPT};
+static int gdb_call_active; // flag: monitor call in progress
+static uint32_t gdb_call_addr;
+static uint32_t gdb_call_args[GDB_CALL_MAX_ARGS];
+static uint32_t gdb_call_runs; // calls asked
+static uint32_t gdb_call_run; // current run, 0 = overhead calibration
+static uint32_t gdb_call_overhead; // stub exit + entry cycles
+static uint32_t gdb_call_cycles[GDB_CALL_MAX_RUNS];
+static rpi2_reg_context_t gdb_call_saved; // registers at the stop
+// monitor runtests: the functions come from a table
+static uint32_t gdb_call_table; // 0 = monitor call
+static uint32_t gdb_test_passed;
+static uint32_t gdb_test_failed;
+static uint32_t gdb_test_exc;
+#define GDB_TEST_OUT_LEN 400 // results are sent in chunks of this
+static char gdb_test_out[GDB_TEST_OUT_LEN];
+// stop-time context push (QRpiStopPush)
+#define GDB_PUSH_MAX 448 // bytes per memory area - the hex fits in a packet
+static uint32_t gdb_push_stack; // bytes from sp upwards, 0 = none
+static uint32_t gdb_push_code; // bytes around pc, 0 = none
 // program to be debugged
 volatile gdb_program_rec gdb_debuggee;
 
@@ -109,13 +170,16 @@ volatile gdb_program_rec gdb_debuggee;
 volatile io_device *gdb_iodev;
 
 // gdb I/O packet buffers
-static volatile uint8_t gdb_in_packet[GDB_MAX_MSG_LEN]; // packets from gdb
-static volatile uint8_t gdb_out_packet[GDB_MAX_MSG_LEN]; // packets to gdb
-static volatile uint8_t gdb_tmp_packet[GDB_MAX_MSG_LEN]; // for building packets
+static uint8_t gdb_in_packet[GDB_MAX_MSG_LEN]; // packets from gdb
+static uint8_t gdb_out_packet[GDB_MAX_MSG_LEN]; // packets to gdb
+static uint8_t gdb_tmp_packet[GDB_MAX_MSG_LEN]; // for building packets
+// memory reads with breakpoints masked out
+static uint8_t gdb_mask_buff[GDB_MAX_MSG_LEN];
 
 // features
 static uint32_t gdb_swbreak;
 static uint32_t gdb_hwbreak;
+static uint32_t gdb_binupload; // 'x' replies with 'b'-prefix
 
 // flag: 0 = return to debuggee, 1 = stay in monitor
 static volatile int gdb_monitor_running = 0;
@@ -135,6 +199,16 @@ void gdb_monitor(int reason);
 
 // resume needs this
 void gdb_do_single_step();
+void gdb_apply_breakpoints();
+static void gdb_unmask_breakpoints(uint32_t addr, uint32_t bytes);
+
+#ifdef DEBUG_GDB
+static void gdb_supported_test();
+#endif
+
+// stop-time context push
+static void gdb_stop_push();
+static int gdb_regs_to_hex(char *dst, int max);
 
 // packet sending
 int gdb_send_packet(char *src, int count);
@@ -160,7 +234,7 @@ int gdb_check_breakpoint()
 	// user breakpoint?
 	if (num == -1)
 	{
-		for (i=0; i<GDB_MAX_BREAKPOINTS; i++)
+		for (i=0; i<gdb_bkpt_top; i++)
 		{
 			//LOG_PR_VAL("bkpt addr= ", (unsigned int)(gdb_usr_breakpoint[i].trap_address));
 			//LOG_PR_VAL_CONT(" valid= ", (unsigned int)(gdb_usr_breakpoint[i].valid));
@@ -190,7 +264,7 @@ void gdb_clear_breakpoints(int remove_traps)
 		if (remove_traps)
 		{
 			// restore 'bkpts'
-			if (gdb_usr_breakpoint[i].valid)
+			if (gdb_usr_breakpoint[i].inserted)
 			{
 				tmp = (uint32_t *)gdb_usr_breakpoint[i].trap_address;
 				*tmp = gdb_usr_breakpoint[i].instruction.arm;
@@ -201,8 +275,10 @@ void gdb_clear_breakpoints(int remove_traps)
 		gdb_usr_breakpoint[i].trap_address = (void *)0xffffffff;
 		gdb_usr_breakpoint[i].instruction.arm = 0;
 		gdb_usr_breakpoint[i].valid = 0;
+		gdb_usr_breakpoint[i].inserted = 0;
 	}
 	gdb_num_bkpts = 0;
+	gdb_bkpt_top = 0;
 	// clean up single stepping breakpoints
 	if (remove_traps)
 	{
@@ -315,6 +391,7 @@ void gdb_trap_handler()
 	char *msg;
 	static char scratchpad[16];
 #endif
+	pmu_budget_pause(); // count only debuggee execution
 	gdb_trap_num = -1;
 	reason = exception_info;
 
@@ -354,7 +431,12 @@ void gdb_trap_handler()
 			break;
 		case RPI2_EXC_PABT:
 			// bkpt (ARM) or bkpt (THUMB)
-			if ((exception_extra == RPI2_TRAP_ARM) || (exception_extra == RPI2_TRAP_THUMB))
+			if ((exception_extra == RPI2_TRAP_ARM) && gdb_call_active
+					&& (rpi2_reg_context.reg.r15 == (uint32_t)gdb_call_trampoline))
+			{
+				reason = CALL_RETURN;
+			}
+			else if ((exception_extra == RPI2_TRAP_ARM) || (exception_extra == RPI2_TRAP_THUMB))
 			{
 				gdb_trap_num = gdb_check_breakpoint();
 				if (gdb_trap_num < 0)
@@ -377,6 +459,10 @@ void gdb_trap_handler()
 			{
 				reason = ALOHA;
 			}
+			else if (exception_extra == RPI2_TRAP_SEMIHOST)
+			{
+				reason = SEMIHOSTING;
+			}
 			else // pabt
 			{
 				reason = SIG_BUS;
@@ -387,6 +473,12 @@ void gdb_trap_handler()
 			{
 				reason = SIG_TRAP;
 			}
+			else if ((exception_extra == RPI2_TRAP_ACCESS) && acctrace_fault())
+			{
+				// access traced and done - continue without gdb
+				pmu_budget_resume();
+				return;
+			}
 			else
 			{
 				reason = SIG_EMT;
@@ -396,7 +488,14 @@ void gdb_trap_handler()
 			reason = SIG_ILL;
 			break;
 		case RPI2_EXC_SVC:
-			reason = SIG_USR2;
+			if (exception_extra == RPI2_TRAP_SEMIHOST)
+			{
+				reason = SEMIHOSTING;
+			}
+			else
+			{
+				reason = SIG_USR2;
+			}
 			break;
 		case RPI2_EXC_AUX:
 			reason = SIG_USR2;
@@ -426,6 +525,9 @@ void gdb_init(io_device *device)
 {
 	/* store I/O device to be used */
 	gdb_iodev = device;
+#ifdef DEBUG_GDB
+	gdb_supported_test(); // before the feature flags are reset
+#endif
 	// number of breakpoints in use
 	gdb_num_bkpts = 0;
 	gdb_single_stepping = 0; // flag: 0 = currently not single stepping
@@ -434,6 +536,7 @@ void gdb_init(io_device *device)
 	gdb_resuming = -1; // flag for single stepping over resumed breakpoint
 	gdb_swbreak = 0;
 	gdb_hwbreak = 0;
+	gdb_binupload = 0;
 	// flag: 0 = return to debuggee, 1 = stay in monitor
 	gdb_monitor_running = 0;
 	gdb_dyn_debug = 0;
@@ -483,13 +586,16 @@ void gdb_reset(int remove_traps)
 	gdb_debuggee.status = 0;
 }
 
+// Z0/z0 only change the breakpoint table (gdb's view). Memory is
+// changed in gdb_apply_breakpoints() when the debuggee is resumed, so
+// that z0-Z0 pairs sent on each stop and resume cost nothing.
+
 /* set a breakpoint to given address */
 /* returns -1 if trap can't be set */
 int dgb_set_trap(void *address, int kind)
 {
 	int i;
-	// char dbg_help[32];
-	// char scratchpad[10];
+	int free = -1;
 	uint32_t *p = (uint32_t *) address;
 	if (gdb_num_bkpts == GDB_MAX_BREAKPOINTS)
 	{
@@ -497,40 +603,49 @@ int dgb_set_trap(void *address, int kind)
 	}
 	for (i=0; i<GDB_MAX_BREAKPOINTS; i++)
 	{
-		if (!gdb_usr_breakpoint[i].valid)
+		if ((!gdb_usr_breakpoint[i].valid) && gdb_usr_breakpoint[i].inserted)
 		{
-			gdb_usr_breakpoint[i].instruction.arm = *p;
-			gdb_usr_breakpoint[i].trap_address = p;
-			gdb_usr_breakpoint[i].trap_kind = kind;
-			gdb_usr_breakpoint[i].valid = 1;
-			gdb_num_bkpts++;
-			rpi2_set_trap(address, kind);
-			/*
-			util_str_copy(dbg_help, "Oset trap: i =", 25);
-			util_word_to_hex(scratchpad, i);
-			scratchpad[8]='\0'; // end-nul
-			util_append_str(dbg_help, scratchpad, 32);
-			util_append_str(dbg_help, "\r\n", 32);
-			//gdb_iodev->put_string(dbg_help, util_str_len(dbg_help)+1);
-			gdb_send_packet(dbg_help, util_str_len(dbg_help));
-			*/
-			return 0; // success
+			// removed by gdb, but still in memory
+			if ((gdb_usr_breakpoint[i].trap_address == p)
+					&& (gdb_usr_breakpoint[i].trap_kind == kind))
+			{
+				gdb_usr_breakpoint[i].valid = 1; // nothing to do
+				gdb_num_bkpts++;
+				return 0; // success
+			}
+		}
+		else if ((!gdb_usr_breakpoint[i].valid) && (free < 0))
+		{
+			free = i;
 		}
 	}
-	return 3; // failure - something wrong with the table
+	if (free < 0)
+	{
+		// all free entries are waiting for removal
+		gdb_apply_breakpoints();
+		return dgb_set_trap(address, kind);
+	}
+	gdb_usr_breakpoint[free].trap_address = p;
+	gdb_usr_breakpoint[free].trap_kind = kind;
+	gdb_usr_breakpoint[free].valid = 1;
+	gdb_usr_breakpoint[free].inserted = 0; // inserted at resume
+	gdb_num_bkpts++;
+	if (free >= gdb_bkpt_top)
+	{
+		gdb_bkpt_top = free + 1;
+	}
+	return 0; // success
 }
 
 int dgb_unset_trap(void *address, int kind)
 {
 	int i;
-	// char dbg_help[32];
-	char scratchpad[10];
 	uint32_t *p = (uint32_t *) address;
 	if (gdb_num_bkpts == 0)
 	{
 		return 1;
 	}
-	for (i=0; i<GDB_MAX_BREAKPOINTS; i++)
+	for (i=0; i<gdb_bkpt_top; i++)
 	{
 		if (gdb_usr_breakpoint[i].valid)
 		{
@@ -538,27 +653,14 @@ int dgb_unset_trap(void *address, int kind)
 			{
 				if (gdb_usr_breakpoint[i].trap_kind == kind)
 				{
-					gdb_usr_breakpoint[i].trap_address = (void *)0xffffffff;
 					gdb_usr_breakpoint[i].valid = 0;
 					gdb_num_bkpts--;
-					*p = gdb_usr_breakpoint[i].instruction.arm;
-					rpi2_flush_address((unsigned int)p);
-					asm volatile("dsb\n\tisb\n\t");
-#ifdef DEBUG_GDB_EXC
-					util_word_to_hex(scratchpad, (unsigned int) p);
-					gdb_iodev->put_string("\r\ninstr at: ", 13);
-					gdb_iodev->put_string(scratchpad, 9);
-					gdb_iodev->put_string("\r\n", 3);
-#endif
-					/*
-					util_str_copy(dbg_help,"Ounset trap: i =", 25);
-					util_word_to_hex(scratchpad, i);
-					scratchpad[8]='\0'; // end-nul
-					util_append_str(dbg_help, scratchpad, 32);
-					util_append_str(dbg_help, "\r\n", 32);
-					//gdb_iodev->put_string(dbg_help, util_str_len(dbg_help)+1);
-					gdb_send_packet(dbg_help, util_str_len(dbg_help));
-					*/
+					if (!gdb_usr_breakpoint[i].inserted)
+					{
+						// never got to memory
+						gdb_usr_breakpoint[i].trap_address = (void *)0xffffffff;
+					}
+					// else removed from memory at resume
 					return 0; // success
 				}
 				else
@@ -571,6 +673,181 @@ int dgb_unset_trap(void *address, int kind)
 	return 3; // failure - not found
 }
 
+// make memory match the breakpoint table - called before resuming
+void gdb_apply_breakpoints()
+{
+	int i;
+	int changed = 0;
+	gdb_trap_rec *bkpt;
+
+	for (i=0; i<gdb_bkpt_top; i++)
+	{
+		bkpt = &(gdb_usr_breakpoint[i]);
+		if (bkpt->valid && (!bkpt->inserted))
+		{
+			// new breakpoint - a removed one of another kind at the same
+			// place goes first, so that the original instruction is saved
+			gdb_unmask_breakpoints((uint32_t)(bkpt->trap_address),
+					(bkpt->trap_kind == RPI2_TRAP_THUMB) ? 2 : 4);
+			if (bkpt->trap_kind == RPI2_TRAP_THUMB)
+			{
+				bkpt->instruction.thumb = *((uint16_t *)(bkpt->trap_address));
+				*((uint16_t *)(bkpt->trap_address)) = RPI2_USER_BKPT_THUMB;
+			}
+			else
+			{
+				bkpt->instruction.arm = *((uint32_t *)(bkpt->trap_address));
+				*((uint32_t *)(bkpt->trap_address)) = RPI2_USER_BKPT_ARM;
+			}
+			rpi2_flush_address((unsigned int)(bkpt->trap_address));
+			bkpt->inserted = 1;
+			changed = 1;
+		}
+		else if ((!bkpt->valid) && bkpt->inserted)
+		{
+			// removed breakpoint
+			if (bkpt->trap_kind == RPI2_TRAP_THUMB)
+			{
+				*((uint16_t *)(bkpt->trap_address)) = bkpt->instruction.thumb;
+			}
+			else
+			{
+				*((uint32_t *)(bkpt->trap_address)) = bkpt->instruction.arm;
+			}
+			rpi2_flush_address((unsigned int)(bkpt->trap_address));
+			bkpt->trap_address = (void *)0xffffffff;
+			bkpt->inserted = 0;
+			changed = 1;
+		}
+	}
+	if (changed)
+	{
+		SYNC;
+	}
+}
+
+// does the range overlap a breakpoint that gdb has removed
+// but which is still in memory
+static int gdb_stale_breakpoint(int i, uint32_t addr, uint32_t bytes)
+{
+	uint32_t bkpt_addr;
+	uint32_t bkpt_size;
+
+	if (gdb_usr_breakpoint[i].valid || (!gdb_usr_breakpoint[i].inserted))
+	{
+		return 0;
+	}
+	bkpt_addr = (uint32_t)(gdb_usr_breakpoint[i].trap_address);
+	bkpt_size = (gdb_usr_breakpoint[i].trap_kind == RPI2_TRAP_THUMB) ? 2 : 4;
+	return ((bkpt_addr < addr + bytes) && (bkpt_addr + bkpt_size > addr));
+}
+
+// memory as gdb expects to see it - with removed breakpoints masked
+// out. The returned buffer may be the memory itself.
+static uint8_t *gdb_mask_breakpoints(uint32_t addr, uint32_t *bytes)
+{
+	int i;
+	uint32_t j, offs, size;
+	uint8_t *instr;
+	int copied = 0;
+
+	if (*bytes > GDB_MAX_MSG_LEN)
+	{
+		*bytes = GDB_MAX_MSG_LEN; // more wouldn't fit in a packet anyway
+	}
+	for (i=0; i<gdb_bkpt_top; i++)
+	{
+		if (gdb_stale_breakpoint(i, addr, *bytes))
+		{
+			if (!copied)
+			{
+				for (j=0; j<*bytes; j++)
+				{
+					gdb_mask_buff[j] = ((uint8_t *)addr)[j];
+				}
+				copied = 1;
+			}
+			// put the original instruction in place
+			instr = (uint8_t *)&(gdb_usr_breakpoint[i].instruction);
+			size = (gdb_usr_breakpoint[i].trap_kind == RPI2_TRAP_THUMB) ? 2 : 4;
+			for (j=0; j<size; j++)
+			{
+				offs = (uint32_t)(gdb_usr_breakpoint[i].trap_address) + j;
+				if ((offs >= addr) && (offs < addr + *bytes))
+				{
+					gdb_mask_buff[offs - addr] = instr[j];
+				}
+			}
+		}
+	}
+	if (copied)
+	{
+		return gdb_mask_buff;
+	}
+	return (uint8_t *)addr;
+}
+
+// memory is written - remove the removed breakpoints in the range for real
+static void gdb_unmask_breakpoints(uint32_t addr, uint32_t bytes)
+{
+	int i;
+	int changed = 0;
+
+	for (i=0; i<gdb_bkpt_top; i++)
+	{
+		if (gdb_stale_breakpoint(i, addr, bytes))
+		{
+			if (gdb_usr_breakpoint[i].trap_kind == RPI2_TRAP_THUMB)
+			{
+				*((uint16_t *)(gdb_usr_breakpoint[i].trap_address)) =
+						gdb_usr_breakpoint[i].instruction.thumb;
+			}
+			else
+			{
+				*((uint32_t *)(gdb_usr_breakpoint[i].trap_address)) =
+						gdb_usr_breakpoint[i].instruction.arm;
+			}
+			rpi2_flush_address((unsigned int)(gdb_usr_breakpoint[i].trap_address));
+			gdb_usr_breakpoint[i].trap_address = (void *)0xffffffff;
+			gdb_usr_breakpoint[i].inserted = 0;
+			changed = 1;
+		}
+	}
+	if (changed)
+	{
+		SYNC;
+	}
+}
+
+// copy of the debuggee memory without any breakpoints (for core dumps)
+void gdb_copy_mem(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+	int i;
+	uint32_t j, offs, size;
+	uint8_t *instr;
+
+	for (j=0; j<len; j++)
+	{
+		buf[j] = ((uint8_t *)addr)[j];
+	}
+	for (i=0; i<gdb_bkpt_top; i++)
+	{
+		if (gdb_usr_breakpoint[i].inserted)
+		{
+			instr = (uint8_t *)&(gdb_usr_breakpoint[i].instruction);
+			size = (gdb_usr_breakpoint[i].trap_kind == RPI2_TRAP_THUMB) ? 2 : 4;
+			for (j=0; j<size; j++)
+			{
+				offs = (uint32_t)(gdb_usr_breakpoint[i].trap_address) + j;
+				if ((offs >= addr) && (offs < addr + len))
+				{
+					buf[offs - addr] = instr[j];
+				}
+			}
+		}
+	}
+}
+
 int dgb_add_watchpoint(uint32_t type, uint32_t addr, uint32_t bytes)
 {
 	uint32_t i;
@@ -772,7 +1049,7 @@ int gdb_write_bin_data(uint8_t *indata, int count, uint8_t *bindata, int max)
 		j += len;
 		i++;
 	}
-	return i;
+	return j;
 }
 
 // return value gives the number of bytes received (from the hexdata buffer)
@@ -1132,6 +1409,35 @@ int gdb_send_packet(char *src, int count)
 	return cnt;
 }
 
+// '%'-notification - not acked, so it has its own buffer
+// and a '-' doesn't resend it
+static void gdb_send_notification(char *src, int count)
+{
+	static char buf[GDB_MAX_MSG_LEN];
+	int checksum = 0;
+	int cnt = 0;
+	int wbc;
+
+	if (count > GDB_MAX_MSG_LEN - 4)
+	{
+		return;
+	}
+	buf[cnt++] = '%';
+	while (count-- > 0)
+	{
+		checksum += (int)(buf[cnt++] = *(src++));
+	}
+	buf[cnt++] = '#';
+	buf[cnt++] = (char)util_nib_to_hex((checksum & 0xf0) >> 4);
+	buf[cnt++] = (char)util_nib_to_hex(checksum & 0x0f);
+	wbc = gdb_iodev->write(buf, cnt);
+	while (wbc < cnt)
+	{
+		cnt -= wbc;
+		wbc = gdb_iodev->write(buf + wbc, cnt);
+	}
+}
+
 void gdb_packet_ack()
 {
 	//gdb_iodev->put_string("$+#2b", 6);
@@ -1187,6 +1493,7 @@ void gdb_resp_target_halted(int reason)
 	switch(reason)
 	{
 	case SIG_INT: // ctrl-C
+	case REATTACH: // detached-run hook
 		// S02 - response for ctrl-C
 		len = util_str_copy(resp_buff, "S02", resp_buff_len);
 		break;
@@ -1296,6 +1603,20 @@ void gdb_resp_target_halted(int reason)
 		//gdb_send_packet(resp_buff, len);
 		len = util_str_copy(resp_buff, "T1f", resp_buff_len);
 		break;
+	case SEMIHOSTING: // stopped in a semihosting call
+		len = util_str_copy(resp_buff, "T05", resp_buff_len);
+		break;
+	case BUDGET: // monitor run-for
+		text = (pmu_budget_kind() == PMU_BUDGET_CYCLES)
+				? "rpi_stub: cycle budget used up, cycles: "
+				: "rpi_stub: instruction budget used up, instructions: ";
+		len = util_str_copy(resp_buff, text, resp_buff_len);
+		util_word_to_dec(scratchpad, pmu_budget_used());
+		len = util_append_str(resp_buff, scratchpad, resp_buff_len);
+		len = util_append_str(resp_buff, "\n", resp_buff_len);
+		gdb_send_text_packet(resp_buff, len);
+		len = util_str_copy(resp_buff, "T05", resp_buff_len);
+		break;
 	case ALOHA: // no debuggee loaded yet - no defined response
 		// send 'Ogdb stub started'
 		//len = util_str_copy(resp_buff, "Ogdb stub started\n", resp_buff_len);
@@ -1334,6 +1655,88 @@ void gdb_resp_target_halted(int reason)
 	}
 	// send response
 	gdb_send_packet(resp_buff, len);
+	if (reason != FINISHED)
+	{
+		gdb_stop_push();
+	}
+}
+
+// %RpiStop:m:addr,length:XX... - memory as an 'm' reply would give it
+static void gdb_push_mem(uint32_t addr, uint32_t bytes)
+{
+	char *buf = (char *)gdb_tmp_packet;
+	uint8_t *data;
+	int len;
+
+	// no peripherals - reads could have side effects
+	if ((addr + bytes < addr) || (addr + bytes > PERIPH_BASE))
+	{
+		return;
+	}
+	data = gdb_mask_breakpoints(addr, &bytes);
+	len = util_str_copy(buf, "RpiStop:m:", GDB_MAX_MSG_LEN);
+	util_word_to_hex(buf + len, addr);
+	len += 8;
+	buf[len++] = ',';
+	util_word_to_hex(buf + len, bytes);
+	len += 8;
+	buf[len++] = ':';
+	len += gdb_write_hex_data(data, (int)bytes, buf + len, GDB_MAX_MSG_LEN - 5 - len);
+	gdb_send_notification(buf, len);
+}
+
+// Sent after a stop reply if asked with QRpiStopPush, for host side
+// caches: %RpiStop:g:<'g' reply>, the stack and code windows as
+// %RpiStop:m:..., and %RpiStop:end
+static void gdb_stop_push()
+{
+	char *buf = (char *)gdb_tmp_packet;
+	int len;
+
+	if (!gdb_push_stack && !gdb_push_code)
+	{
+		return;
+	}
+	len = util_str_copy(buf, "RpiStop:g:", GDB_MAX_MSG_LEN);
+	len += gdb_regs_to_hex(buf + len, GDB_MAX_MSG_LEN - 5 - len);
+	gdb_send_notification(buf, len);
+	if (gdb_push_stack)
+	{
+		gdb_push_mem(rpi2_reg_context.reg.r13 & ~3, gdb_push_stack);
+	}
+	if (gdb_push_code)
+	{
+		gdb_push_mem((rpi2_reg_context.reg.r15 - gdb_push_code / 2) & ~3,
+				gdb_push_code);
+	}
+	gdb_send_notification("RpiStop:end", 11);
+}
+
+// QRpiStopPush:stack,code - bytes of stack and code to push at stops
+void gdb_cmd_stop_push(char *gdb_in_packet, int packet_len)
+{
+	int len;
+	const int scratch_len = 16;
+	char scratchpad[scratch_len]; // scratchpad
+
+	(void) packet_len;
+	len = util_cpy_substr(scratchpad, gdb_in_packet, ',', scratch_len);
+	if (gdb_in_packet[len] != ',')
+	{
+		gdb_send_packet("E01", 3);
+		return;
+	}
+	gdb_push_stack = util_hex_to_word(scratchpad);
+	gdb_push_code = util_hex_to_word(gdb_in_packet + len + 1);
+	if (gdb_push_stack > GDB_PUSH_MAX)
+	{
+		gdb_push_stack = GDB_PUSH_MAX;
+	}
+	if (gdb_push_code > GDB_PUSH_MAX)
+	{
+		gdb_push_code = GDB_PUSH_MAX;
+	}
+	gdb_send_packet("OK", 2);
 }
 
 // c [addr]
@@ -1360,6 +1763,7 @@ void gdb_cmd_cont(char *src, int len)
 		rpi2_reg_context.reg.r15 = (unsigned int)(&loader_main);
 	}
 	*/
+	gdb_apply_breakpoints(); // net effect of z0/Z0s
 	gdb_monitor_running = 0; // return
 	rpi2_debuggee_running = 1;
 	//gdb_dyn_debug = 1;
@@ -1369,25 +1773,74 @@ void gdb_cmd_cont(char *src, int len)
 		rpi2_invalidate_caches();
 	}
 #endif
+	pmu_budget_resume(); // as late as possible
+}
+
+// the 'g' reply (registers in hex) into dst, returns the length
+static int gdb_regs_to_hex(char *dst, int max)
+{
+	int i, regbytes;
+	static char tmp_buff[512]; // response buff
+	uint32_t *p1, *p2;
+
+	// response for 'g' - regs r0 - r15
+	p1 = (uint32_t *)&(rpi2_reg_context.storage);
+	p2 = (uint32_t *)tmp_buff;
+	for (i=0; i<16; i++) // r0 - r15
+	{
+		*(p2++) = *(p1++);
+	}
+	regbytes = 16*4;
+
+#ifdef RPI2_NEON_SUPPORTED
+	if (!gdb_xmlregs)
+	{
+		for (i=16; i<25; i++) // 8 x fp + fps (all dummy)
+		{
+			*(p2++) = 0x90000009;
+		}
+		regbytes += 9*4;
+	}
+#else
+	for (i=16; i<25; i++) // 8 x fp + fps (all dummy)
+	{
+		*(p2++) = 0x90000009;
+		regbytes += 9*4;
+	}
+#endif
+	// p1 = (char *)&(rpi2_reg_context.reg.cpsr);
+	// util_swap_bytes(p1, p2);
+	*(p2++) = rpi2_reg_context.reg.cpsr;
+	regbytes += 4;
+#ifdef RPI2_NEON_SUPPORTED
+	// Neon-registers (low word first)
+	if (gdb_xmlregs)
+	{
+		p1 = (uint32_t *)&rpi2_neon_context;
+		for(i=0; i<32*2; i++)
+		{
+			*(p2++) = *(p1++);
+		}
+		regbytes += 32*8;
+		*(p2++) = rpi2_neon_context.fpscr;
+		regbytes += 4;
+		//*p2 = '\0'; // just in case
+	}
+#endif
+	return gdb_write_hex_data((uint8_t *)tmp_buff, regbytes, dst, max);
 }
 
 // g
 void gdb_cmd_get_regs(char *gdb_in_packet, int packet_len)
 {
-	int len, i, regbytes;
+	int len;
 	//const int resp_buff_len = 512; // should be enough to hold 'g' response
 	//static char resp_buff[512]; // response buff
-	static char tmp_buff[512]; // response buff
 
 	(void) gdb_in_packet;
 #if 0
 	char scratchpad[16]; // scratchpad
 #endif
-#if 0
-	char *p1, *p2;
-#else
-	uint32_t *p1, *p2;
-#endif
 #if 0
 	util_word_to_hex(scratchpad, packet_len);
 	gdb_iodev->put_string("\r\ng_cmd: ", 10);
@@ -1400,51 +1853,7 @@ void gdb_cmd_get_regs(char *gdb_in_packet, int packet_len)
 	LOG_PR_VAL_CONT(" rpi2_neon_used: ", rpi2_neon_used);
 	if (packet_len >= 0)
 	{
-		// response for 'g' - regs r0 - r15
-		p1 = (uint32_t *)&(rpi2_reg_context.storage);
-		p2 = (uint32_t *)tmp_buff;
-		for (i=0; i<16; i++) // r0 - r15
-		{
-			*(p2++) = *(p1++);
-		}
-		regbytes = 16*4;
-
-#ifdef RPI2_NEON_SUPPORTED
-		if (!gdb_xmlregs)
-		{
-			for (i=16; i<25; i++) // 8 x fp + fps (all dummy)
-			{
-				*(p2++) = 0x90000009;
-			}
-			regbytes += 9*4;
-		}
-#else
-		for (i=16; i<25; i++) // 8 x fp + fps (all dummy)
-		{
-			*(p2++) = 0x90000009;
-			regbytes += 9*4;
-		}
-#endif
-		// p1 = (char *)&(rpi2_reg_context.reg.cpsr);
-		// util_swap_bytes(p1, p2);
-		*(p2++) = rpi2_reg_context.reg.cpsr;
-		regbytes += 4;
-#ifdef RPI2_NEON_SUPPORTED
-		// Neon-registers (low word first)
-		if (gdb_xmlregs)
-		{
-			p1 = (uint32_t *)&rpi2_neon_context;
-			for(i=0; i<32*2; i++)
-			{
-				*(p2++) = *(p1++);
-			}
-			regbytes += 32*8;
-			*(p2++) = rpi2_neon_context.fpscr;
-			regbytes += 4;
-			//*p2 = '\0'; // just in case
-		}
-#endif
-		len = gdb_write_hex_data((uint8_t *)tmp_buff, regbytes, (char *)gdb_tmp_packet, GDB_MAX_MSG_LEN);
+		len = gdb_regs_to_hex((char *)gdb_tmp_packet, GDB_MAX_MSG_LEN);
 #if 0
 		util_word_to_hex(scratchpad, len);
 		gdb_iodev->put_string("\r\ng_cmd2: ", 10);
@@ -1583,7 +1992,8 @@ void gdb_cmd_read_mem_hex(char *gdb_in_packet, int packet_len)
 		addr = util_hex_to_word(scratchpad); // address to binary
 		bytes = util_hex_to_word((char *)gdb_in_packet); // read nuber of bytes
 		// dump memory as hex into temp buffer
-		len = gdb_write_hex_data((uint8_t *)addr, (int)bytes, (char *)gdb_tmp_packet,
+		len = gdb_write_hex_data(gdb_mask_breakpoints(addr, &bytes), (int)bytes,
+				(char *)gdb_tmp_packet,
 				 GDB_MAX_MSG_LEN - 5); // -5 to allow message overhead
 #ifdef DEBUG_GDB
 		gdb_iodev->put_string("\r\nm_cmd: addr= ", 16);
@@ -1634,6 +2044,7 @@ void gdb_cmd_write_mem_hex(char *gdb_in_packet, int packet_len)
 		gdb_iodev->put_string("\r\n", 3);
 #endif
 		// write to memory
+		gdb_unmask_breakpoints(addr, bytes);
 		gdb_read_hex_data((uint8_t *)gdb_in_packet, (int)bytes, (uint8_t *) addr,
 				GDB_MAX_MSG_LEN); // can't be more than message size
 		// send response
@@ -1641,264 +2052,1905 @@ void gdb_cmd_write_mem_hex(char *gdb_in_packet, int packet_len)
 	}
 }
 
-// p n
-void gdb_cmd_read_reg(char *gdb_in_packet, int packet_len)
+// qRpiMemRead:addr,length;addr,length;...
+// all areas in one reply, as concatenated hex
+void gdb_cmd_read_mem_multi(char *gdb_in_packet, int packet_len)
 {
-	unsigned int value, tmp;
-	unsigned long long dvalue, dtmp;
-	uint32_t reg;
-	char *err = "E00";
-	const int scratch_len = 32;
+	uint32_t addr;
+	uint32_t bytes;
+	int len;
+	int pos = 0;
+	char *err = "E01";
+	const int scratch_len = 16;
 	char scratchpad[scratch_len]; // scratchpad
-	if (packet_len > 0)
+
+	while (packet_len > 0)
 	{
-		reg = (uint32_t)util_hex_to_word((char *)gdb_in_packet);
-		if (reg < 16)
-		{
-			//p = (uint32_t *) &(rpi2_reg_context.storage);
-			//value = p[reg];
-			value = rpi2_reg_context.storage[reg];
-			util_swap_bytes(&value, &tmp);
-			util_word_to_hex(scratchpad, tmp);
-			gdb_send_packet(scratchpad, util_str_len(scratchpad));
-		}
-		else if ((reg > 15) && (reg < 25)) // dummy fp-register
-		{
-			util_word_to_hex(scratchpad, 0x90000009);
-			util_swap_bytes(&value, &tmp);
-			util_word_to_hex(scratchpad, tmp);
-			gdb_send_packet(scratchpad, util_str_len(scratchpad));
-		}
-		else if (reg == 25) // cpsr
-		{
-			//p = (uint32_t *) &(rpi2_reg_context.storage);
-			//value = p[reg];
-			value = rpi2_reg_context.reg.cpsr;
-			util_swap_bytes(&value, &tmp);
-			util_word_to_hex(scratchpad, tmp);
-			gdb_send_packet(scratchpad, util_str_len(scratchpad));
-		}
-#ifdef RPI2_NEON_SUPPORTED
-		else if (gdb_xmlregs)
+		len = util_cpy_substr(scratchpad, (char *)gdb_in_packet, ',', scratch_len);
+		if (gdb_in_packet[len] != ',') break;
+		gdb_in_packet += len+1; // skip address and delimiter
+		packet_len -= (len+1);
+		addr = util_hex_to_word(scratchpad);
+		len = util_cpy_substr(scratchpad, (char *)gdb_in_packet, ';', scratch_len);
+		gdb_in_packet += len;
+		packet_len -= len;
+		bytes = util_hex_to_word(scratchpad);
+		if (*gdb_in_packet == ';')
 		{
-			if ((reg > 25) && (reg < 58))
-			{
-				reg -= 26; // gdb reg number -> storage item
-				dvalue = rpi2_neon_context.storage[reg];
-				util_swap_bytesd(&dvalue, &dtmp);
-				util_dword_to_hex(scratchpad, dtmp);
-				gdb_send_packet(scratchpad, util_str_len(scratchpad));
-			}
-			else if (reg == 58)
-			{
-				value = rpi2_neon_context.fpscr;
-				util_swap_bytes(&value, &tmp);
-				util_word_to_hex(scratchpad, tmp);
-				gdb_send_packet(scratchpad, util_str_len(scratchpad));
-			}
-			else
-			{
-				gdb_send_packet(err, util_str_len(err));
-			}
+			gdb_in_packet++;
+			packet_len--;
 		}
-#endif
-		else
+		// all must fit, -5 to allow message overhead - compared unsigned,
+		// the length comes from the client
+		if (bytes > (uint32_t)(GDB_MAX_MSG_LEN - 5 - pos) / 2)
 		{
-			gdb_send_packet(err, util_str_len(err));
+			err = "E02";
+			break;
 		}
-#ifdef DEBUG_GDB
-		gdb_iodev->put_string("\r\np_cmd: ", 10);
-		util_word_to_hex(scratchpad, reg);
-		gdb_iodev->put_string(scratchpad, 10);
-		gdb_iodev->put_string(" : ", 4);
-		util_word_to_hex(scratchpad, tmp);
-		gdb_iodev->put_string(scratchpad, 10);
-		gdb_iodev->put_string("\r\n", 3);
-#endif
+		pos += gdb_write_hex_data(gdb_mask_breakpoints(addr, &bytes), (int)bytes,
+				(char *)(gdb_tmp_packet + pos), GDB_MAX_MSG_LEN - 5 - pos);
+	}
+	if ((packet_len > 0) || (pos == 0))
+	{
+		gdb_send_packet(err, util_str_len(err));
+		return;
 	}
+	gdb_send_packet((char *)gdb_tmp_packet, pos);
 }
 
-// P n...=r...
-void gdb_cmd_write_reg(char *gdb_in_packet, int packet_len)
+// QRpiMemWrite:addr,length:XX...;addr,length:XX...;...
+void gdb_cmd_write_mem_multi(char *gdb_in_packet, int packet_len)
 {
+	uint32_t addr;
+	uint32_t bytes;
 	int len;
 	char *resp_str = "OK";
-	const int scratch_len = 32;
+	const int scratch_len = 16;
 	char scratchpad[scratch_len]; // scratchpad
-	unsigned int value, tmp;
-	unsigned long long dvalue, dtmp;
-	uint32_t reg;
-	char *err = "E00";
-	if (packet_len > 0)
+
+	while (packet_len > 0)
 	{
-		len = util_cpy_substr(scratchpad, (char *)gdb_in_packet, '=', scratch_len);
-		reg = (uint32_t)util_hex_to_word(scratchpad);
-		gdb_in_packet += (len + 1);  // skip register number and '='
-		packet_len -= (len + 1);
-#ifdef DEBUG_GDB
-		gdb_iodev->put_string((char *)gdb_in_packet, packet_len);
-		gdb_iodev->put_string("\r\nP_cmd: ", 10);
-		util_word_to_hex(scratchpad, reg);
-		gdb_iodev->put_string(scratchpad, 10);
-		gdb_iodev->put_string(" plen: ", 10);
-		util_word_to_hex(scratchpad, packet_len);
-		gdb_iodev->put_string(scratchpad, 10);
-		gdb_iodev->put_string(" tmp: ", 10);
-		util_word_to_hex(scratchpad, tmp);
-		gdb_iodev->put_string(scratchpad, 10);
-		gdb_iodev->put_string(" val: ", 10);
-		util_word_to_hex(scratchpad, value);
-		gdb_iodev->put_string(scratchpad, 10);
-		gdb_iodev->put_string("\r\n", 3);
-#endif
-		if ((reg > 15) && (reg < 25))
+		len = util_cpy_substr(scratchpad, (char *)gdb_in_packet, ',', scratch_len);
+		if (gdb_in_packet[len] != ',') break;
+		gdb_in_packet += len+1; // skip address and delimiter
+		packet_len -= (len+1);
+		addr = util_hex_to_word(scratchpad);
+		len = util_cpy_substr(scratchpad, (char *)gdb_in_packet, ':', scratch_len);
+		if (gdb_in_packet[len] != ':') break;
+		gdb_in_packet += len+1; // skip bytecount and delimiter
+		packet_len -= (len+1);
+		bytes = util_hex_to_word(scratchpad);
+		if (packet_len < 2 * (int)bytes) break; // data missing
+		gdb_unmask_breakpoints(addr, bytes);
+		gdb_read_hex_data((uint8_t *)gdb_in_packet, (int)bytes, (uint8_t *) addr,
+				GDB_MAX_MSG_LEN); // can't be more than message size
+		gdb_in_packet += 2 * bytes;
+		packet_len -= 2 * bytes;
+		if (*gdb_in_packet == ';')
 		{
-			// dummy fp-register
+			gdb_in_packet++;
+			packet_len--;
 		}
-		else if (reg < 16)
-		{
-			tmp = (uint32_t)util_hex_to_word((char *)gdb_in_packet);
-			util_swap_bytes(&tmp, &value);
+	}
+	if (packet_len > 0)
+	{
+		resp_str = "E01"; // the areas before the error got written
+	}
+	gdb_send_packet(resp_str, util_str_len(resp_str));
+}
 
-			//util_swap_bytes((unsigned char *)(&value), (unsigned char *)(&tmp));
-			// p = (uint32_t *) &(rpi2_reg_context.storage);
-			// p[reg] = value;
-			rpi2_reg_context.storage[reg] = value;
-		}
-		else if (reg == 25) // cpsr
-		{
-			tmp = (uint32_t)util_hex_to_word((char *)gdb_in_packet);
-			util_swap_bytes(&tmp, &value);
-			//util_swap_bytes((unsigned char *)(&value), (unsigned char *)(&tmp));
-			// p = (uint32_t *) &(rpi2_reg_context.storage);
-			// p[reg] = value;
-			rpi2_reg_context.reg.cpsr = value;
-		}
-#ifdef RPI2_NEON_SUPPORTED
-		else if (gdb_xmlregs)
-		{
-			if ((reg > 25) && (reg < 58))
-			{
-				// regs are stored low word first
-				reg -= 26; // gdb reg number -> storage item
-				dtmp = util_hex_to_dword((char *)gdb_in_packet);
-				util_swap_bytesd(&dtmp, &dvalue);
-				rpi2_neon_context.storage[reg] = dvalue;
-			}
-			else if (reg == 58)
-			{
-				tmp = (uint32_t)util_hex_to_word((char *)gdb_in_packet);
-				util_swap_bytes(&tmp, &value);
-				rpi2_neon_context.fpscr = value;
-			}
-			else
-			{
-				gdb_send_packet(err, util_str_len(err));
-			}
-		}
-#endif
-		else
+// windowed writes (QRpiWinStart, QRpiWinWrite)
+// The host keeps several write packets in flight. Each packet has a sequence
+// number and is written as soon as it arrives, in any order. The replies
+// carry the cumulative ack and selective NAKs for the missing packets.
+#define GDB_WIN_SIZE 32
+static uint32_t gdb_win_base; // lowest sequence number not received yet
+static uint32_t gdb_win_got; // received packets, bit n = gdb_win_base + n
+static uint32_t gdb_win_nakd; // missing packets already reported
+static uint32_t gdb_win_busy; // packets in the load pipeline
+
+// A<base>[;N<seq>...] - NAKs the not yet reported gaps below base + upto
+static void gdb_win_reply(uint32_t upto)
+{
+	char *buf = (char *)gdb_tmp_packet;
+	uint32_t i;
+	int len;
+
+	len = util_str_copy(buf, "A", GDB_MAX_MSG_LEN);
+	util_word_to_hex(buf + len, gdb_win_base);
+	len += 8;
+	for (i=0; (i < upto) && (i < GDB_WIN_SIZE); i++)
+	{
+		if (!((gdb_win_got | gdb_win_nakd) & (1u << i)))
 		{
-			gdb_send_packet(err, util_str_len(err));
-			return;
+			gdb_win_nakd |= 1u << i;
+			buf[len++] = ';';
+			buf[len++] = 'N';
+			util_word_to_hex(buf + len, gdb_win_base + i);
+			len += 8;
 		}
-		gdb_send_packet(resp_str, util_str_len(resp_str));
 	}
-	else
+	gdb_send_packet(buf, len);
+}
+
+// QRpiWinStart - resets the sequence numbers
+// reply: A<base>;W<window size>
+void gdb_cmd_win_start(char *gdb_in_packet, int packet_len)
+{
+	char *buf = (char *)gdb_tmp_packet;
+	int len;
+
+	gdb_win_base = 0;
+	gdb_win_got = 0;
+	gdb_win_nakd = 0;
+	gdb_win_busy = 0;
+	len = util_str_copy(buf, "A", GDB_MAX_MSG_LEN);
+	util_word_to_hex(buf + len, gdb_win_base);
+	len += 8;
+	len += util_str_copy(buf + len, ";W", GDB_MAX_MSG_LEN - len);
+	util_word_to_hex(buf + len, GDB_WIN_SIZE);
+	len += 8;
+	gdb_send_packet(buf, len);
+}
+
+// Parses 'seq,addr,length:XX...' of QRpiWinWrite. Returns the offset of
+// the data, or -1 if the packet is malformed, the data isn't all there or
+// the area isn't below the peripherals (a fault would hang a load worker).
+// Also used by the load pipeline workers (loadpipe.c).
+int gdb_win_parse(char *packet, int packet_len, uint32_t *seq, uint32_t *addr,
+		uint32_t *bytes)
+{
+	int len, i, offs;
+	const int scratch_len = 16;
+	char scratchpad[scratch_len]; // scratchpad
+
+	len = util_cpy_substr(scratchpad, packet, ',', scratch_len);
+	if (packet[len] != ',')
 	{
-		gdb_send_packet(err, util_str_len(err));
+		return -1;
 	}
+	offs = len+1; // skip sequence number and delimiter
+	*seq = util_hex_to_word(scratchpad);
+	len = util_cpy_substr(scratchpad, packet + offs, ',', scratch_len);
+	if (packet[offs + len] != ',')
+	{
+		return -1;
+	}
+	offs += len+1; // skip address and delimiter
+	*addr = util_hex_to_word(scratchpad);
+	len = util_cpy_substr(scratchpad, packet + offs, ':', scratch_len);
+	if (packet[offs + len] != ':')
+	{
+		return -1;
+	}
+	offs += len+1; // skip byte count and delimiter
+	*bytes = util_hex_to_word(scratchpad);
+	// the escaped data must all be there
+	for (i=offs, len=0; (i < packet_len) && (len < (int)*bytes); len++)
+	{
+		i += (packet[i] == 0x7d) ? 2 : 1;
+	}
+	if ((len < (int)*bytes) || (i > packet_len))
+	{
+		return -1;
+	}
+	if ((*addr + *bytes < *addr) || (*addr + *bytes > PERIPH_BASE))
+	{
+		return -1;
+	}
+	return offs;
 }
 
-void gdb_cmd_kill(char *gdb_packet, int packet_len)
+// 1 if the packet is to be written: in the window, not received yet and
+// not in the load pipeline
+static int gdb_win_wanted(uint32_t seq)
 {
-	(void) gdb_packet;
-	(void) packet_len;
-	// kill doesn't have responses
-	gdb_reset(1);
+	uint32_t diff;
+
+	diff = seq - gdb_win_base;
+	return (diff < GDB_WIN_SIZE) && !((gdb_win_got | gdb_win_busy) & (1u << diff));
 }
-void gdb_cmd_detach(char *gdb_packet, int packet_len)
+
+// marks the packet received, slides the window and replies
+static void gdb_win_received(uint32_t seq)
 {
-	(void) gdb_packet;
-	(void) packet_len;
-	gdb_send_packet("OK", 2); // for now
-	gdb_clear_breakpoints(1); // remove all breakpoints
-	gdb_cmd_cont("", 0);
+	uint32_t diff;
+
+	diff = seq - gdb_win_base;
+	if ((diff < GDB_WIN_SIZE) && !(gdb_win_got & (1u << diff)))
+	{
+		gdb_win_got |= 1u << diff;
+		// slide the window over the received packets
+		while (gdb_win_got & 1)
+		{
+			gdb_win_got >>= 1;
+			gdb_win_nakd >>= 1;
+			gdb_win_busy >>= 1;
+			gdb_win_base++;
+		}
+	}
+	// duplicates and packets beyond the window are just acked
+	diff = seq - gdb_win_base;
+	gdb_win_reply((diff < GDB_WIN_SIZE) ? diff : 0);
 }
 
-void gdb_cmd_set_thread(char *gdb_packet, int packet_len)
+// QRpiWinWrite:seq,addr,length:XX... (binary, escaped as in 'X')
+void gdb_cmd_win_write(char *gdb_in_packet, int packet_len)
+{
+	uint32_t seq;
+	uint32_t addr;
+	uint32_t bytes;
+	int offs;
+	char *err = "E01";
+
+	offs = gdb_win_parse(gdb_in_packet, packet_len, &seq, &addr, &bytes);
+	if (offs < 0)
+	{
+		gdb_send_packet(err, util_str_len(err));
+		return;
+	}
+	if (gdb_win_wanted(seq))
+	{
+		gdb_unmask_breakpoints(addr, bytes);
+		gdb_read_bin_data((uint8_t *)gdb_in_packet + offs, (int)bytes, (uint8_t *) addr,
+				GDB_MAX_MSG_LEN); // can't be more than message size
+	}
+	gdb_win_received(seq);
+}
+
+// a windowed write packet with a checksum error gets a selective NAK
+// instead of '-'. Returns 1 if the NAK was sent.
+static int gdb_win_bad_packet(char *packet)
 {
+	uint32_t diff;
 	int len;
-	int num;
-	//char *msg;
-	char *packet;
-	//char scratchpad[32]; // scratchpad
-	//char resp_buff[128]; // response buffer
+	const int scratch_len = 16;
+	char scratchpad[scratch_len]; // scratchpad
 
-	packet = (char *)gdb_packet;
-	if (packet_len > 1)
+	len = util_cmp_substr(packet, "QRpiWinWrite:");
+	if (len != util_str_len("QRpiWinWrite:"))
 	{
+		return 0;
+	}
+	packet += len;
+	len = util_cpy_substr(scratchpad, packet, ',', scratch_len);
+	if (packet[len] != ',')
+	{
+		return 0;
+	}
+	diff = util_hex_to_word(scratchpad) - gdb_win_base;
+	if (diff >= GDB_WIN_SIZE)
+	{
+		return 0; // the sequence number itself may be broken
+	}
+	gdb_win_nakd &= ~(1u << diff); // report it again
+	gdb_win_reply(diff + 1);
+	return 1;
+}
 
-		if (*packet == 'H')
+// acks and replies for the finished pipelined packets, in order
+static void gdb_pipe_complete()
+{
+	loadpipe_slot_t *slot;
+	uint32_t diff;
+	char *err = "E01";
+
+	while ((slot = loadpipe_next_done()) != 0)
+	{
+		diff = slot->seq - gdb_win_base;
+		if (diff < GDB_WIN_SIZE)
 		{
-#ifdef DEBUG_GDB
-			gdb_iodev->put_string("\r\nH-cmd: ", 10);
-			gdb_iodev->put_string(packet, util_str_len(packet)+1);
-			gdb_iodev->put_string("\r\n", 3);
-#endif
-			packet++; // skip the read and delimiter
-			if (--packet_len == 0)
+			gdb_win_busy &= ~(1u << diff);
+		}
+		switch (slot->status)
+		{
+		case LOADPIPE_OK:
+			gdb_packet_ack();
+			gdb_win_received(slot->seq);
+			break;
+		case LOADPIPE_BADSUM:
+			if (!gdb_win_bad_packet(slot->data))
 			{
-				gdb_send_packet("E01", 3);
-				return;
+				gdb_packet_nack();
 			}
-			if ((*packet == 'g') || (*packet == 'c'))
+			break;
+		default:
+			gdb_packet_ack();
+			gdb_send_packet(err, util_str_len(err));
+			break;
+		}
+		loadpipe_release(slot);
+	}
+}
+
+// waits for a character, completing pipelined packets meanwhile
+static int gdb_pipe_get_char()
+{
+	int ch;
+
+	while ((ch = gdb_iodev->get_char()) == -1)
+	{
+		gdb_pipe_complete();
+	}
+	return ch;
+}
+
+// Pipelined load (monitor loadpipe on): the packet is read raw into a
+// pipeline slot. QRpiWinWrite packets that are to be written go to the
+// workers as such, others (also duplicates) are checked here and copied to
+// dst when the packets before them are done.
+// Returns like receive_packet(), 0 if the packet went to the workers.
+static int gdb_pipe_receive(char *dst)
+{
+	loadpipe_slot_t *slot;
+	char *buf;
+	int ch, got, len, i;
+	int checksum = 0;
+	const int scratch_len = 16;
+	char scratchpad[scratch_len]; // scratchpad
+
+	while ((slot = loadpipe_next_free()) == 0)
+	{
+		gdb_pipe_complete();
+	}
+	buf = slot->data;
+	while ((ch = gdb_pipe_get_char()) != (int)'$')
+	{
+		if ((char)ch == '-')
+		{
+			return util_str_copy(dst, "-", 2);
+		}
+	}
+	// the raw payload and '#'
+	len = 0;
+	do
+	{
+		got = gdb_iodev->get_string(buf + len, '#', GDB_MAX_MSG_LEN - len);
+		if (got == 0)
+		{
+			gdb_pipe_complete();
+		}
+		len += got;
+		if (len >= GDB_MAX_MSG_LEN)
+		{
+			return -1; // max. packet size exceeded
+		}
+	} while ((len == 0) || (buf[len - 1] != '#'));
+	slot->len = len - 1;
+	buf[len++] = (char)gdb_pipe_get_char();
+	buf[len++] = (char)gdb_pipe_get_char();
+	buf[len] = '\0';
+
+	i = util_str_len("QRpiWinWrite:");
+	if (util_cmp_substr(buf, "QRpiWinWrite:") == i)
+	{
+		// same window rule as gdb_cmd_win_write()
+		len = util_cpy_substr(scratchpad, buf + i, ',', scratch_len);
+		slot->seq = util_hex_to_word(scratchpad);
+		if ((buf[i + len] == ',') && gdb_win_wanted(slot->seq))
+		{
+			if (loadpipe_pending() == 0)
 			{
-				packet++;
-				if (--packet_len == 0)
-				{
-					gdb_send_packet("E02", 3);
-					return;
-				}
-				// get thread ID
-				len = util_read_dec(packet, &num);
-				if (len == 0)
-				{
-					gdb_send_packet("E03", 3);
-					return;
-				}
-				if ((packet_len -= len) > 0)
-				{
-					gdb_response_not_supported();
-					return;
-				}
+				// the workers don't touch the breakpoints - remove the stale ones
+				gdb_unmask_breakpoints(0, PERIPH_BASE);
+			}
+			if (loadpipe_submit(slot) == 0)
+			{
+				gdb_win_busy |= 1u << (slot->seq - gdb_win_base);
+				return 0;
+			}
+			// no workers left - written here like without the pipeline
+		}
+	}
 
-				// thread ID -1 and 0 are OK
-				// -1 = all, 0 = arbitrary
-				if ((num == -1) || (num == 0))
-				{
-					gdb_send_packet("OK", 2);
-				}
-				else
-				{
-					gdb_response_not_supported();
-				}
+	// others in order after the pipelined ones
+	while (loadpipe_pending() > 0)
+	{
+		gdb_pipe_complete();
+	}
+	for (i = 0; i < slot->len; i++)
+	{
+		checksum += (uint8_t)(dst[i] = buf[i]);
+	}
+	dst[i] = '\0';
+	if ((util_hex_to_nib(buf[i + 1]) < 0) || (util_hex_to_nib(buf[i + 2]) < 0))
+	{
+		return -4; // not hex digit
+	}
+	if (((util_hex_to_nib(buf[i + 1]) << 4) | util_hex_to_nib(buf[i + 2]))
+			!= (checksum & 0xff))
+	{
+		return -2; // checksum mismatch
+	}
+	return slot->len;
+}
+
+// qRpiBacktrace[:max]
+// the call stack unwound on the target: pc,sp;pc,sp;...
+void gdb_cmd_backtrace(char *gdb_in_packet, int packet_len)
+{
+	unwind_frame_t frames[UNWIND_MAX_FRAMES];
+	uint32_t regs[16];
+	uint32_t max = UNWIND_MAX_FRAMES;
+	int i, n, len = 0;
+	char *err = "E02"; // tables unknown
+
+	if (!unwind_have_tables())
+	{
+		gdb_send_packet(err, util_str_len(err));
+		return;
+	}
+	if (packet_len > 0)
+	{
+		max = util_hex_to_word(gdb_in_packet);
+		if ((max == 0) || (max > UNWIND_MAX_FRAMES))
+		{
+			max = UNWIND_MAX_FRAMES;
+		}
+	}
+	for (i=0; i<16; i++)
+	{
+		regs[i] = rpi2_reg_context.storage[i];
+	}
+	n = unwind_backtrace(regs, frames, (int)max);
+	gdb_tmp_packet[0] = '\0';
+	for (i=0; i<n; i++)
+	{
+		if (i > 0)
+		{
+			gdb_tmp_packet[len++] = ';';
+		}
+		util_word_to_hex((char *)(gdb_tmp_packet + len), frames[i].pc);
+		len += 8;
+		gdb_tmp_packet[len++] = ',';
+		util_word_to_hex((char *)(gdb_tmp_packet + len), frames[i].sp);
+		len += 8;
+	}
+	gdb_send_packet((char *)gdb_tmp_packet, len);
+}
+
+// symbols asked from gdb with qSymbol
+static char *gdb_symbols[] = {"__exidx_start", "__exidx_end"};
+static uint32_t gdb_symbol_values[2];
+#define GDB_NUM_SYMBOLS 2
+
+// qSymbol:: (gdb offers symbol lookup) or qSymbol:value:name (answer)
+// reply: qSymbol:name (next request) or OK
+void gdb_cmd_symbol(char *packet, int packet_len, char *resp_buff, int resp_buff_len)
+{
+	const int scratch_len = 32;
+	char scratchpad[scratch_len];
+	char name[scratch_len];
+	int len, next = 0;
+	int i;
+
+	len = util_cpy_substr(scratchpad, packet, ':', scratch_len);
+	packet += len + 1;
+	packet_len -= len + 1;
+	if (packet_len <= 0)
+	{
+		// new lookup round
+		gdb_symbol_values[0] = 0;
+		gdb_symbol_values[1] = 0;
+	}
+	else
+	{
+		// the answer - value is empty if gdb doesn't know the symbol
+		len = packet_len / 2;
+		if (len > scratch_len - 1) len = scratch_len - 1;
+		gdb_read_hex_data((uint8_t *)packet, len, (uint8_t *)name, scratch_len);
+		name[len] = '\0';
+		for (i=0; i<GDB_NUM_SYMBOLS; i++)
+		{
+			if (util_str_cmp(name, gdb_symbols[i]) == 0)
+			{
+				gdb_symbol_values[i] = (scratchpad[0] == '\0') ? 0
+						: util_hex_to_word(scratchpad);
+				next = i + 1;
+				break;
+			}
+		}
+		if (i == GDB_NUM_SYMBOLS)
+		{
+			next = GDB_NUM_SYMBOLS; // not ours
+		}
+	}
+	if (next < GDB_NUM_SYMBOLS)
+	{
+		len = util_str_copy(resp_buff, "qSymbol:", resp_buff_len);
+		len += gdb_write_hex_data((uint8_t *)gdb_symbols[next],
+				util_str_len(gdb_symbols[next]), resp_buff + len, resp_buff_len - len);
+	}
+	else
+	{
+		if (gdb_symbol_values[0] && gdb_symbol_values[1])
+		{
+			unwind_set_tables(gdb_symbol_values[0], gdb_symbol_values[1]);
+		}
+		len = util_str_copy(resp_buff, "OK", resp_buff_len);
+	}
+	gdb_send_packet(resp_buff, len);
+}
+
+// Q name params
+void gdb_cmd_common_set(char *gdb_in_packet, int packet_len)
+{
+	int len;
+
+	len = util_cmp_substr((char *)gdb_in_packet, "QRpiMemWrite:");
+	if (len == util_str_len("QRpiMemWrite:"))
+	{
+		gdb_cmd_write_mem_multi(gdb_in_packet + len, packet_len - len);
+	}
+	else if ((len = util_cmp_substr((char *)gdb_in_packet, "QRpiWinWrite:"))
+			== util_str_len("QRpiWinWrite:"))
+	{
+		gdb_cmd_win_write(gdb_in_packet + len, packet_len - len);
+	}
+	else if (util_str_cmp((char *)gdb_in_packet, "QRpiWinStart") == 0)
+	{
+		gdb_cmd_win_start(gdb_in_packet, packet_len);
+	}
+	else if ((len = util_cmp_substr((char *)gdb_in_packet, "QRpiStopPush:"))
+			== util_str_len("QRpiStopPush:"))
+	{
+		gdb_cmd_stop_push(gdb_in_packet + len, packet_len - len);
+	}
+	else if (util_str_cmp((char *)gdb_in_packet, "QRpiChannels:1") == 0)
+	{
+		// the host demultiplexes the channel frames
+		chan_enable(1);
+		gdb_send_packet("OK", 2);
+	}
+	else if (util_str_cmp((char *)gdb_in_packet, "QRpiChannels:0") == 0)
+	{
+		chan_enable(0);
+		gdb_send_packet("OK", 2);
+	}
+	else
+	{
+		gdb_response_not_supported();
+	}
+}
+
+// p n
+void gdb_cmd_read_reg(char *gdb_in_packet, int packet_len)
+{
+	unsigned int value, tmp;
+	unsigned long long dvalue, dtmp;
+	uint32_t reg;
+	char *err = "E00";
+	const int scratch_len = 32;
+	char scratchpad[scratch_len]; // scratchpad
+	if (packet_len > 0)
+	{
+		reg = (uint32_t)util_hex_to_word((char *)gdb_in_packet);
+		if (reg < 16)
+		{
+			//p = (uint32_t *) &(rpi2_reg_context.storage);
+			//value = p[reg];
+			value = rpi2_reg_context.storage[reg];
+			util_swap_bytes(&value, &tmp);
+			util_word_to_hex(scratchpad, tmp);
+			gdb_send_packet(scratchpad, util_str_len(scratchpad));
+		}
+		else if ((reg > 15) && (reg < 25)) // dummy fp-register
+		{
+			util_word_to_hex(scratchpad, 0x90000009);
+			util_swap_bytes(&value, &tmp);
+			util_word_to_hex(scratchpad, tmp);
+			gdb_send_packet(scratchpad, util_str_len(scratchpad));
+		}
+		else if (reg == 25) // cpsr
+		{
+			//p = (uint32_t *) &(rpi2_reg_context.storage);
+			//value = p[reg];
+			value = rpi2_reg_context.reg.cpsr;
+			util_swap_bytes(&value, &tmp);
+			util_word_to_hex(scratchpad, tmp);
+			gdb_send_packet(scratchpad, util_str_len(scratchpad));
+		}
+#ifdef RPI2_NEON_SUPPORTED
+		else if (gdb_xmlregs)
+		{
+			if ((reg > 25) && (reg < 58))
+			{
+				reg -= 26; // gdb reg number -> storage item
+				dvalue = rpi2_neon_context.storage[reg];
+				util_swap_bytesd(&dvalue, &dtmp);
+				util_dword_to_hex(scratchpad, dtmp);
+				gdb_send_packet(scratchpad, util_str_len(scratchpad));
+			}
+			else if (reg == 58)
+			{
+				value = rpi2_neon_context.fpscr;
+				util_swap_bytes(&value, &tmp);
+				util_word_to_hex(scratchpad, tmp);
+				gdb_send_packet(scratchpad, util_str_len(scratchpad));
 			}
 			else
 			{
-				gdb_response_not_supported(); // for now
+				gdb_send_packet(err, util_str_len(err));
 			}
 		}
+#endif
 		else
 		{
-			gdb_send_packet("E04", 3);
+			gdb_send_packet(err, util_str_len(err));
+		}
+#ifdef DEBUG_GDB
+		gdb_iodev->put_string("\r\np_cmd: ", 10);
+		util_word_to_hex(scratchpad, reg);
+		gdb_iodev->put_string(scratchpad, 10);
+		gdb_iodev->put_string(" : ", 4);
+		util_word_to_hex(scratchpad, tmp);
+		gdb_iodev->put_string(scratchpad, 10);
+		gdb_iodev->put_string("\r\n", 3);
+#endif
+	}
+}
+
+// P n...=r...
+void gdb_cmd_write_reg(char *gdb_in_packet, int packet_len)
+{
+	int len;
+	char *resp_str = "OK";
+	const int scratch_len = 32;
+	char scratchpad[scratch_len]; // scratchpad
+	unsigned int value, tmp;
+	unsigned long long dvalue, dtmp;
+	uint32_t reg;
+	char *err = "E00";
+	if (packet_len > 0)
+	{
+		len = util_cpy_substr(scratchpad, (char *)gdb_in_packet, '=', scratch_len);
+		reg = (uint32_t)util_hex_to_word(scratchpad);
+		gdb_in_packet += (len + 1);  // skip register number and '='
+		packet_len -= (len + 1);
+#ifdef DEBUG_GDB
+		gdb_iodev->put_string((char *)gdb_in_packet, packet_len);
+		gdb_iodev->put_string("\r\nP_cmd: ", 10);
+		util_word_to_hex(scratchpad, reg);
+		gdb_iodev->put_string(scratchpad, 10);
+		gdb_iodev->put_string(" plen: ", 10);
+		util_word_to_hex(scratchpad, packet_len);
+		gdb_iodev->put_string(scratchpad, 10);
+		gdb_iodev->put_string(" tmp: ", 10);
+		util_word_to_hex(scratchpad, tmp);
+		gdb_iodev->put_string(scratchpad, 10);
+		gdb_iodev->put_string(" val: ", 10);
+		util_word_to_hex(scratchpad, value);
+		gdb_iodev->put_string(scratchpad, 10);
+		gdb_iodev->put_string("\r\n", 3);
+#endif
+		if ((reg > 15) && (reg < 25))
+		{
+			// dummy fp-register
+		}
+		else if (reg < 16)
+		{
+			tmp = (uint32_t)util_hex_to_word((char *)gdb_in_packet);
+			util_swap_bytes(&tmp, &value);
+
+			//util_swap_bytes((unsigned char *)(&value), (unsigned char *)(&tmp));
+			// p = (uint32_t *) &(rpi2_reg_context.storage);
+			// p[reg] = value;
+			rpi2_reg_context.storage[reg] = value;
+		}
+		else if (reg == 25) // cpsr
+		{
+			tmp = (uint32_t)util_hex_to_word((char *)gdb_in_packet);
+			util_swap_bytes(&tmp, &value);
+			//util_swap_bytes((unsigned char *)(&value), (unsigned char *)(&tmp));
+			// p = (uint32_t *) &(rpi2_reg_context.storage);
+			// p[reg] = value;
+			rpi2_reg_context.reg.cpsr = value;
+		}
+#ifdef RPI2_NEON_SUPPORTED
+		else if (gdb_xmlregs)
+		{
+			if ((reg > 25) && (reg < 58))
+			{
+				// regs are stored low word first
+				reg -= 26; // gdb reg number -> storage item
+				dtmp = util_hex_to_dword((char *)gdb_in_packet);
+				util_swap_bytesd(&dtmp, &dvalue);
+				rpi2_neon_context.storage[reg] = dvalue;
+			}
+			else if (reg == 58)
+			{
+				tmp = (uint32_t)util_hex_to_word((char *)gdb_in_packet);
+				util_swap_bytes(&tmp, &value);
+				rpi2_neon_context.fpscr = value;
+			}
+			else
+			{
+				gdb_send_packet(err, util_str_len(err));
+			}
+		}
+#endif
+		else
+		{
+			gdb_send_packet(err, util_str_len(err));
+			return;
+		}
+		gdb_send_packet(resp_str, util_str_len(resp_str));
+	}
+	else
+	{
+		gdb_send_packet(err, util_str_len(err));
+	}
+}
+
+void gdb_cmd_kill(char *gdb_packet, int packet_len)
+{
+	(void) gdb_packet;
+	(void) packet_len;
+	// kill doesn't have responses
+	gdb_reset(1);
+}
+
+static uint32_t gdb_detach_hook; // RPI2_DETACH_* used by 'D'
+static uint32_t gdb_detach_pin; // GPIO for RPI2_DETACH_GPIO
+
+void gdb_cmd_detach(char *gdb_packet, int packet_len)
+{
+	(void) gdb_packet;
+	(void) packet_len;
+	gdb_send_packet("OK", 2); // for now
+	gdb_clear_breakpoints(1); // remove all breakpoints
+	if (gdb_detach_hook != RPI2_DETACH_NONE)
+	{
+		// run on the debuggee's own vectors until the hook fires
+		gdb_clear_watchpoints(1);
+		rpi2_detach_run(gdb_detach_hook, gdb_detach_pin);
+	}
+	gdb_cmd_cont("", 0);
+}
+
+void gdb_cmd_set_thread(char *gdb_packet, int packet_len)
+{
+	int len;
+	int num;
+	//char *msg;
+	char *packet;
+	//char scratchpad[32]; // scratchpad
+	//char resp_buff[128]; // response buffer
+
+	packet = (char *)gdb_packet;
+	if (packet_len > 1)
+	{
+
+		if (*packet == 'H')
+		{
+#ifdef DEBUG_GDB
+			gdb_iodev->put_string("\r\nH-cmd: ", 10);
+			gdb_iodev->put_string(packet, util_str_len(packet)+1);
+			gdb_iodev->put_string("\r\n", 3);
+#endif
+			packet++; // skip the read and delimiter
+			if (--packet_len == 0)
+			{
+				gdb_send_packet("E01", 3);
+				return;
+			}
+			if ((*packet == 'g') || (*packet == 'c'))
+			{
+				packet++;
+				if (--packet_len == 0)
+				{
+					gdb_send_packet("E02", 3);
+					return;
+				}
+				// get thread ID
+				len = util_read_dec(packet, &num);
+				if (len == 0)
+				{
+					gdb_send_packet("E03", 3);
+					return;
+				}
+				if ((packet_len -= len) > 0)
+				{
+					gdb_response_not_supported();
+					return;
+				}
+
+				// thread ID -1 and 0 are OK
+				// -1 = all, 0 = arbitrary
+				if ((num == -1) || (num == 0))
+				{
+					gdb_send_packet("OK", 2);
+				}
+				else
+				{
+					gdb_response_not_supported();
+				}
+			}
+			else
+			{
+				gdb_response_not_supported(); // for now
+			}
+		}
+		else
+		{
+			gdb_send_packet("E04", 3);
+		}
+	}
+	else
+	{
+		gdb_send_packet("E05", 3);
+	}
+}
+
+// monitor commands (qRcmd)
+// the command function returns 0 for 'OK', otherwise an error is sent
+typedef struct {
+	char *name;
+	int (*fun)(char *args);
+	char *help;
+} gdb_mon_cmd_rec;
+
+static int gdb_mon_help(char *args);
+static int gdb_mon_coredump(char *args);
+static int gdb_mon_run_for(char *args);
+static int gdb_mon_step_masked(char *args);
+static int gdb_mon_detach_run(char *args);
+static int gdb_mon_excbench(char *args);
+static int gdb_mon_step_blocks(char *args);
+static int gdb_mon_call(char *args);
+static int gdb_mon_runtests(char *args);
+static int gdb_mon_stub_nocache(char *args);
+static int gdb_mon_cachebench(char *args);
+static int gdb_mon_serbench(char *args);
+
+static gdb_mon_cmd_rec gdb_mon_cmds[] = {
+	{"help", gdb_mon_help, "help - list monitor commands"},
+	{"coredump", gdb_mon_coredump,
+			"coredump [addr len]... - prepare core dump for rpi-coredump"},
+	{"run-for", gdb_mon_run_for,
+			"run-for [N insns|cycles|off] - stop after N instructions/cycles"},
+	{"trace", trace_mon_cmd,
+			"trace [on|off|clear|stats|dump [N]] - debuggee exception trace"},
+	{"acctrace", acctrace_mon_cmd,
+			"acctrace [addr len|off|clear|dump [N]] - trace accesses by MMU faults"},
+	{"loadpipe", loadpipe_mon_cmd,
+			"loadpipe [on|off] - windowed load writes on the other cores"},
+	{"channels", chan_mon_cmd,
+			"channels [on|off] - channel frames on the UART, counters"},
+	{"step-masked", gdb_mon_step_masked,
+			"step-masked [on|off] - single-step with IRQ/FIQ masked"},
+	{"stackpaint", stackmon_paint_cmd,
+			"stackpaint addr len - fill a stack with the watermark pattern"},
+	{"stackwater", stackmon_water_cmd,
+			"stackwater [addr len] - show stack usage (painted and stub stacks)"},
+	{"unwind-tables", unwind_mon_cmd,
+			"unwind-tables [start end] - show or set the .ARM.exidx location"},
+	{"detach-run", gdb_mon_detach_run,
+			"detach-run [break|gpio N|off] - detach gives the debuggee its vectors"},
+	{"boottime", boottime_mon_cmd,
+			"boottime - show the boot timeline (system timer per init phase)"},
+	{"excbench", gdb_mon_excbench,
+			"excbench [on] - cycles of the latest exception entry and exit"},
+	{"stub-nocache", gdb_mon_stub_nocache,
+			"stub-nocache [on|off] - the stub's pages uncached (debuggee data sharing one too)"},
+	{"cachebench", gdb_mon_cachebench,
+			"cachebench addr len - debuggee cache refills caused by a stop"},
+	{"serbench", gdb_mon_serbench,
+			"serbench [N] - CPU cycles per byte of the serial ring copy"},
+	{"step-blocks", gdb_mon_step_blocks,
+			"step-blocks [on|off] - step to address one basic block at a time"},
+	{"hide-stops", hyp_mon_cmd,
+			"hide-stops [on|off] - keep stop time out of the virtual counter"},
+	{"call", gdb_mon_call,
+			"call addr [arg]... [repeat N] - run a function, show result and cycles"},
+	{"runtests", gdb_mon_runtests,
+			"runtests table count - run test functions (0 = pass), catch faults"}
+};
+
+#define GDB_MON_NUM_CMDS (sizeof(gdb_mon_cmds) / sizeof(gdb_mon_cmds[0]))
+#define GDB_MON_LINE_LEN 256
+
+static char gdb_mon_line[GDB_MON_LINE_LEN]; // decoded command line
+static int gdb_stop_reason; // reason of the latest stop
+
+// output to gdb console
+void gdb_mon_print(char *msg)
+{
+	gdb_send_text_packet(msg, (unsigned int)util_str_len(msg));
+}
+
+static int gdb_mon_help(char *args)
+{
+	unsigned int i;
+
+	(void)args;
+	for (i=0; i<GDB_MON_NUM_CMDS; i++)
+	{
+		gdb_mon_print(gdb_mon_cmds[i].help);
+		gdb_mon_print("\n");
+	}
+	return 0;
+}
+
+static int gdb_mon_coredump(char *args)
+{
+	int sig;
+
+	// signal numbers above 31 are stub-internal
+	sig = (gdb_stop_reason <= 31) ? gdb_stop_reason : SIG_TRAP;
+	if (coredump_start(args, sig) < 0)
+	{
+		gdb_mon_print("coredump: bad address range\n");
+		return -1;
+	}
+	return 0;
+}
+
+// run-for N insns|cycles - budget for the following 'continue's
+// run-for off - clear, run-for - show state
+static int gdb_mon_run_for(char *args)
+{
+	unsigned int count;
+	int len;
+	int kind;
+	char scratchpad[16];
+
+	len = util_read_num(args, &count);
+	if (len == 0)
+	{
+		while (*args == ' ') args++;
+		if (util_str_cmp(args, "off") == 0)
+		{
+			pmu_budget_set(PMU_BUDGET_OFF, 0);
+			return 0;
+		}
+		if (*args != '\0') return -1;
+		kind = pmu_budget_kind();
+		if (kind == PMU_BUDGET_OFF)
+		{
+			gdb_mon_print("run-for: off\n");
+			return 0;
+		}
+		gdb_mon_print((kind == PMU_BUDGET_CYCLES) ? "cycles used: " : "insns used: ");
+		util_word_to_dec(scratchpad, pmu_budget_used());
+		gdb_mon_print(scratchpad);
+		gdb_mon_print(" left: ");
+		util_word_to_dec(scratchpad, pmu_budget_left());
+		gdb_mon_print(scratchpad);
+		gdb_mon_print("\n");
+		return 0;
+	}
+	args += len;
+	while (*args == ' ') args++;
+	if ((util_str_cmp(args, "insns") == 0) || (*args == '\0'))
+	{
+		kind = PMU_BUDGET_INSNS;
+	}
+	else if (util_str_cmp(args, "cycles") == 0)
+	{
+		kind = PMU_BUDGET_CYCLES;
+	}
+	else
+	{
+		return -1;
+	}
+	if (count == 0) return -1;
+	pmu_budget_set(kind, count);
+	return 0;
+}
+
+// step-masked on|off - step policy (see rpi_stub_step_masked)
+static int gdb_mon_step_masked(char *args)
+{
+	while (*args == ' ') args++;
+	if (util_str_cmp(args, "on") == 0)
+	{
+		rpi2_step_masked = 1;
+	}
+	else if (util_str_cmp(args, "off") == 0)
+	{
+		rpi2_step_masked = 0;
+	}
+	else if (*args != '\0')
+	{
+		return -1;
+	}
+	gdb_mon_print(rpi2_step_masked ? "step-masked: on\n" : "step-masked: off\n");
+	return 0;
+}
+
+// step-blocks on|off - step-to-address policy
+static int gdb_mon_step_blocks(char *args)
+{
+	while (*args == ' ') args++;
+	if (util_str_cmp(args, "on") == 0)
+	{
+		gdb_step_blocks = 1;
+	}
+	else if (util_str_cmp(args, "off") == 0)
+	{
+		gdb_step_blocks = 0;
+	}
+	else if (*args != '\0')
+	{
+		return -1;
+	}
+	gdb_mon_print(gdb_step_blocks ? "step-blocks: on\n" : "step-blocks: off\n");
+	return 0;
+}
+
+// the registers of the stop back
+static void gdb_call_restore()
+{
+	int i;
+
+	for (i=0; i<18; i++)
+	{
+		rpi2_reg_context.storage[i] = gdb_call_saved.storage[i];
+	}
+}
+
+// sets the debuggee registers for the next run of the called function
+static void gdb_call_setup()
+{
+	int i;
+
+	gdb_call_restore();
+	for (i=0; i<GDB_CALL_MAX_ARGS; i++)
+	{
+		rpi2_reg_context.storage[i] = gdb_call_args[i];
+	}
+	rpi2_reg_context.reg.r14 = (uint32_t)gdb_call_trampoline;
+	// ARM state, IT-bits cleared; bit 0 of the address selects thumb
+	rpi2_reg_context.reg.cpsr &= ~((1 << 5) | 0x0600fc00);
+	if (gdb_call_run == 0)
+	{
+		// calibration: straight to the trampoline
+		rpi2_reg_context.reg.r15 = (uint32_t)gdb_call_trampoline;
+	}
+	else
+	{
+		rpi2_reg_context.reg.r15 = gdb_call_addr & ~1;
+		if (gdb_call_addr & 1)
+		{
+			rpi2_reg_context.reg.cpsr |= (1 << 5);
+		}
+	}
+	gdb_apply_breakpoints(); // net effect of z0/Z0s
+	gdb_monitor_running = 0;
+	rpi2_debuggee_running = 1;
+}
+
+// collects the runtests output into packet-size chunks
+static void gdb_test_print(char *msg)
+{
+	if (util_str_len(gdb_test_out) + util_str_len(msg) >= GDB_TEST_OUT_LEN)
+	{
+		gdb_mon_print(gdb_test_out);
+		gdb_test_out[0] = '\0';
+	}
+	util_append_str(gdb_test_out, msg, GDB_TEST_OUT_LEN);
+}
+
+// one test ended: 'N pass cycles', 'N FAIL r0 cycles' or
+// 'N EXC kind pc cycles'
+static void gdb_tests_stopped(int reason)
+{
+	char scratchpad[16];
+	char *msg;
+	uint32_t cycles;
+
+	if (reason == SIG_INT)
+	{
+		gdb_call_active = 0;
+		gdb_call_table = 0;
+		if (gdb_call_run == 0)
+		{
+			gdb_test_print("interrupted at calibration");
+		}
+		else
+		{
+			gdb_test_print("interrupted at test ");
+			util_word_to_dec(scratchpad, gdb_call_run - 1);
+			gdb_test_print(scratchpad);
+		}
+		gdb_test_print(", registers restored\n");
+		gdb_mon_print(gdb_test_out);
+		gdb_call_restore();
+		gdb_monitor_running = 1;
+		gdb_send_packet("E01", 3);
+		return;
+	}
+	cycles = rpi2_exc_cycles[0] - rpi2_exc_cycles[3];
+	cycles = (cycles > gdb_call_overhead) ? cycles - gdb_call_overhead : 0;
+	if (gdb_call_run == 0)
+	{
+		gdb_call_overhead = rpi2_exc_cycles[0] - rpi2_exc_cycles[3];
+	}
+	else
+	{
+		util_word_to_dec(scratchpad, gdb_call_run - 1);
+		gdb_test_print(scratchpad);
+		if (reason != CALL_RETURN)
+		{
+			gdb_test_exc++;
+			switch (reason)
+			{
+			case SIG_ILL:
+				gdb_test_print(" EXC undef ");
+				break;
+			case SIG_BUS:
+				gdb_test_print(" EXC pabt ");
+				break;
+			case SIG_EMT:
+				gdb_test_print(" EXC dabt ");
+				break;
+			case SIG_TRAP:
+				gdb_test_print(" EXC bkpt ");
+				break;
+			case SEMIHOSTING:
+				gdb_test_print(" EXC exit ");
+				break;
+			default:
+				gdb_test_print(" EXC other ");
+				break;
+			}
+			util_word_to_hex(scratchpad, rpi2_reg_context.reg.r15);
+			gdb_test_print(scratchpad);
+		}
+		else if (rpi2_reg_context.reg.r0 == 0)
+		{
+			gdb_test_passed++;
+			gdb_test_print(" pass");
+		}
+		else
+		{
+			gdb_test_failed++;
+			gdb_test_print(" FAIL ");
+			util_word_to_hex(scratchpad, rpi2_reg_context.reg.r0);
+			gdb_test_print(scratchpad);
+		}
+		gdb_test_print(" ");
+		util_word_to_dec(scratchpad, cycles);
+		gdb_test_print(scratchpad);
+		gdb_test_print("\n");
+	}
+	if (gdb_call_run < gdb_call_runs)
+	{
+		// next test, from the registers of the stop
+		gdb_call_addr = *((uint32_t *)(gdb_call_table + 4 * gdb_call_run));
+		gdb_call_run++;
+		gdb_call_setup();
+		return;
+	}
+	gdb_call_active = 0;
+	gdb_call_table = 0;
+	util_word_to_dec(scratchpad, gdb_call_runs);
+	gdb_test_print(scratchpad);
+	gdb_test_print(" tests: ");
+	util_word_to_dec(scratchpad, gdb_test_passed);
+	gdb_test_print(scratchpad);
+	gdb_test_print(" passed, ");
+	util_word_to_dec(scratchpad, gdb_test_failed);
+	gdb_test_print(scratchpad);
+	gdb_test_print(" failed, ");
+	util_word_to_dec(scratchpad, gdb_test_exc);
+	gdb_test_print(scratchpad);
+	gdb_test_print(" exceptions\n");
+	gdb_mon_print(gdb_test_out);
+	gdb_call_restore();
+	gdb_monitor_running = 1;
+	msg = (gdb_test_failed || gdb_test_exc) ? "E01" : "OK";
+	gdb_send_packet(msg, util_str_len(msg));
+}
+
+// the called function returned to the trampoline, or something else
+// stopped the debuggee
+static void gdb_call_stopped(int reason)
+{
+	char scratchpad[16];
+	uint32_t cycles, tmp;
+	uint32_t i, j;
+
+	if (gdb_call_table)
+	{
+		gdb_tests_stopped(reason);
+		return;
+	}
+	if (reason != CALL_RETURN)
+	{
+		gdb_call_active = 0;
+		gdb_mon_print("call: stopped at ");
+		util_word_to_hex(scratchpad, rpi2_reg_context.reg.r15);
+		gdb_mon_print(scratchpad);
+		gdb_mon_print(", registers restored\n");
+		gdb_call_restore();
+		gdb_monitor_running = 1;
+		gdb_send_packet("E01", 3);
+		return;
+	}
+	// from the stub exit to the next stub entry
+	cycles = rpi2_exc_cycles[0] - rpi2_exc_cycles[3];
+	if (gdb_call_run == 0)
+	{
+		gdb_call_overhead = cycles;
+	}
+	else
+	{
+		gdb_call_cycles[gdb_call_run - 1] = (cycles > gdb_call_overhead)
+				? cycles - gdb_call_overhead : 0;
+	}
+	if (gdb_call_run < gdb_call_runs)
+	{
+		gdb_call_run++;
+		gdb_call_setup();
+		return;
+	}
+	gdb_call_active = 0;
+	gdb_mon_print("result: r0 = 0x");
+	util_word_to_hex(scratchpad, rpi2_reg_context.reg.r0);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(", r1 = 0x");
+	util_word_to_hex(scratchpad, rpi2_reg_context.reg.r1);
+	gdb_mon_print(scratchpad);
+	// sort for the median
+	for (i=1; i<gdb_call_runs; i++)
+	{
+		tmp = gdb_call_cycles[i];
+		for (j=i; (j > 0) && (gdb_call_cycles[j - 1] > tmp); j--)
+		{
+			gdb_call_cycles[j] = gdb_call_cycles[j - 1];
+		}
+		gdb_call_cycles[j] = tmp;
+	}
+	gdb_mon_print("\ncycles: min ");
+	util_word_to_dec(scratchpad, gdb_call_cycles[0]);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" median ");
+	util_word_to_dec(scratchpad, gdb_call_cycles[gdb_call_runs / 2]);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" max ");
+	util_word_to_dec(scratchpad, gdb_call_cycles[gdb_call_runs - 1]);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" (");
+	util_word_to_dec(scratchpad, gdb_call_runs);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" calls, ");
+	util_word_to_dec(scratchpad, gdb_call_overhead);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" cycles of stub overhead subtracted)\n");
+	gdb_call_restore();
+	gdb_monitor_running = 1;
+	gdb_send_packet("OK", 2);
+}
+
+// call addr [arg]... [repeat N]
+// The function runs in the debuggee's mode and stack, with the registers
+// of the stop. The reply is sent when the last call has returned.
+static int gdb_mon_call(char *args)
+{
+	uint32_t num;
+	int len, i, nargs = 0;
+
+	len = util_read_num(args, &gdb_call_addr);
+	if (len == 0)
+	{
+		return -1;
+	}
+	args += len;
+	gdb_call_runs = 1;
+	while (*args != '\0')
+	{
+		while (*args == ' ') args++;
+		if (util_cmp_substr(args, "repeat") == 6)
+		{
+			len = util_read_num(args + 6, &gdb_call_runs);
+			if ((len == 0) || (gdb_call_runs == 0)
+					|| (gdb_call_runs > GDB_CALL_MAX_RUNS))
+			{
+				gdb_mon_print("call: repeat 1...256\n");
+				return -1;
+			}
+			args += 6 + len;
+		}
+		else if (*args != '\0')
+		{
+			len = util_read_num(args, &num);
+			if ((len == 0) || (nargs == GDB_CALL_MAX_ARGS))
+			{
+				gdb_mon_print("call: up to 4 numeric arguments\n");
+				return -1;
+			}
+			gdb_call_args[nargs++] = num;
+			args += len;
+		}
+	}
+	for (i=nargs; i<GDB_CALL_MAX_ARGS; i++)
+	{
+		gdb_call_args[i] = 0;
+	}
+	if (pmu_cycles_enable() < 0)
+	{
+		gdb_mon_print("call: cycle counter in use by run-for\n");
+		return -1;
+	}
+	for (i=0; i<18; i++)
+	{
+		gdb_call_saved.storage[i] = rpi2_reg_context.storage[i];
+	}
+	gdb_call_run = 0;
+	gdb_call_active = 1;
+	gdb_call_setup();
+	return 1; // reply from gdb_call_stopped()
+}
+
+// runtests table_addr count
+// Calls the functions in the table (return value 0 = pass) one after
+// another, each from the registers of the stop. Aborts and undefs end
+// only the test. The reply is sent when all tests have run.
+static int gdb_mon_runtests(char *args)
+{
+	uint32_t table;
+	int len, i;
+
+	len = util_read_num(args, &table);
+	if (len == 0)
+	{
+		return -1;
+	}
+	if ((util_read_num(args + len, &gdb_call_runs) == 0) || (gdb_call_runs == 0)
+			|| (table & 3))
+	{
+		return -1;
+	}
+	if (pmu_cycles_enable() < 0)
+	{
+		gdb_mon_print("runtests: cycle counter in use by run-for\n");
+		return -1;
+	}
+	for (i=0; i<GDB_CALL_MAX_ARGS; i++)
+	{
+		gdb_call_args[i] = 0;
+	}
+	for (i=0; i<18; i++)
+	{
+		gdb_call_saved.storage[i] = rpi2_reg_context.storage[i];
+	}
+	gdb_test_passed = 0;
+	gdb_test_failed = 0;
+	gdb_test_exc = 0;
+	gdb_test_out[0] = '\0';
+	gdb_call_table = table;
+	gdb_call_run = 0;
+	gdb_call_active = 1;
+	gdb_call_setup();
+	return 1; // reply from gdb_tests_stopped()
+}
+
+static int gdb_mon_detach_run(char *args)
+{
+	char scratchpad[16];
+	uint32_t pin;
+	int len;
+
+	while (*args == ' ') args++;
+	if (util_str_cmp(args, "off") == 0)
+	{
+		gdb_detach_hook = RPI2_DETACH_NONE;
+	}
+	else if (util_str_cmp(args, "break") == 0)
+	{
+		gdb_detach_hook = RPI2_DETACH_BREAK;
+	}
+	else if (util_cmp_substr(args, "gpio") == 4)
+	{
+		args += 4;
+		while (*args == ' ') args++;
+		len = util_read_num(args, &pin);
+		if ((len == 0) || (pin > 53))
+		{
+			return -1;
+		}
+		gdb_detach_hook = RPI2_DETACH_GPIO;
+		gdb_detach_pin = pin;
+	}
+	else if (*args != '\0')
+	{
+		return -1;
+	}
+	switch (gdb_detach_hook)
+	{
+	case RPI2_DETACH_BREAK:
+		gdb_mon_print("detach-run: break\n");
+		break;
+	case RPI2_DETACH_GPIO:
+		util_word_to_dec(scratchpad, gdb_detach_pin);
+		gdb_mon_print("detach-run: gpio ");
+		gdb_mon_print(scratchpad);
+		gdb_mon_print("\n");
+		break;
+	default:
+		gdb_mon_print("detach-run: off\n");
+		break;
+	}
+	return 0;
+}
+
+// the stamps are taken at exception entry (write_context), gdb entry,
+// gdb exit and exception return - the exit is that of the previous resume
+static int gdb_mon_excbench(char *args)
+{
+	char scratchpad[16];
+
+	while (*args == ' ') args++;
+	if (util_str_cmp(args, "on") == 0)
+	{
+		if (pmu_cycles_enable() < 0)
+		{
+			gdb_mon_print("excbench: cycle counter in use by run-for\n");
+			return -1;
+		}
+		gdb_mon_print("excbench: cycle counter on\n");
+		return 0;
+	}
+	else if (*args != '\0')
+	{
+		return -1;
+	}
+	gdb_mon_print("entry: ");
+	util_word_to_dec(scratchpad, rpi2_exc_cycles[1] - rpi2_exc_cycles[0]);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" cycles\nexit: ");
+	util_word_to_dec(scratchpad, rpi2_exc_cycles[3] - rpi2_exc_cycles[2]);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" cycles\n");
+	return 0;
+}
+
+// stub-nocache on|off - the stub's memory non-cacheable or cacheable
+static int gdb_mon_stub_nocache(char *args)
+{
+	while (*args == ' ') args++;
+	if ((util_str_cmp(args, "on") == 0) || (util_str_cmp(args, "off") == 0))
+	{
+		if (!rpi2_use_mmu)
+		{
+			gdb_mon_print("stub-nocache: no MMU - the caches are off anyway\n");
+			return -1;
+		}
+		gdb_stub_nocache = (args[1] == 'n');
+		rpi2_stub_cacheable(!gdb_stub_nocache);
+	}
+	else if (*args != '\0')
+	{
+		return -1;
+	}
+	gdb_mon_print(gdb_stub_nocache ? "stub-nocache: on\n" : "stub-nocache: off\n");
+	return 0;
+}
+
+// reads the area through the caches
+static uint32_t gdb_cachebench_touch(uint32_t addr, uint32_t len)
+{
+	uint32_t sum = 0;
+	uint32_t i;
+
+	for (i=0; i<len; i+=32)
+	{
+		sum += *((volatile uint32_t *)(addr + i));
+	}
+	return sum;
+}
+
+// The stub's part of a typical stop, without the host: breakpoint lookup,
+// the 'g' reply and a stack read built, and a console packet sent through
+// the serial driver. The exception entry and exit only add the context.
+static void gdb_cachebench_stop()
+{
+	char *buf = (char *)gdb_tmp_packet;
+	uint32_t bytes = 64;
+	uint32_t sp = rpi2_reg_context.reg.r13 & ~3;
+	uint8_t *data;
+	int len;
+
+	(void)gdb_check_breakpoint();
+	len = gdb_regs_to_hex(buf, GDB_MAX_MSG_LEN);
+	if (sp + bytes <= PERIPH_BASE)
+	{
+		data = gdb_mask_breakpoints(sp, &bytes);
+		gdb_write_hex_data(data, (int)bytes, buf + len, GDB_MAX_MSG_LEN - len);
+	}
+	gdb_mon_print(".");
+}
+
+static void gdb_cachebench_line(char *name, uint32_t *res, int cycles)
+{
+	char line[80];
+
+	util_str_copy(line, name, 80);
+	util_append_str(line, "L1D refills ", 80);
+	util_word_to_dec(line + util_str_len(line), res[0] / GDB_CACHEBENCH_RUNS);
+	util_append_str(line, ", L2 refills ", 80);
+	util_word_to_dec(line + util_str_len(line), res[1] / GDB_CACHEBENCH_RUNS);
+	if (cycles)
+	{
+		util_append_str(line, ", cycles ", 80);
+		util_word_to_dec(line + util_str_len(line), res[2] / GDB_CACHEBENCH_RUNS);
+	}
+	util_append_str(line, "\n", 80);
+	gdb_mon_print(line);
+}
+
+// cachebench addr len - the debuggee's cache refills when it reads
+// a warm area again, without and with a stop in between
+static int gdb_mon_cachebench(char *args)
+{
+	static const unsigned int events[2] = {
+			PMU_EVT_L1D_CACHE_REFILL, PMU_EVT_L2D_CACHE_REFILL
+	};
+	unsigned int addr, len, counts[2];
+	uint32_t warm[3] = {0, 0, 0};
+	uint32_t stop[3] = {0, 0, 0};
+	uint32_t *res;
+	uint32_t cyc0, cyc1;
+	int n, run, i, cycles;
+
+	n = util_read_num(args, &addr);
+	if ((n == 0) || (util_read_num(args + n, &len) == 0))
+	{
+		return -1;
+	}
+	if ((len == 0) || (len > 0x100000) || (addr + len < addr)
+			|| (addr + len > PERIPH_BASE))
+	{
+		gdb_mon_print("cachebench: bad address range\n");
+		return -1;
+	}
+	cycles = (pmu_cycles_enable() == 0);
+	gdb_mon_print("cachebench: ");
+	for (run=0; run<GDB_CACHEBENCH_RUNS; run++)
+	{
+		for (i=0; i<2; i++)
+		{
+			(void)gdb_cachebench_touch(addr, len); // warm up
+			if (i)
+			{
+				gdb_cachebench_stop();
+			}
+			res = i ? stop : warm;
+			asm volatile ("mrc p15, 0, %0, c9, c13, 0\n\t" : "=r" (cyc0)); // PMCCNTR
+			pmu_events_start(events, 2);
+			(void)gdb_cachebench_touch(addr, len);
+			pmu_events_stop(counts, 2);
+			asm volatile ("mrc p15, 0, %0, c9, c13, 0\n\t" : "=r" (cyc1));
+			res[0] += counts[0];
+			res[1] += counts[1];
+			res[2] += cyc1 - cyc0;
+		}
+	}
+	gdb_mon_print(gdb_stub_nocache ? "\nstub non-cacheable, " : "\nstub cacheable, ");
+	gdb_mon_print("average per re-read:\n");
+	gdb_cachebench_line("no stop: ", warm, cycles);
+	gdb_cachebench_line("stop:    ", stop, cycles);
+	return 0;
+}
+
+// cycles / bytes with two decimals
+static void gdb_serbench_line(char *name, uint32_t cycles, uint32_t bytes)
+{
+	char line[80];
+	uint32_t per100;
+
+	per100 = (cycles * 100) / bytes; // bytes are at most 4 * 1023
+	util_str_copy(line, name, 80);
+	util_word_to_dec(line + util_str_len(line), per100 / 100);
+	util_append_str(line, (per100 % 100 < 10) ? ".0" : ".", 80);
+	util_word_to_dec(line + util_str_len(line), per100 % 100);
+	util_append_str(line, " cycles/byte\n", 80);
+	gdb_mon_print(line);
+}
+
+// serbench [N] - the serial ring copy (N bytes in and out, default 512)
+// the way the driver does it and the way it did with volatile buffers
+// and dsb + isb for each character
+static int gdb_mon_serbench(char *args)
+{
+	unsigned int n;
+	uint32_t cyc0, cyc1;
+	uint32_t res[2] = {0, 0};
+	int i, run;
+
+	if (util_read_num(args, &n) == 0)
+	{
+		n = 512;
+	}
+	if ((n == 0) || (n >= 1024))
+	{
+		gdb_mon_print("serbench: 1 - 1023 bytes\n");
+		return -1;
+	}
+	if (pmu_cycles_enable() != 0)
+	{
+		gdb_mon_print("serbench: the cycle counter is in use\n");
+		return -1;
+	}
+	for (run=0; run<GDB_CACHEBENCH_RUNS; run++)
+	{
+		for (i=0; i<2; i++)
+		{
+			asm volatile ("mrc p15, 0, %0, c9, c13, 0\n\t" : "=r" (cyc0)); // PMCCNTR
+			serial_ring_bench(i, (char *)gdb_tmp_packet, (int)n);
+			asm volatile ("mrc p15, 0, %0, c9, c13, 0\n\t" : "=r" (cyc1));
+			res[i] += cyc1 - cyc0;
+		}
+	}
+	gdb_serbench_line("serbench: now:    ", res[0], n * GDB_CACHEBENCH_RUNS);
+	gdb_serbench_line("serbench: legacy: ", res[1], n * GDB_CACHEBENCH_RUNS);
+	return 0;
+}
+
+// qRcmd,command - command is hex-encoded
+void gdb_cmd_monitor(char *hexcmd)
+{
+	int i = 0;
+	unsigned int j;
+	int ret = -1;
+	char *args;
+	char *msg;
+
+	while ((i < GDB_MON_LINE_LEN - 1) && (util_hex_to_nib(hexcmd[0]) >= 0)
+			&& (util_hex_to_nib(hexcmd[1]) >= 0))
+	{
+		gdb_mon_line[i++] = (char)util_hex_to_byte(hexcmd);
+		hexcmd += 2;
+	}
+	gdb_mon_line[i] = '\0';
+
+	// split the command name from the arguments
+	args = gdb_mon_line;
+	while (*args == ' ') args++;
+	msg = args; // command name
+	while ((*args != ' ') && (*args != '\0')) args++;
+	if (*args == ' ')
+	{
+		*(args++) = '\0';
+	}
+	for (j=0; j<GDB_MON_NUM_CMDS; j++)
+	{
+		if (util_str_cmp(msg, gdb_mon_cmds[j].name) == 0)
+		{
+			ret = gdb_mon_cmds[j].fun(args);
+			break;
+		}
+	}
+	if (j == GDB_MON_NUM_CMDS)
+	{
+		gdb_mon_print("unknown monitor command, try 'monitor help'\n");
+	}
+	if (ret > 0)
+	{
+		return; // the command replies later
+	}
+	msg = (ret == 0) ? "OK" : "E01";
+	gdb_send_packet(msg, util_str_len(msg));
+}
+
+// reply to a qXfer read of a generated stream: avail bytes at data
+static void gdb_xfer_send(int avail, uint8_t *data, uint32_t length)
+{
+	int i, j;
+	char *msg;
+
+	if (avail < 0)
+	{
+		msg = "E01";
+		gdb_send_packet(msg, util_str_len(msg));
+		return;
+	}
+	if (avail == 0)
+	{
+		msg = "l";
+		gdb_send_packet(msg, util_str_len(msg));
+		return;
+	}
+	if ((uint32_t)avail > length)
+	{
+		avail = (int)length;
+	}
+	gdb_tmp_packet[0] = 'm';
+	j = 1;
+	for (i=0; i<avail; i++)
+	{
+		// -6 to allow message overhead, escaped byte takes 2
+		if (j + 2 > GDB_MAX_MSG_LEN - 6) break;
+		j += util_byte_to_bin((unsigned char *)(gdb_tmp_packet + j), data[i]);
+	}
+	gdb_send_packet((char *)gdb_tmp_packet, j);
+}
+
+// qXfer:rpi-core:read::offset,length - core dump stream
+// (see coredump.c). Replies with as much as fits in a packet, the host
+// advances the offset by the amount of data it actually got.
+void gdb_xfer_core(char *args)
+{
+	int len, avail;
+	uint32_t offset, length;
+	uint8_t *data = (uint8_t *)0;
+
+	len = util_cpy_substr((char *)gdb_out_packet, args, ',', 16);
+	offset = util_hex_to_word((char *)gdb_out_packet);
+	length = util_hex_to_word(args + len + 1);
+	avail = coredump_read(offset, &data);
+	gdb_xfer_send(avail, data, length);
+}
+
+// qXfer:rpi-mem:read:addr,len:offset,length - compressed memory
+// (see memdump.c)
+void gdb_xfer_mem(char *args)
+{
+	int len, avail;
+	uint32_t addr, size, offset, length;
+	uint8_t *data = (uint8_t *)0;
+
+	len = util_cpy_substr((char *)gdb_out_packet, args, ',', 16);
+	addr = util_hex_to_word((char *)gdb_out_packet);
+	args += len + 1;
+	len = util_cpy_substr((char *)gdb_out_packet, args, ':', 16);
+	size = util_hex_to_word((char *)gdb_out_packet);
+	args += len + 1;
+	len = util_cpy_substr((char *)gdb_out_packet, args, ',', 16);
+	offset = util_hex_to_word((char *)gdb_out_packet);
+	length = util_hex_to_word(args + len + 1);
+	avail = memdump_read(addr, size, offset, &data);
+	gdb_xfer_send(avail, data, length);
+}
+
+// vendor packets in the qSupported reply
+static char * const gdb_rpi_features[] =
+{
+	"qRpiMemRead+", "QRpiMemWrite+", // multi-area memory read/write
+	"qRpiBacktrace+",
+	"QRpiWinWrite+",
+	"QRpiStopPush+",
+	"QRpiChannels+"
+};
+
+// appends a stubfeature to the qSupported reply, returns the reply length
+static int gdb_supported_add(char *buf, int *params, char *feature)
+{
+	if (*params)
+	{
+		util_append_str(buf, ";", GDB_MAX_MSG_LEN);
+	}
+	(*params)++;
+	return util_append_str(buf, feature, GDB_MAX_MSG_LEN);
+}
+
+// qSupported [:gdbfeature [;gdbfeature]... ]
+// reply: 'stubfeature [;stubfeature]...' - 'name=value', 'name+' or 'name-'
+// The reply doesn't fit in a command's response buffer, so it is built
+// in buf (GDB_MAX_MSG_LEN). Returns the reply length.
+static int gdb_supported_reply(char *buf, char *packet, int packet_len)
+{
+	int len = 0;
+	int packlen = 0, params = 0;
+	int i;
+	const int scratch_len = 32;
+	char scratchpad[scratch_len]; // scratchpad
+
+	buf[0] = '\0';
+	while (packet_len > 0)
+	{
+		len = util_cpy_substr(scratchpad, packet, ';', scratch_len);
+		packet += len+1; // the read and delimiter
+		packet_len -= (len + 1);
+		if (util_str_cmp(scratchpad, "PacketSize") == 0)
+		{
+			packlen = 1;
+			util_append_str(scratchpad, "=", scratch_len);
+			len = util_str_len(scratchpad);
+			util_word_to_hex(scratchpad + len, GDB_MAX_MSG_LEN);
+			gdb_supported_add(buf, &params, scratchpad);
+		}
+		else if (util_str_cmp(scratchpad, "swbreak+") == 0)
+		{
+			// don't use until the T05-format is clear
+			gdb_supported_add(buf, &params, "swbreak+");
+			gdb_swbreak = 1;
+		}
+		else if (util_str_cmp(scratchpad, "swbreak-") == 0)
+		{
+			gdb_supported_add(buf, &params, "swbreak-");
+			gdb_swbreak = 0;
+		}
+		else if (util_str_cmp(scratchpad, "hwbreak+") == 0)
+		{
+			// 'hwbreak+' only when HW breakpoints are supported
+			gdb_supported_add(buf, &params, "hwbreak-");
+			gdb_hwbreak = rpi2_use_hw_debug ? 1 : 0;
+		}
+		else if (util_str_cmp(scratchpad, "hwbreak-") == 0)
+		{
+			gdb_supported_add(buf, &params, "hwbreak-");
+			gdb_hwbreak = 0;
+		}
+		else if (util_str_cmp(scratchpad, "binary-upload+") == 0)
+		{
+			gdb_supported_add(buf, &params, "binary-upload+");
+			gdb_binupload = 1;
+		}
+		else if (util_cmp_substr(scratchpad, "xmlRegisters")
+				== util_str_len("xmlRegisters"))
+		{
+#ifdef GDB_FEATURE_XML
+			if (rpi2_neon_used)
+			{
+				gdb_supported_add(buf, &params, "qXfer:features:read+");
+			}
+#endif
+			// else keep silent on this
 		}
+		// else unsupported feature - not mentioned
+	}
+	for (i = 0; i < sizeof(gdb_rpi_features) / sizeof(gdb_rpi_features[0]); i++)
+	{
+		gdb_supported_add(buf, &params, gdb_rpi_features[i]);
+	}
+	if (packlen == 0) // PacketSize hasn't been given yet
+	{
+		util_str_copy(scratchpad, "PacketSize=", scratch_len);
+		util_word_to_hex(scratchpad + util_str_len(scratchpad), 256); // GDB_MAX_MSG_LEN / 4
+		gdb_supported_add(buf, &params, scratchpad);
+	}
+	return util_str_len(buf);
+}
+
+#ifdef DEBUG_GDB
+// the qSupported reply to a gdb that asks for all the features we know
+// (gdb 13 and later) must come whole, PacketSize included
+static void gdb_supported_test()
+{
+	char *features = "multiprocess+;swbreak+;hwbreak+;qRelocInsn+;"
+			"fork-events+;vfork-events+;exec-events+;vContSupported+;"
+			"QThreadEvents+;no-resumed+;memory-tagging+;xmlRegisters=arm;"
+			"binary-upload+";
+	char *msg;
+	char *expected;
+	int len;
+
+#ifdef GDB_FEATURE_XML
+	if (rpi2_neon_used)
+	{
+		expected = "swbreak+;hwbreak-;qXfer:features:read+;binary-upload+;"
+				"qRpiMemRead+;QRpiMemWrite+;qRpiBacktrace+;QRpiWinWrite+;"
+				"QRpiStopPush+;QRpiChannels+;PacketSize=00000100";
 	}
 	else
+#endif
 	{
-		gdb_send_packet("E05", 3);
+		expected = "swbreak+;hwbreak-;binary-upload+;"
+				"qRpiMemRead+;QRpiMemWrite+;qRpiBacktrace+;QRpiWinWrite+;"
+				"QRpiStopPush+;QRpiChannels+;PacketSize=00000100";
+	}
+	len = gdb_supported_reply((char *)gdb_tmp_packet, features,
+			util_str_len(features));
+	if ((len == util_str_len(expected))
+			&& (util_str_cmp((char *)gdb_tmp_packet, expected) == 0))
+	{
+		msg = "\r\nqSupported test: OK\r\n";
+		gdb_iodev->put_string(msg, util_str_len(msg)+1);
+		return;
 	}
+	msg = "\r\nqSupported test: FAIL\r\ngot: ";
+	gdb_iodev->put_string(msg, util_str_len(msg)+1);
+	gdb_iodev->put_string((char *)gdb_tmp_packet, len+1);
+	msg = "\r\nexpected: ";
+	gdb_iodev->put_string(msg, util_str_len(msg)+1);
+	gdb_iodev->put_string(expected, util_str_len(expected)+1);
+	msg = "\r\n";
+	gdb_iodev->put_string(msg, util_str_len(msg)+1);
 }
+#endif
 
 // q - for single core bare metal, fake single process (PID = 1)
 // If non-SMP config, the cores are different targets, if SMP-config,
@@ -1906,7 +3958,6 @@ void gdb_cmd_set_thread(char *gdb_packet, int packet_len)
 void gdb_cmd_common_query(char *gdb_packet, int packet_len)
 {
 	int len, i;
-	int packlen = 0, params = 0;
 	char *msg;
 	char *packet;
 	char *p;
@@ -1916,10 +3967,14 @@ void gdb_cmd_common_query(char *gdb_packet, int packet_len)
 	char scratchpad[scratch_len]; // scratchpad
 	char resp_buff[resp_buff_len]; // response buffer
 	// q name params
-	// qSupported [:gdbfeature [;gdbfeature]... ]
-	// PacketSize=bytes  value required
 	packet = (char *)gdb_packet;
 	resp_buff[0] = '\0';
+	// qRcmd,command (monitor command) - no ':'-delimiter
+	if (util_cmp_substr(packet, "qRcmd,") == util_str_len("qRcmd,"))
+	{
+		gdb_cmd_monitor(packet + util_str_len("qRcmd,"));
+		return;
+	}
 	if (packet_len > 1)
 	{
 		len = util_cpy_substr(scratchpad, packet, ':', scratch_len);
@@ -1936,158 +3991,8 @@ void gdb_cmd_common_query(char *gdb_packet, int packet_len)
 		// 		packet += len;
 		if (util_str_cmp(scratchpad, "qSupported") == 0)
 		{
-#if 1
-			while (packet_len > 0)
-			{
-				len = util_cpy_substr(scratchpad, packet, ';', scratch_len);
-				packet += len+1; // the read and delimiter
-				packet_len -= (len + 1);
-//#ifdef DEBUG_GDB
-#if 0
-				gdb_iodev->put_string("\r\nparam: ", 12);
-				gdb_iodev->put_string(scratchpad, util_str_len(scratchpad)+1);
-#endif
-				// reply: 'stubfeature [;stubfeature]...'
-				// 'name=value', 'name+' or 'name-'
-#if 1
-				if (util_str_cmp(scratchpad, "PacketSize") == 0)
-				{
-					packlen = 1;
-					if (params)
-					{
-						len = util_append_str(resp_buff + len, ";", resp_buff_len);
-					}
-					params++;
-					len = util_append_str(resp_buff, scratchpad, resp_buff_len);
-					len = util_append_str(resp_buff + len, "=", resp_buff_len);
-					//util_word_to_hex(resp_buff + len, 256);
-					util_word_to_hex(resp_buff + len, GDB_MAX_MSG_LEN);
-					len = util_str_len(resp_buff);
-				}
-				else if (util_str_cmp(scratchpad, "swbreak+") == 0)
-				{
-					if (params)
-					{
-						len = util_append_str(resp_buff + len, ";", resp_buff_len);
-					}
-					params++;
-#if 1
-					// don't use until the T05-format is clear
-					len = util_append_str(resp_buff, "swbreak+", resp_buff_len);
-#else
-					len = util_append_str(resp_buff, "swbreak-", resp_buff_len);
-#endif
-					len = util_str_len(resp_buff);
-					gdb_swbreak = 1;
-				}
-				else if (util_str_cmp(scratchpad, "swbreak-") == 0)
-				{
-					if (params)
-					{
-						len = util_append_str(resp_buff + len, ";", resp_buff_len);
-					}
-					params++;
-					len = util_append_str(resp_buff, "swbreak-", resp_buff_len);
-					len = util_str_len(resp_buff);
-					gdb_swbreak = 0;
-				}
-				else if (util_str_cmp(scratchpad, "hwbreak+") == 0)
-				{
-					if (rpi2_use_hw_debug)
-					{
-						if (params)
-						{
-							len = util_append_str(resp_buff + len, ";", resp_buff_len);
-						}
-						params++;
-#if 0
-						// Only use when HW breakpoints are supported
-						len = util_append_str(resp_buff, "hwbreak+", resp_buff_len);
-#else
-						len = util_append_str(resp_buff, "hwbreak-", resp_buff_len);
-#endif
-						len = util_str_len(resp_buff);
-						gdb_hwbreak = 1;
-					}
-					else
-					{
-						if (params)
-						{
-							len = util_append_str(resp_buff + len, ";", resp_buff_len);
-						}
-						params++;
-						len = util_append_str(resp_buff, "hwbreak-", resp_buff_len);
-						len = util_str_len(resp_buff);
-						gdb_hwbreak = 0;
-					}
-				}
-				else if (util_str_cmp(scratchpad, "hwbreak-") == 0)
-				{
-					if (params)
-					{
-						len = util_append_str(resp_buff + len, ";", resp_buff_len);
-					}
-					params++;
-					len = util_append_str(resp_buff, "hwbreak-", resp_buff_len);
-					len = util_str_len(resp_buff);
-					gdb_hwbreak = 0;
-				}
-				else if (util_cmp_substr(scratchpad, "xmlRegisters")
-						== util_str_len("xmlRegisters"))
-				{
-#ifdef GDB_FEATURE_XML
-					if (params)
-					{
-						len = util_append_str(resp_buff + len, ";", resp_buff_len);
-					}
-					params++;
-					if (rpi2_neon_used)
-					{
-						len = util_append_str(resp_buff, "qXfer:features:read+", resp_buff_len);
-						len = util_str_len(resp_buff);
-					}
-#endif
-					// else keep silent on this
-				}
-				else
-				{
-					/* unsupported feature */
-					//len = util_append_str(resp_buff, scratchpad, resp_buff_len);
-					//len = util_append_str(resp_buff, "-", resp_buff_len);
-				}
-#endif
-#if 0
-				if (packet_len > 0)
-				{
-					len = util_append_str(resp_buff, ";", resp_buff_len);
-				}
-#endif
-			}
-			if (packlen == 0) // PacketSize hasn't been given yet
-			{
-				if (params)
-				{
-					len = util_append_str(resp_buff + len, ";", resp_buff_len);
-				}
-				params++;
-				len = util_append_str(resp_buff, "PacketSize=", resp_buff_len);
-				util_word_to_hex(scratchpad, 256); // GDB_MAX_MSG_LEN / 4
-				//util_word_to_hex(scratchpad, GDB_MAX_MSG_LEN);
-				len = util_append_str(resp_buff, scratchpad, resp_buff_len);
-			}
-//#ifdef DEBUG_GDB
-#if 0
-			gdb_iodev->put_string("resp: ", 8);
-			gdb_iodev->put_string(resp_buff, util_str_len(resp_buff)+1);
-			gdb_iodev->put_string("\r\n", 3);
-#endif
-#else
-
-			len = util_str_copy(resp_buff, "swbreak+;hwbreak+;PacketSize=", resp_buff_len);
-			util_word_to_hex(scratchpad, 256); // GDB_MAX_MSG_LEN / 4
-			len = util_append_str(resp_buff, scratchpad, resp_buff_len);
-#endif
-			gdb_send_packet(resp_buff, len);
+			len = gdb_supported_reply((char *)gdb_tmp_packet, packet, packet_len);
+			gdb_send_packet((char *)gdb_tmp_packet, len);
 		}
 		else if (util_str_cmp(scratchpad, "qOffsets") == 0)
 		{
@@ -2113,16 +4018,36 @@ void gdb_cmd_common_query(char *gdb_packet, int packet_len)
 			len = util_str_copy(resp_buff, "0", resp_buff_len);
 			gdb_send_packet(resp_buff, len);
 		}
+		else if (util_str_cmp(scratchpad, "qRpiMemRead") == 0)
+		{
+			gdb_cmd_read_mem_multi(packet, packet_len);
+		}
+		else if (util_str_cmp(scratchpad, "qRpiBacktrace") == 0)
+		{
+			gdb_cmd_backtrace(packet, packet_len);
+		}
 		else if (util_str_cmp(scratchpad, "qSymbol") == 0)
 		{
-			// reply: 'OK' - Offer to provide symbol values (none)
-			len = util_str_copy(resp_buff, "OK", resp_buff_len);
-			gdb_send_packet(resp_buff, len);
+			// ask for the unwind table location
+			gdb_cmd_symbol(packet, packet_len, resp_buff, resp_buff_len);
 		}
-#ifdef GDB_FEATURE_XML
-		// qXfer:features:read:annex:offset,length (target.xml)
+		// qXfer:object:read:annex:offset,length
 		else if (util_str_cmp(scratchpad, "qXfer") == 0)
 		{
+			if (util_cmp_substr("rpi-core:read::", packet)
+					== util_str_len("rpi-core:read::"))
+			{
+				gdb_xfer_core(packet + util_str_len("rpi-core:read::"));
+				return;
+			}
+			if (util_cmp_substr("rpi-mem:read:", packet)
+					== util_str_len("rpi-mem:read:"))
+			{
+				gdb_xfer_mem(packet + util_str_len("rpi-mem:read:"));
+				return;
+			}
+#ifdef GDB_FEATURE_XML
+			// qXfer:features:read:annex:offset,length (target.xml)
 			len = util_cmp_substr("features:read:", packet);
 			packet += len;
 			packet_len -= len;
@@ -2191,8 +4116,10 @@ void gdb_cmd_common_query(char *gdb_packet, int packet_len)
 			{
 				gdb_response_not_supported();
 			}
-		}
+#else
+			gdb_response_not_supported();
 #endif
+		}
 		else
 		{
 			gdb_response_not_supported(); // for now
@@ -2208,6 +4135,116 @@ void gdb_cmd_restart_program(char *gdb_packet, int packet_len)
 	gdb_response_not_supported(); // for now
 }
 
+// Which of the I/F bits the stepped ARM instruction writes itself.
+// With mrs, rd gets the register number, otherwise -1.
+// The mode is the one the instruction was executed in, not the one
+// after the step (an exception return changes it).
+static uint32_t gdb_step_if_writes(uint32_t instr, int *rd)
+{
+	uint32_t mode = gdb_step_saved_mode;
+
+	*rd = -1;
+	if ((instr & 0xfff1fe20) == 0xf1000000) // cps
+	{
+		if ((mode == INSTR_PMODE_USR) || !(instr & (1 << 19))) // no imod
+		{
+			return 0;
+		}
+		return instr & GDB_PSR_IF; // I and F bits are in the same place
+	}
+	if (!gdb_step_executed)
+	{
+		return 0;
+	}
+	if (((instr & 0x0ff0fff0) == 0x0120f000) // msr cpsr, reg
+			|| ((instr & 0x0ff0f000) == 0x0320f000)) // msr cpsr, #imm
+	{
+		// control field, privileged only
+		return ((instr & (1 << 16)) && (mode != INSTR_PMODE_USR)) ? GDB_PSR_IF : 0;
+	}
+	if ((instr & 0x0fff0fff) == 0x010f0000) // mrs rd, cpsr
+	{
+		*rd = (int)((instr >> 12) & 0xf);
+		return 0;
+	}
+	// exception returns: cpsr from spsr, unless executed in USR/SYS
+	// mode that has no spsr
+	if (((instr & 0x0c10f000) == 0x0010f000) // subs pc, ... / movs pc, ...
+			|| ((instr & 0x0e508000) == 0x08508000) // ldm {.., pc}^
+			|| ((instr & 0xfe50ffff) == 0xf8100a00)) // rfe
+	{
+		if ((mode != INSTR_PMODE_USR) && (mode != INSTR_PMODE_SYS))
+		{
+			return GDB_PSR_IF;
+		}
+	}
+	return 0;
+}
+
+// mask IRQ and FIQ for the step of the instruction at addr
+static void gdb_step_mask(uint32_t addr)
+{
+	if (!rpi2_step_masked)
+	{
+		return;
+	}
+	gdb_step_instr = *((uint32_t *)addr);
+	gdb_step_executed = (uint32_t)will_branch(gdb_step_instr);
+	gdb_step_saved_if = rpi2_reg_context.reg.cpsr & GDB_PSR_IF;
+	gdb_step_saved_mode = rpi2_reg_context.reg.cpsr & 0x1f;
+	rpi2_reg_context.reg.cpsr |= GDB_PSR_IF;
+	gdb_step_masked = 1;
+}
+
+// restore the I/F bits after a step, keeping the changes made by the
+// stepped instruction itself. done = the step was completed
+static void gdb_step_unmask(int done)
+{
+	uint32_t writes = 0;
+	int rd = -1;
+
+	if (!gdb_step_masked)
+	{
+		return;
+	}
+	gdb_step_masked = 0;
+	if (done)
+	{
+		writes = gdb_step_if_writes(gdb_step_instr, &rd);
+	}
+	rpi2_reg_context.reg.cpsr = (rpi2_reg_context.reg.cpsr & ~(GDB_PSR_IF & ~writes))
+			| (gdb_step_saved_if & ~writes);
+	if ((rd >= 0) && (rd < 15))
+	{
+		// mrs read our mask bits
+		rpi2_reg_context.storage[rd] = (rpi2_reg_context.storage[rd] & ~GDB_PSR_IF)
+				| gdb_step_saved_if;
+	}
+}
+
+// end of the straight-line block starting at addr: the first instruction
+// that may change the control flow, or the target address.
+// Returns addr if the block is empty.
+static uint32_t gdb_block_end(uint32_t addr, uint32_t target)
+{
+	uint32_t end = addr;
+	int i;
+
+	for (i = 0; i < GDB_MAX_BLOCK_INSTRS; i++)
+	{
+		if (!is_linear_arm(*((uint32_t *)end)))
+		{
+			break;
+		}
+		end += 4;
+		if (end == target)
+		{
+			break;
+		}
+	}
+	return end;
+}
+
 void gdb_do_single_step(void)
 {
 	instr_next_addr_t next_addr;
@@ -2220,6 +4257,7 @@ void gdb_do_single_step(void)
 
 	curr_addr = rpi2_reg_context.reg.r15; // stored PC
 
+	gdb_apply_breakpoints(); // net effect of z0/Z0s
 	LOG_PR_VAL("Current address: ", curr_addr);
 	LOG_NEWLINE();
 	if (gdb_single_stepping_address != 0xffffffff)
@@ -2239,7 +4277,27 @@ void gdb_do_single_step(void)
 		}
 	}
 	// step
-	next_addr = next_address(curr_addr);
+	next_addr = set_undef_addr();
+	if ((gdb_single_stepping_address != 0xffffffff) && gdb_step_blocks
+			&& !(rpi2_reg_context.reg.cpsr & (1 << 5)))
+	{
+		// run to the end of the straight-line block in one go
+		next_addr = set_arm_addr(gdb_block_end(curr_addr,
+				gdb_single_stepping_address));
+		if (next_addr.address == curr_addr)
+		{
+			next_addr = set_undef_addr();
+		}
+		else
+		{
+			LOG_PR_VAL("Block end: ", next_addr.address);
+			LOG_NEWLINE();
+		}
+	}
+	if (next_addr.flag == INSTR_ADDR_UNDEF)
+	{
+		next_addr = next_address(curr_addr);
+	}
 	if ((next_addr.flag & (~INSTR_ADDR_UNPRED)) == INSTR_ADDR_UNDEF)
 	{
 		LOG_PR_VAL("Next instr undef: ", *((uint32_t *)curr_addr));
@@ -2287,6 +4345,7 @@ void gdb_do_single_step(void)
 	rpi2_set_trap(gdb_step_bkpt.trap_address, RPI2_TRAP_ARM);
 	LOG_PR_VAL("Next address: ", next_addr.address);
 	LOG_NEWLINE();
+	gdb_step_mask(curr_addr);
 	gdb_monitor_running = 0;
 	// Delayed response - sent when stepping is done
 }
@@ -2343,6 +4402,7 @@ void gdb_cmd_write_mem_bin(char *gdb_in_packet, int packet_len)
 		packet_len -= (len + 1);
 		bytes = util_hex_to_word(scratchpad); // address to binary
 		// write to memory
+		gdb_unmask_breakpoints(addr, bytes);
 		gdb_read_bin_data((uint8_t *)gdb_in_packet, (int)bytes, (uint8_t *) addr,
 				GDB_MAX_MSG_LEN); // can't be more than message size
 			// send response
@@ -2356,7 +4416,7 @@ void gdb_cmd_read_mem_bin(char *gdb_in_packet, int packet_len)
 {
 	uint32_t addr;
 	uint32_t bytes;
-	int len;
+	int len, i;
 	const int scratch_len = 16;
 	char scratchpad[scratch_len];
 	if (packet_len > 1)
@@ -2366,11 +4426,18 @@ void gdb_cmd_read_mem_bin(char *gdb_in_packet, int packet_len)
 		gdb_in_packet += len+1; // skip address and delimiter
 		addr = util_hex_to_word(scratchpad); // address to binary
 		bytes = util_hex_to_word((char *)gdb_in_packet); // read nuber of bytes
+		// gdb 'binary-upload' wants 'b' before data
+		i = 0;
+		if (gdb_binupload)
+		{
+			gdb_tmp_packet[i++] = 'b';
+		}
 		// dump memory as bin into temp buffer
-		len = gdb_write_bin_data((uint8_t *)addr, (int)bytes, (uint8_t *)gdb_tmp_packet,
-				 GDB_MAX_MSG_LEN - 5); // -5 to allow message overhead
+		len = gdb_write_bin_data(gdb_mask_breakpoints(addr, &bytes), (int)bytes,
+				(uint8_t *)(gdb_tmp_packet + i),
+				 GDB_MAX_MSG_LEN - 6); // -6 to allow message overhead + 'b'
 		// send response
-		gdb_send_packet((char *)gdb_tmp_packet, len);
+		gdb_send_packet((char *)gdb_tmp_packet, len + i);
 	}
 }
 
@@ -2410,6 +4477,59 @@ void gdb_cmd_special(char *gdb_in_packet, int packet_len)
 	}
 }
 
+// signed hex number of 'F'-reply
+static int gdb_hex_to_int(char *p)
+{
+	if (*p == '-')
+	{
+		return -((int)util_hex_to_word(p + 1));
+	}
+	return (int)util_hex_to_word(p);
+}
+
+// F retcode[,errno[,C]][;attachment] - reply to File-I/O request
+void gdb_cmd_file_reply(char *gdb_in_packet, int packet_len)
+{
+	int len;
+	int retcode;
+	int err = 0;
+	int ctrlc = 0;
+	const int scratch_len = 16;
+	char scratchpad[scratch_len];
+
+	if ((packet_len < 1) || (!semihost_pending()))
+	{
+		gdb_response_not_supported();
+		return;
+	}
+	len = util_cpy_substr(scratchpad, (char *)gdb_in_packet, ',', scratch_len);
+	gdb_in_packet += len; // to delimiter
+	retcode = gdb_hex_to_int(scratchpad);
+	if (*gdb_in_packet == ',')
+	{
+		gdb_in_packet++; // skip delimiter
+		len = util_cpy_substr(scratchpad, (char *)gdb_in_packet, ',', scratch_len);
+		gdb_in_packet += len;
+		err = gdb_hex_to_int(scratchpad);
+		if (*gdb_in_packet == ',')
+		{
+			if (*(gdb_in_packet + 1) == 'C')
+			{
+				ctrlc = 1; // ctrl-C pressed during the call
+			}
+		}
+	}
+	semihost_reply(retcode, err);
+	if (ctrlc)
+	{
+		gdb_resp_target_halted(SIG_INT);
+	}
+	else
+	{
+		gdb_cmd_cont("", 0); // no response
+	}
+}
+
 // Z1 - Z4 = HW breakpoints/watchpoints
 
 void gdb_cmd_add_watchpoint(char *gdb_in_packet, int packet_len)
@@ -2629,7 +4749,7 @@ void gdb_cmd_delete_breakpoint(char *gdb_in_packet, int packet_len)
 	//rpi2_set_watchpoint(0, (unsigned int)(&gdb_num_bkpts), 4);
 }
 
-void gdb_restore_breakpoint(volatile gdb_trap_rec *bkpt)
+void gdb_restore_breakpoint(gdb_trap_rec *bkpt)
 {
 	if (bkpt->trap_kind == RPI2_TRAP_ARM)
 	{
@@ -2644,6 +4764,51 @@ void gdb_restore_breakpoint(volatile gdb_trap_rec *bkpt)
 
 }
 
+// semihosting call from debuggee - make File-I/O request out of it
+void gdb_semihost_request()
+{
+	int len;
+
+	switch (semihost_request((char *)gdb_tmp_packet, GDB_MAX_MSG_LEN - 5, &len))
+	{
+	case SEMIHOST_FILEIO:
+		// gdb uses the buffers with m/X/x and answers with 'F'
+		gdb_monitor_running = 1;
+		gdb_send_packet((char *)gdb_tmp_packet, len);
+		break;
+	case SEMIHOST_EXIT:
+		gdb_debuggee.status = (uint8_t)semihost_exit_status();
+		gdb_resp_target_halted(FINISHED);
+		break;
+	default:
+		// handled in the stub - just return to debuggee
+		gdb_monitor_running = 0;
+		break;
+	}
+}
+
+// semihosting call from a function run with monitor call or runtests.
+// gdb is waiting for the reply to the monitor command, so File-I/O
+// can't be used: those calls fail with EIO. Returns 0 if the function
+// exited and the call ends like with an exception.
+static int gdb_call_semihost()
+{
+	int len;
+
+	switch (semihost_request((char *)gdb_tmp_packet, GDB_MAX_MSG_LEN - 5, &len))
+	{
+	case SEMIHOST_EXIT:
+		return 0;
+	case SEMIHOST_FILEIO:
+		semihost_reply(-1, 5); // gdb File-I/O EIO
+		break;
+	default:
+		break;
+	}
+	gdb_monitor_running = 0;
+	return 1;
+}
+
 // handle stuff left pending until exception
 void gdb_handle_pending_state(int reason)
 {
@@ -2654,6 +4819,27 @@ void gdb_handle_pending_state(int reason)
 #endif
 	curr_addr = rpi2_reg_context.reg.r15; // stored PC
 
+	// a masked step ends with any stop
+	gdb_step_unmask((reason == SIG_TRAP) && (gdb_trap_num == GDB_MAX_BREAKPOINTS));
+
+	if (reason == SEMIHOSTING)
+	{
+		if (!gdb_call_active)
+		{
+			gdb_semihost_request();
+			return; // response handled within the call
+		}
+		if (gdb_call_semihost())
+		{
+			return; // back to the called function
+		}
+	}
+
+	if (gdb_call_active)
+	{
+		gdb_call_stopped(reason);
+		return; // response handled within the call
+	}
 	// break point or single step
 	if (reason == SIG_TRAP)
 	{
@@ -2689,6 +4875,12 @@ void gdb_handle_pending_state(int reason)
 			}
 		}
 	}
+	if (reason == REATTACH)
+	{
+		// gdb is (re)connecting - the stop is reported with '?'
+		gdb_monitor_running = 1;
+		return;
+	}
 	if (reason == SIG_INT)
 	{
 		if (!gdb_monitor_running)
@@ -2734,6 +4926,9 @@ void gdb_monitor(int reason)
 	gdb_iodev->put_string(msg, util_str_len(msg)+1);
 #endif
 
+	hyp_stop_begin(); // stop time isn't shown in the virtual counter
+	acctrace_open(1); // gdb can read the traced pages
+	gdb_stop_reason = reason;
 	gdb_handle_pending_state(reason);
 
 #ifdef DEBUG_GDB
@@ -2818,7 +5013,15 @@ void gdb_monitor(int reason)
 			gdb_send_packet(scratchpad, util_str_len(scratchpad));
 		}
 #endif
-		packet_len = receive_packet(inpkg);
+		inpkg = (char *)gdb_in_packet; // commands move the pointer
+		if (loadpipe_active())
+		{
+			packet_len = gdb_pipe_receive(inpkg);
+		}
+		else
+		{
+			packet_len = receive_packet(inpkg);
+		}
 #ifdef DEBUG_GDB
 		msg = "packet received\r\n";
 		gdb_iodev->put_string(msg, util_str_len(msg)+1);
@@ -2851,6 +5054,11 @@ void gdb_monitor(int reason)
 #endif
 		if (packet_len < 0)
 		{
+			if ((packet_len == -2) && gdb_win_bad_packet(inpkg))
+			{
+				// selective NAK sent
+				continue;
+			}
 			// send NACK
 			gdb_packet_nack();
 			// flush, re-read
@@ -2921,8 +5129,8 @@ void gdb_monitor(int reason)
 			case 'D':	// detach
 				gdb_cmd_detach(++inpkg, --packet_len);
 				break;
-			case 'F':	// file I/O - for gdb console
-				gdb_response_not_supported(); // for now
+			case 'F':	// file I/O reply (semihosting)
+				gdb_cmd_file_reply(++inpkg, --packet_len);
 				break;
 			case 'g':	// get regs +
 				gdb_cmd_get_regs(++inpkg, --packet_len);
@@ -2952,7 +5160,7 @@ void gdb_monitor(int reason)
 				gdb_cmd_common_query(inpkg, packet_len);
 				break;
 			case 'Q':	// set
-				gdb_response_not_supported(); // for now
+				gdb_cmd_common_set(inpkg, packet_len);
 				break;
 			case 'R':	// restart program
 				gdb_cmd_restart_program(inpkg, packet_len);
@@ -3040,10 +5248,11 @@ void gdb_monitor(int reason)
 				break; // needless, but some tools want this
 			}
 		}
-		SYNC;
 	}
 	// enable CTRL-C
 	gdb_iodev->enable_ctrlc(); // enable
+	acctrace_open(0);
+	hyp_stop_end();
 
 	//ch = "\r\nLeaving GDB-monitor\r\n";
 	//gdb_send_text_packet(ch, util_str_len(ch));
@@ -44,5 +44,10 @@ void gdb_trap();
 void gdb_reset();
 void gdb_trap_handler();
 void gdb_send_text_packet(char *msg, unsigned int msglen);
+void gdb_mon_print(char *msg);
+void gdb_copy_mem(uint32_t addr, uint8_t *buf, uint32_t len);
+int gdb_read_bin_data(uint8_t *bindata, int count, uint8_t *outdata, int max);
+int gdb_win_parse(char *packet, int packet_len, uint32_t *seq, uint32_t *addr,
+		uint32_t *bytes);
 
 #endif /* GDB_H_ */
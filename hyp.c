@@ -0,0 +1,386 @@
+/*
+hyp.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Debugging from HYP mode (rpi_stub_hyp).
+// The firmware starts the cores in HYP mode. start.S leaves the vector
+// table below in HVBAR before dropping to SVC. When the debug hypervisor
+// is taken into use, the debug exceptions (breakpoints, BKPT, watchpoints)
+// of the non-secure PL1&0 are routed to HYP (HDCR.TDE) and the FIQ (UART0)
+// as well (HCR.FMO), but only while the debuggee runs. Everything else is
+// delivered through the debuggee's own VBAR, without the stub.
+// A routed debug exception is injected into the stub's own prefetch or
+// data abort handler, as if it had been taken in PL1, and the ctrl-C FIQ
+// into rpi2_fiq_sigint, after setting VBAR to the stub's vectors. The
+// stub gives the debuggee's vectors back with 'hvc #1' when it returns.
+// The stub itself keeps running in PL1 as before.
+// The same vectors let the stub add the time the debuggee is stopped to
+// CNTVOFF (hvc #3) even if the debug hypervisor is not in use, so that
+// the debuggee's virtual counter and timer only advance while it runs.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "hyp.h"
+#include "gdb.h"
+#include "util.h"
+
+extern uint32_t rpi2_upper_vec_address;
+extern uint32_t rpi2_serial_handler(uint32_t stack_pointer, uint32_t exc_addr);
+extern void rpi2_fiq_sigint();
+
+// LPAE block descriptor attributes: AttrIndx, AP[1] (SBO in HYP), SH, AF
+#define HYP_BLOCK_NORMAL 0x741ULL	// attr 0, inner shareable
+#define HYP_BLOCK_DEVICE (0x445ULL | (1ULL << 54)) // attr 1, XN
+#define HYP_TABLE 3ULL
+// attr 0: normal, write-through read-allocate (like the stub),
+// attr 1: device
+#define HYP_MAIR0 0x000004aa
+// T0SZ = 0, write-through walks, inner shareable
+#define HYP_TCR (0x80800000 | (3 << 12) | (2 << 10) | (2 << 8))
+
+unsigned int hyp_boot;
+unsigned int hyp_active;
+unsigned int hyp_hide_stops = 1;
+
+// HYP-only state
+static uint32_t hyp_swapped;	// stub's vectors in use
+static uint32_t hyp_debuggee_vbar;
+static uint32_t hyp_debuggee_ifsr;
+static uint32_t hyp_debuggee_dfsr;
+static uint32_t hyp_debuggee_dfar;
+
+// stop time hiding (PL1)
+static uint64_t hyp_stop_start;	// CNTVCT at the stop
+static uint64_t hyp_hidden;	// total hidden time in counter ticks
+
+// HYP translation tables: 1:1 mapping, RAM cached the same way as in
+// the stub so that both see the same data
+static uint64_t hyp_pmd[512] __attribute__ ((aligned (4096)));
+static uint64_t hyp_pgd[4] __attribute__ ((aligned (32)));
+
+void hyp_vectors() __attribute__ ((naked));
+
+// HYP mode functions (called from hyp_vectors)
+void hyp_setup();
+void hyp_enter();
+void hyp_resume();
+
+void hyp_vectors()
+{
+	asm volatile (
+			".align 5\n\t"
+			".globl hyp_vec_table\n\t"
+			"hyp_vec_table:\n\t"
+			"b hyp_unexpected @ reset\n\t"
+			"b hyp_unexpected @ undef in HYP\n\t"
+			"b hyp_unexpected @ hvc in HYP\n\t"
+			"b hyp_unexpected @ prefetch abort in HYP\n\t"
+			"b hyp_unexpected @ data abort in HYP\n\t"
+			"b hyp_trap @ trap from PL1/PL0\n\t"
+			"b hyp_unexpected @ IRQ\n\t"
+			"b hyp_fiq @ FIQ\n\t"
+
+			"hyp_unexpected:\n\t"
+			"wfe\n\t"
+			"b hyp_unexpected\n\t"
+
+			"hyp_trap:\n\t"
+			"push {r0 - r3, r12, lr}\n\t"
+			"mrc p15, 4, r0, c5, c2, 0 @ HSR\n\t"
+			"lsr r1, r0, #26 @ exception class\n\t"
+			"cmp r1, #0x12 @ hvc\n\t"
+			"beq hyp_hvc\n\t"
+			"cmp r1, #0x20 @ prefetch abort routed to HYP\n\t"
+			"beq hyp_pabt\n\t"
+			"cmp r1, #0x24 @ data abort routed to HYP\n\t"
+			"beq hyp_dabt\n\t"
+			"b hyp_unexpected\n\t"
+
+			"hyp_hvc:\n\t"
+			"uxth r0, r0 @ hvc immediate\n\t"
+			"cmp r0, #1 @ HYP_HVC_RESUME\n\t"
+			"bne 1f\n\t"
+			"bl hyp_resume\n\t"
+			"b hyp_return\n\t"
+			"1:\n\t"
+			"cmp r0, #2 @ HYP_HVC_ENTER\n\t"
+			"bne 2f\n\t"
+			"bl hyp_enter\n\t"
+			"b hyp_return\n\t"
+			"2:\n\t"
+			"cmp r0, #3 @ HYP_HVC_CNTVOFF\n\t"
+			"bne 3f\n\t"
+			"ldm sp, {r0, r1} @ the caller's r0 and r1\n\t"
+			"mrrc p15, 4, r2, r3, c14 @ CNTVOFF\n\t"
+			"adds r2, r0\n\t"
+			"adc r3, r1\n\t"
+			"mcrr p15, 4, r2, r3, c14\n\t"
+			"isb\n\t"
+			"b hyp_return\n\t"
+			"3:\n\t"
+			"cmp r0, #0 @ HYP_HVC_ENABLE\n\t"
+			"bne hyp_return\n\t"
+			"bl hyp_setup\n\t"
+			"hyp_return:\n\t"
+			"pop {r0 - r3, r12, lr}\n\t"
+			"eret\n\t"
+
+			"@ breakpoint or BKPT - to the stub's prefetch abort handler\n\t"
+			"hyp_pabt:\n\t"
+			"bl hyp_enter\n\t"
+			"mrs r0, ELR_hyp\n\t"
+			"add r0, #4 @ like in PL1\n\t"
+			"msr LR_abt, r0\n\t"
+			"mrs r0, SPSR_hyp\n\t"
+			"msr SPSR_abt, r0\n\t"
+			"mov r0, #2 @ debug event\n\t"
+			"mcr p15, 0, r0, c5, c0, 1 @ IFSR\n\t"
+			"ldr r0, =rpi2_upper_vec_address\n\t"
+			"ldr r0, [r0]\n\t"
+			"add r0, #12 @ prefetch abort vector\n\t"
+			"b hyp_inject_abt\n\t"
+
+			"@ watchpoint - to the stub's data abort handler\n\t"
+			"hyp_dabt:\n\t"
+			"bl hyp_enter\n\t"
+			"mrs r0, ELR_hyp\n\t"
+			"add r0, #8 @ like in PL1\n\t"
+			"msr LR_abt, r0\n\t"
+			"mrs r0, SPSR_hyp\n\t"
+			"msr SPSR_abt, r0\n\t"
+			"mrc p15, 4, r0, c6, c0, 0 @ HDFAR\n\t"
+			"mcr p15, 0, r0, c6, c0, 0 @ DFAR\n\t"
+			"mrc p15, 4, r0, c5, c2, 0 @ HSR\n\t"
+			"and r0, #0x40 @ WnR\n\t"
+			"lsl r0, #5 @ to DFSR.WnR\n\t"
+			"orr r0, #2 @ debug event\n\t"
+			"mcr p15, 0, r0, c5, c0, 0 @ DFSR\n\t"
+			"ldr r0, =rpi2_upper_vec_address\n\t"
+			"ldr r0, [r0]\n\t"
+			"add r0, #16 @ data abort vector\n\t"
+			"hyp_inject_abt:\n\t"
+			"msr ELR_hyp, r0\n\t"
+			"movw r0, #0x1d7 @ ABT-mode, aif masked\n\t"
+			"msr SPSR_hyp, r0\n\t"
+			"isb\n\t"
+			"b hyp_return\n\t"
+
+			"@ UART0 (or PMU) while the debuggee runs\n\t"
+			"hyp_fiq:\n\t"
+			"push {r0 - r3, r12, lr}\n\t"
+			"mov r0, sp\n\t"
+			"mrs r1, ELR_hyp\n\t"
+			"bl rpi2_serial_handler\n\t"
+			"cmp r0, #2 @ ctrl-c or run-for budget\n\t"
+			"bne hyp_return\n\t"
+			"bl hyp_enter\n\t"
+			"mrs r0, ELR_hyp @ no offset in HYP\n\t"
+			"msr LR_fiq, r0\n\t"
+			"mrs r0, SPSR_hyp\n\t"
+			"msr SPSR_fiq, r0\n\t"
+			"ldr r0, =rpi2_fiq_sigint\n\t"
+			"msr ELR_hyp, r0\n\t"
+			"movw r0, #0x1d1 @ FIQ-mode, aif masked\n\t"
+			"msr SPSR_hyp, r0\n\t"
+			"isb\n\t"
+			"b hyp_return\n\t"
+			".ltorg @ literal pool\n\t"
+	);
+}
+
+// the stub takes over: its own vectors, debug exceptions to PL1
+void hyp_enter()
+{
+	uint32_t tmp;
+
+	if (!hyp_swapped)
+	{
+		asm volatile ("mrc p15, 0, %0, c12, c0, 0 @ VBAR\n\t" : "=r" (hyp_debuggee_vbar));
+		asm volatile ("mrc p15, 0, %0, c5, c0, 1 @ IFSR\n\t" : "=r" (hyp_debuggee_ifsr));
+		asm volatile ("mrc p15, 0, %0, c5, c0, 0 @ DFSR\n\t" : "=r" (hyp_debuggee_dfsr));
+		asm volatile ("mrc p15, 0, %0, c6, c0, 0 @ DFAR\n\t" : "=r" (hyp_debuggee_dfar));
+		asm volatile ("mcr p15, 0, %0, c12, c0, 0 @ VBAR\n\t" :: "r" (rpi2_upper_vec_address));
+		hyp_swapped = 1;
+	}
+	asm volatile ("mrc p15, 4, %0, c1, c1, 1 @ HDCR\n\t" : "=r" (tmp));
+	tmp &= ~HYP_HDCR_TDE;
+	asm volatile ("mcr p15, 4, %0, c1, c1, 1 @ HDCR\n\t" :: "r" (tmp));
+	asm volatile ("mrc p15, 4, %0, c1, c1, 0 @ HCR\n\t" : "=r" (tmp));
+	tmp &= ~HYP_HCR_FMO;
+	asm volatile ("mcr p15, 4, %0, c1, c1, 0 @ HCR\n\t" :: "r" (tmp));
+	SYNC;
+}
+
+// back to the debuggee: its own vectors, debug exceptions to HYP
+void hyp_resume()
+{
+	uint32_t tmp;
+
+	if (hyp_swapped)
+	{
+		asm volatile ("mcr p15, 0, %0, c12, c0, 0 @ VBAR\n\t" :: "r" (hyp_debuggee_vbar));
+		asm volatile ("mcr p15, 0, %0, c5, c0, 1 @ IFSR\n\t" :: "r" (hyp_debuggee_ifsr));
+		asm volatile ("mcr p15, 0, %0, c5, c0, 0 @ DFSR\n\t" :: "r" (hyp_debuggee_dfsr));
+		asm volatile ("mcr p15, 0, %0, c6, c0, 0 @ DFAR\n\t" :: "r" (hyp_debuggee_dfar));
+		hyp_swapped = 0;
+	}
+	asm volatile ("mrc p15, 4, %0, c1, c1, 1 @ HDCR\n\t" : "=r" (tmp));
+	tmp |= HYP_HDCR_TDE;
+	asm volatile ("mcr p15, 4, %0, c1, c1, 1 @ HDCR\n\t" :: "r" (tmp));
+	asm volatile ("mrc p15, 4, %0, c1, c1, 0 @ HCR\n\t" : "=r" (tmp));
+	tmp |= HYP_HCR_FMO;
+	asm volatile ("mcr p15, 4, %0, c1, c1, 0 @ HCR\n\t" :: "r" (tmp));
+	SYNC;
+}
+
+// runs in HYP mode
+void hyp_setup()
+{
+	int i;
+	uint32_t addr, tmp;
+
+	if (rpi2_use_mmu)
+	{
+		// the stub uses caches, so HYP must too, to see the same data
+		for (i=0; i<512; i++)
+		{
+			addr = (uint32_t)i << 21; // 2 MB blocks
+			hyp_pmd[i] = (uint64_t)addr
+					| ((addr < PERIPH_BASE) ? HYP_BLOCK_NORMAL : HYP_BLOCK_DEVICE);
+		}
+		hyp_pgd[0] = (uint64_t)(uint32_t)hyp_pmd | HYP_TABLE;
+		for (i=1; i<4; i++)
+		{
+			hyp_pgd[i] = ((uint64_t)i << 30) | HYP_BLOCK_DEVICE; // 1 GB blocks
+		}
+		SYNC;
+		asm volatile ("mcr p15, 4, %0, c10, c2, 0 @ HMAIR0\n\t" :: "r" (HYP_MAIR0));
+		asm volatile ("mcr p15, 4, %0, c2, c0, 2 @ HTCR\n\t" :: "r" (HYP_TCR));
+		asm volatile ("mcrr p15, 4, %0, %1, c2 @ HTTBR\n\t"
+				:: "r" ((uint32_t)hyp_pgd), "r" (0));
+		asm volatile ("mcr p15, 4, %0, c8, c7, 0 @ TLBIALLH\n\t" :: "r" (0));
+		SYNC;
+		asm volatile ("mrc p15, 4, %0, c1, c0, 0 @ HSCTLR\n\t" : "=r" (tmp));
+		tmp |= HYP_HSCTLR_M | HYP_HSCTLR_C | HYP_HSCTLR_I;
+		asm volatile ("mcr p15, 4, %0, c1, c0, 0 @ HSCTLR\n\t" :: "r" (tmp));
+		SYNC;
+	}
+	// the stub is running - the debuggee vectors are taken into use
+	// at the first resume
+	hyp_debuggee_vbar = 0; // the low vectors
+	asm volatile ("mrc p15, 0, %0, c5, c0, 1 @ IFSR\n\t" : "=r" (hyp_debuggee_ifsr));
+	asm volatile ("mrc p15, 0, %0, c5, c0, 0 @ DFSR\n\t" : "=r" (hyp_debuggee_dfsr));
+	asm volatile ("mrc p15, 0, %0, c6, c0, 0 @ DFAR\n\t" : "=r" (hyp_debuggee_dfar));
+	hyp_swapped = 1;
+}
+
+void hyp_init()
+{
+	hyp_active = 0;
+	if (hyp_boot && rpi2_use_hyp)
+	{
+		asm volatile ("hvc #0 @ HYP_HVC_ENABLE\n\t" ::: "memory");
+		hyp_active = 1;
+	}
+}
+
+static uint64_t hyp_cntvct()
+{
+	uint32_t lo, hi;
+
+	asm volatile (
+			"isb\n\t"
+			"mrrc p15, 1, %0, %1, c14 @ CNTVCT\n\t"
+			: "=r" (lo), "=r" (hi)
+	);
+	return ((uint64_t)hi << 32) | lo;
+}
+
+void hyp_stop_begin()
+{
+	if (hyp_boot && hyp_hide_stops)
+	{
+		hyp_stop_start = hyp_cntvct();
+	}
+}
+
+// the virtual counter continues from where the debuggee stopped
+void hyp_stop_end()
+{
+	uint64_t delta;
+
+	if (!hyp_boot || !hyp_hide_stops || !hyp_stop_start)
+	{
+		return;
+	}
+	delta = hyp_cntvct() - hyp_stop_start;
+	hyp_stop_start = 0;
+	hyp_hidden += delta;
+	asm volatile (
+			"mov r0, %0\n\t"
+			"mov r1, %1\n\t"
+			"hvc #3 @ HYP_HVC_CNTVOFF\n\t"
+			:: "r" ((uint32_t)delta), "r" ((uint32_t)(delta >> 32))
+			: "r0", "r1", "memory"
+	);
+}
+
+int hyp_mon_cmd(char *args)
+{
+	char scratchpad[16];
+	uint64_t ticks;
+	uint32_t frq, secs = 0;
+
+	while (*args == ' ') args++;
+	if (!hyp_boot)
+	{
+		gdb_mon_print("hide-stops: not booted in HYP mode\n");
+		return (*args == '\0') ? 0 : -1;
+	}
+	if (util_str_cmp(args, "on") == 0)
+	{
+		hyp_hide_stops = 1;
+	}
+	else if (util_str_cmp(args, "off") == 0)
+	{
+		hyp_hide_stops = 0;
+		hyp_stop_start = 0;
+	}
+	else if (*args != '\0')
+	{
+		return -1;
+	}
+	gdb_mon_print(hyp_hide_stops ? "hide-stops: on, " : "hide-stops: off, ");
+	asm volatile ("mrc p15, 0, %0, c14, c0, 0 @ CNTFRQ\n\t" : "=r" (frq));
+	if (frq < 1000)
+	{
+		frq = 19200000; // the firmware's value
+	}
+	// no 64-bit division
+	ticks = hyp_hidden;
+	while (ticks >= frq)
+	{
+		ticks -= frq;
+		secs++;
+	}
+	util_word_to_dec(scratchpad, secs * 1000 + (uint32_t)ticks / (frq / 1000));
+	gdb_mon_print(scratchpad);
+	gdb_mon_print(" ms hidden\n");
+	return 0;
+}
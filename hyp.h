@@ -0,0 +1,67 @@
+/*
+hyp.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HYP_H_
+#define HYP_H_
+
+// hvc immediates
+#define HYP_HVC_ENABLE 0	// take the debug hypervisor into use
+#define HYP_HVC_RESUME 1	// the stub returns to the debuggee
+#define HYP_HVC_ENTER 2		// the stub was entered
+#define HYP_HVC_CNTVOFF 3	// add r1:r0 to CNTVOFF
+
+// HYP mode coprocessor register bits
+#define HYP_HDCR_TDE (1 << 8)
+#define HYP_HCR_FMO (1 << 3)
+#define HYP_HSCTLR_M (1 << 0)
+#define HYP_HSCTLR_C (1 << 2)
+#define HYP_HSCTLR_I (1 << 12)
+
+// For naked exception returns to the debuggee: gives the debuggee its
+// own vectors back in HYP mode. Needs no registers, but changes flags
+// (the exception return restores them).
+#define HYP_RESUME_DEBUGGEE \
+			"push {r0}\n\t" \
+			"ldr r0, =hyp_active\n\t" \
+			"ldr r0, [r0]\n\t" \
+			"cmp r0, #0\n\t" \
+			"pop {r0}\n\t" \
+			"beq 99f\n\t" \
+			"hvc #1 @ HYP_HVC_RESUME\n\t" \
+			"99:\n\t"
+
+extern unsigned int hyp_boot;	// booted in HYP mode (set in start.S)
+extern unsigned int hyp_active;	// debuggee runs under the debug hypervisor
+extern unsigned int hyp_hide_stops;	// stop time hidden from the virtual counter
+
+// HYP vector table (set as HVBAR in start.S)
+void hyp_vectors();
+
+// takes the debug hypervisor into use if booted in HYP and asked for
+void hyp_init();
+
+// the debuggee stopped / resumes - the stop time is added to CNTVOFF
+void hyp_stop_begin();
+void hyp_stop_end();
+
+// monitor hide-stops [on|off]
+int hyp_mon_cmd(char *args);
+
+#endif /* HYP_H_ */
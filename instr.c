@@ -110,3 +110,42 @@ instr_next_addr_t  next_address(unsigned int address)
 	return retval;
 }
 
+// 1 if execution certainly continues at the next ARM instruction after
+// 'instr', whatever the registers and flags are by the time it runs.
+// Anything that may write the PC, generate an exception or change the
+// state gives 0 - used for running straight-line code natively.
+// The cheap encoding checks go first, so that the decoder doesn't
+// evaluate PC-loads with register values from somewhere else.
+int is_linear_arm(unsigned int instr)
+{
+	instr_next_addr_t retval;
+
+	if ((instr & INSTR_COND_MASK) == INSTR_COND_NV)
+	{
+		return 0; // unconditional space: BLX, RFE, SRS, CPS, ...
+	}
+	if (bitrng(instr, 27, 25) == 5)
+	{
+		return 0; // B, BL
+	}
+	if (bitrng(instr, 27, 24) == 0xf)
+	{
+		return 0; // SVC
+	}
+	if ((instr & 0x0d900000) == 0x01000000)
+	{
+		return 0; // miscellaneous: BX, BKPT, HVC, SMC, MSR, ...
+	}
+	if ((bitrng(instr, 27, 26) <= 1) && (bitrng(instr, 15, 12) == 15))
+	{
+		return 0; // data processing, load or store with Rd/Rt = PC
+	}
+	if ((bitrng(instr, 27, 25) == 4) && bit(instr, 20) && bit(instr, 15))
+	{
+		return 0; // LDM with PC
+	}
+	// the condition doesn't matter - assume it passes
+	retval = ARM_decoder_dispatch((instr & ~INSTR_COND_MASK) | INSTR_COND_AL);
+	return ((retval.flag == INSTR_ADDR_ARM) && (retval.address == 0xffffffff));
+}
+
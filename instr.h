@@ -28,4 +28,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // finds out the next address after executing the instruction at 'address'
 instr_next_addr_t next_address(unsigned int address);
 
+// 1 if the ARM instruction can't change the control flow
+int is_linear_arm(unsigned int instr);
+
 #endif /* INSTR_H_ */
@@ -20,6 +20,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdint.h>
 #include "rpi2.h"
+#include "hyp.h"
+#include "boottime.h"
 #include "serial.h"
 #include "gdb.h"
 #include "io_dev.h"
@@ -66,6 +68,7 @@ void loader_main()
 
 	/* initialize rpi2 */
 	rpi2_init();
+	boottime_mark("rpi2_init");
 	
 #if 0	
 		rpi2_led_blink(100, 100, 3);
@@ -77,6 +80,7 @@ void loader_main()
 	/* initialize serial for debugger */
 	serial_init(&serial_io);
 	log_init(&serial_io);
+	boottime_mark("serial");
 #if 0
 		rpi2_led_blink(100, 100, 3);
 		rpi2_delay_loop(1000);
@@ -119,6 +123,18 @@ void loader_main()
 		serial_io.put_string(msg, util_str_len(msg));
 		util_word_to_hex(scratchpad, rpi2_keep_ctrlc);
 		serial_io.put_string(scratchpad, 9);
+		msg = " rpi2_step_masked ";
+		serial_io.put_string(msg, util_str_len(msg));
+		util_word_to_hex(scratchpad, rpi2_step_masked);
+		serial_io.put_string(scratchpad, 9);
+		msg = " rpi2_use_hyp ";
+		serial_io.put_string(msg, util_str_len(msg));
+		util_word_to_hex(scratchpad, rpi2_use_hyp);
+		serial_io.put_string(scratchpad, 9);
+		msg = " hyp_active ";
+		serial_io.put_string(msg, util_str_len(msg));
+		util_word_to_hex(scratchpad, hyp_active);
+		serial_io.put_string(scratchpad, 9);
 		msg = "\r\nrpi2_uart0_baud ";
 		serial_io.put_string(msg, util_str_len(msg));
 		util_word_to_hex(scratchpad, rpi2_uart0_baud);
@@ -271,6 +287,7 @@ void loader_main()
 		}
 	}
 #else
+	boottime_mark("gdb-ready");
 
 	while (1)
 	{
@@ -314,11 +331,15 @@ void main(uint32_t r0, uint32_t r1, uint32_t r2)
 	rpi2_uart0_baud = 115200;
 	rpi2_use_hw_debug = 1;
 	rpi2_print_dbg_info = 0;
+	rpi2_step_masked = 0; // interrupts can be taken while stepping
+	rpi2_use_hyp = 0; // drop from HYP to SVC
 	rpi2_neon_used = 0;
 	rpi2_neon_enable = 0;
 	
-	rpi2_get_cmdline(cmdline);
-	
+	// ram size and uart clock come in the same mailbox call
+	rpi2_get_boot_info(cmdline);
+	boottime_mark("mailbox");
+
 	for (i=0; i< 1024; i++)
 	{
 		if (cmdline[i] == '\0') break;
@@ -363,6 +384,18 @@ void main(uint32_t r0, uint32_t r1, uint32_t r2)
 					i += util_str_len("keep_ctrlc");
 					rpi2_keep_ctrlc = 1;
 				}
+				else if (util_cmp_substr("step_masked", cmdline + i) >= util_str_len("step_masked"))
+				{
+					// rpi_stub_step_masked
+					i += util_str_len("step_masked");
+					rpi2_step_masked = 1;
+				}
+				else if (util_cmp_substr("hyp", cmdline + i) >= util_str_len("hyp"))
+				{
+					// rpi_stub_hyp
+					i += util_str_len("hyp");
+					rpi2_use_hyp = 1;
+				}
 				else if (util_cmp_substr("baud=", cmdline + i) >= util_str_len("baud="))
 				{
 					// rpi_stub_baud=115200
@@ -407,5 +440,11 @@ void main(uint32_t r0, uint32_t r1, uint32_t r2)
 			}
 		}
 	}
+	if (rpi2_use_hyp)
+	{
+		// ctrl-C comes through HYP - only FIQ can be routed there alone
+		rpi2_uart0_excmode = RPI2_UART0_FIQ;
+	}
+	boottime_mark("cmdline");
 	loader_main();
 }
\ No newline at end of file
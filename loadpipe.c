@@ -0,0 +1,367 @@
+/*
+loadpipe.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// Load pipeline: the other cores write the windowed load packets.
+// Core 0 owns the UART and only reads the raw packets into the slots (see
+// gdb_pipe_receive() in gdb.c). The workers on cores 1 - 3 check the
+// checksum, unescape the data into the debuggee memory and do the cache
+// maintenance for it. Core 0 sends the acks and window replies as the slots
+// complete, in order. So the receiving is never waiting for the writes.
+// The workers are started from the firmware's spin loop (mailbox 3) at
+// the first 'monitor loadpipe on'. They keep the firmware's protocol, so
+// a debuggee can still start the cores by writing its entry point to
+// their mailbox 3 - they get there in SVC mode with the MMU off.
+// The slots are shared between the cores, so they need real barriers
+// (dmb) - the same-core LOAD_ACQUIRE/STORE_RELEASE aren't enough.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "gdb.h"
+#include "loadpipe.h"
+
+#define LOADPIPE_STACK_SIZE 2048 // per worker, must match the entry code
+#define LOCAL_MAILBOX3_SET(core) (LOCAL_BASE + 0x8c + 0x10 * (core))
+#define LOCAL_MAILBOX3_CLR(core) (LOCAL_BASE + 0xcc + 0x10 * (core))
+#define LOADPIPE_START_TIMEOUT 100000 // us
+
+static loadpipe_slot_t loadpipe_slot[LOADPIPE_SLOTS];
+static uint32_t loadpipe_head = 0; // next slot to fill (core 0)
+static uint32_t loadpipe_tail = 0; // oldest slot not released (core 0)
+static uint32_t loadpipe_next_worker = 0;
+static volatile uint32_t loadpipe_on = 0;
+static volatile uint32_t loadpipe_up[LOADPIPE_WORKERS + 1]; // by core number
+static volatile uint32_t loadpipe_count[LOADPIPE_WORKERS + 1]; // packets done
+static uint32_t loadpipe_ttbr0; // core 0 translation table for the workers
+
+// used from the entry code
+uint8_t loadpipe_stack[LOADPIPE_WORKERS][LOADPIPE_STACK_SIZE] __attribute__ ((aligned (8)));
+void loadpipe_entry() __attribute__ ((naked));
+void loadpipe_worker(uint32_t core);
+
+// entry from the firmware spin loop (HYP or SVC mode, MMU off)
+void loadpipe_entry()
+{
+	asm volatile (
+			"mrs r0, cpsr\n\t"
+			"and r1, r0, #0x1f\n\t"
+			"cmp r1, #0x1a @ HYP-mode?\n\t"
+			"bne 1f\n\t"
+			"movw r0, #0x1d3 @ aif-masks set, SVC-mode\n\t"
+			"adr r1, 1f\n\t"
+			"msr ELR_hyp, r1\n\t"
+			"msr SPSR_hyp, r0\n\t"
+			"eret\n\t"
+			"1:\n\t"
+			"cpsid aif\n\t"
+			"mrc p15, 0, r0, c0, c0, 5 @ MPIDR\n\t"
+			"and r0, r0, #3 @ core number\n\t"
+			"movw r1, #:lower16:loadpipe_stack\n\t"
+			"movt r1, #:upper16:loadpipe_stack\n\t"
+			"add r1, r1, r0, lsl #11 @ stack top of worker (core - 1)\n\t"
+			"mov sp, r1\n\t"
+			"b loadpipe_worker\n\t"
+	);
+}
+
+// the MMU as on core 0, coherent with it (SMP bit)
+static void loadpipe_worker_mmu()
+{
+	uint32_t tmp;
+
+	asm volatile ("mrc p15, 0, %0, c1, c0, 1\n\t" : "=r" (tmp)); // ACTLR
+	tmp |= 1 << 6;
+	asm volatile ("mcr p15, 0, %0, c1, c0, 1\n\t" :: "r" (tmp));
+	// domain 0 manager - the writes ignore the access trace protections
+	asm volatile ("mcr p15, 0, %0, c3, c0, 0\n\t" :: "r" (3)); // DACR
+	asm volatile ("mcr p15, 0, %0, c2, c0, 2\n\t" :: "r" (0)); // TTBCR
+	asm volatile ("mcr p15, 0, %0, c2, c0, 0\n\t" :: "r" (loadpipe_ttbr0));
+	asm volatile ("mcr p15, 0, %0, c8, c7, 0\n\t" :: "r" (0)); // TLBIALL
+	asm volatile ("mcr p15, 0, %0, c7, c5, 0\n\t" :: "r" (0)); // ICIALLU
+	asm volatile ("dsb\n\tisb\n\t" ::: "memory");
+	asm volatile ("mcr p15, 0, %0, c1, c0, 0\n\t" :: "r" (0x1805) : "memory");
+	asm volatile ("dsb\n\tisb\n\t" ::: "memory");
+}
+
+// back to the firmware's state and to the address given in mailbox 3
+static void loadpipe_handoff(uint32_t core, uint32_t addr)
+{
+	*((volatile uint32_t *)LOCAL_MAILBOX3_CLR(core)) = addr;
+	loadpipe_up[core] = 0;
+	if (loadpipe_ttbr0)
+	{
+		rpi2_invalidate_caches(); // cleans to memory
+		asm volatile ("mcr p15, 0, %0, c1, c0, 0\n\t" :: "r" (0) : "memory");
+		asm volatile ("dsb\n\tisb\n\t" ::: "memory");
+	}
+	asm volatile ("bx %0\n\t" :: "r" (addr));
+}
+
+// written code visible to all the cores
+static void loadpipe_sync_range(uint32_t addr, uint32_t bytes)
+{
+	uint32_t line;
+
+	if (!loadpipe_ttbr0)
+	{
+		return; // no caches
+	}
+	for (line = addr & ~31; line < addr + bytes; line += 32)
+	{
+		asm volatile ("mcr p15, 0, %0, c7, c11, 1\n\t" :: "r" (line)); // DCCMVAU
+	}
+	asm volatile ("dsb\n\t" ::: "memory");
+	for (line = addr & ~31; line < addr + bytes; line += 32)
+	{
+		asm volatile ("mcr p15, 0, %0, c7, c5, 1\n\t" :: "r" (line)); // ICIMVAU
+	}
+	asm volatile ("mcr p15, 0, %0, c7, c1, 6\n\t" :: "r" (0)); // BPIALLIS
+	asm volatile ("dsb\n\tisb\n\t" ::: "memory");
+}
+
+// QRpiWinWrite:seq,addr,length:XX...#cc
+static void loadpipe_process(loadpipe_slot_t *slot)
+{
+	char *packet = slot->data;
+	uint32_t seq, addr, bytes;
+	int checksum = 0;
+	int i, offs, hi, lo;
+
+	for (i = 0; i < slot->len; i++)
+	{
+		checksum += (uint8_t)packet[i];
+	}
+	hi = util_hex_to_nib(packet[slot->len + 1]);
+	lo = util_hex_to_nib(packet[slot->len + 2]);
+	if ((hi < 0) || (lo < 0) || (((hi << 4) | lo) != (checksum & 0xff)))
+	{
+		slot->status = LOADPIPE_BADSUM;
+		return;
+	}
+	packet[slot->len] = '\0';
+	i = util_str_len("QRpiWinWrite:");
+	// core 0 has checked the window, the area is checked in the parsing
+	offs = gdb_win_parse(packet + i, slot->len - i, &seq, &addr, &bytes);
+	if (offs < 0)
+	{
+		slot->status = LOADPIPE_ERR;
+		return;
+	}
+	gdb_read_bin_data((uint8_t *)packet + i + offs, (int)bytes, (uint8_t *)addr,
+			LOADPIPE_DATA_LEN);
+	loadpipe_sync_range(addr, bytes);
+	slot->status = LOADPIPE_OK;
+}
+
+void loadpipe_worker(uint32_t core)
+{
+	loadpipe_slot_t *slot;
+	uint32_t addr;
+	int i, found;
+
+	if (loadpipe_ttbr0)
+	{
+		loadpipe_worker_mmu();
+	}
+	__atomic_store_n(&loadpipe_up[core], 1, __ATOMIC_RELEASE);
+	while (1)
+	{
+		found = 0;
+		for (i = 0; i < LOADPIPE_SLOTS; i++)
+		{
+			slot = &loadpipe_slot[i];
+			if ((__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == LOADPIPE_RAW)
+					&& (slot->worker == core))
+			{
+				if (!found && loadpipe_ttbr0)
+				{
+					// core 0 may have changed the tables (stub-nocache, acctrace)
+					asm volatile ("mcr p15, 0, %0, c8, c7, 0\n\t"
+							"dsb\n\tisb\n\t" :: "r" (0) : "memory"); // TLBIALL
+				}
+				found = 1;
+				loadpipe_process(slot);
+				loadpipe_count[core]++;
+				__atomic_store_n(&slot->state, LOADPIPE_DONE, __ATOMIC_RELEASE);
+			}
+		}
+		if (found)
+		{
+			continue;
+		}
+		addr = *((volatile uint32_t *)LOCAL_MAILBOX3_CLR(core));
+		if (addr)
+		{
+			loadpipe_handoff(core, addr);
+		}
+		asm volatile ("wfe\n\t");
+	}
+}
+
+// wakes the cores in the firmware spin loop, returns the number started
+static int loadpipe_start()
+{
+	uint32_t core, t0;
+	int started = 0;
+
+	loadpipe_ttbr0 = 0;
+	if (rpi2_use_mmu)
+	{
+		asm volatile ("mrc p15, 0, %0, c2, c0, 0\n\t" : "=r" (loadpipe_ttbr0));
+	}
+	// the workers read it before their MMU is on
+	asm volatile ("mcr p15, 0, %0, c7, c10, 1\n\t" // DCCMVAC
+			"dsb\n\t" :: "r" (&loadpipe_ttbr0) : "memory");
+	for (core = 1; core <= LOADPIPE_WORKERS; core++)
+	{
+		if (!loadpipe_up[core])
+		{
+			*((volatile uint32_t *)LOCAL_MAILBOX3_SET(core)) = (uint32_t)loadpipe_entry;
+		}
+	}
+	asm volatile ("dsb\n\tsev\n\t" ::: "memory");
+	t0 = *((volatile uint32_t *)SYSTMR_CLO);
+	for (core = 1; core <= LOADPIPE_WORKERS; core++)
+	{
+		while (!__atomic_load_n(&loadpipe_up[core], __ATOMIC_ACQUIRE)
+				&& (*((volatile uint32_t *)SYSTMR_CLO) - t0 < LOADPIPE_START_TIMEOUT));
+		if (loadpipe_up[core])
+		{
+			started++;
+		}
+	}
+	return started;
+}
+
+int loadpipe_active()
+{
+	return (int)loadpipe_on;
+}
+
+loadpipe_slot_t *loadpipe_next_free()
+{
+	loadpipe_slot_t *slot = &loadpipe_slot[loadpipe_head % LOADPIPE_SLOTS];
+
+	if (loadpipe_head - loadpipe_tail >= LOADPIPE_SLOTS)
+	{
+		return 0;
+	}
+	return slot;
+}
+
+int loadpipe_submit(loadpipe_slot_t *slot)
+{
+	int i;
+
+	// round robin over the cores that are up
+	for (i = 0; i < LOADPIPE_WORKERS; i++)
+	{
+		loadpipe_next_worker = loadpipe_next_worker % LOADPIPE_WORKERS + 1;
+		if (loadpipe_up[loadpipe_next_worker])
+		{
+			break;
+		}
+	}
+	if (i == LOADPIPE_WORKERS)
+	{
+		// the debuggee took the cores (mailbox 3)
+		loadpipe_on = 0;
+		return -1;
+	}
+	slot->worker = loadpipe_next_worker;
+	__atomic_store_n(&slot->state, LOADPIPE_RAW, __ATOMIC_RELEASE);
+	loadpipe_head++;
+	asm volatile ("dsb\n\tsev\n\t" ::: "memory");
+	return 0;
+}
+
+loadpipe_slot_t *loadpipe_next_done()
+{
+	loadpipe_slot_t *slot = &loadpipe_slot[loadpipe_tail % LOADPIPE_SLOTS];
+
+	if ((loadpipe_tail == loadpipe_head)
+			|| (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != LOADPIPE_DONE))
+	{
+		return 0;
+	}
+	return slot;
+}
+
+void loadpipe_release(loadpipe_slot_t *slot)
+{
+	__atomic_store_n(&slot->state, LOADPIPE_FREE, __ATOMIC_RELAXED);
+	loadpipe_tail++;
+}
+
+int loadpipe_pending()
+{
+	return (int)(loadpipe_head - loadpipe_tail);
+}
+
+// monitor loadpipe [on|off]
+int loadpipe_mon_cmd(char *args)
+{
+	char scratchpad[16];
+	uint32_t core;
+	int started;
+
+	while (*args == ' ') args++;
+	if (util_str_cmp(args, "on") == 0)
+	{
+		started = loadpipe_start();
+		for (core = 1; core <= LOADPIPE_WORKERS; core++)
+		{
+			if (!loadpipe_up[core])
+			{
+				gdb_mon_print("loadpipe: core ");
+				util_word_to_dec(scratchpad, core);
+				gdb_mon_print(scratchpad);
+				gdb_mon_print(" didn't start\n");
+			}
+		}
+		if (started == 0)
+		{
+			return -1;
+		}
+		loadpipe_on = 1;
+	}
+	else if (util_str_cmp(args, "off") == 0)
+	{
+		// the pipeline is empty between the commands
+		loadpipe_on = 0;
+	}
+	else if (*args != '\0')
+	{
+		return -1;
+	}
+	gdb_mon_print(loadpipe_on ? "loadpipe: on\n" : "loadpipe: off\n");
+	for (core = 1; core <= LOADPIPE_WORKERS; core++)
+	{
+		gdb_mon_print("core ");
+		util_word_to_dec(scratchpad, core);
+		gdb_mon_print(scratchpad);
+		gdb_mon_print(loadpipe_up[core] ? ": up, packets " : ": down, packets ");
+		util_word_to_dec(scratchpad, loadpipe_count[core]);
+		gdb_mon_print(scratchpad);
+		gdb_mon_print("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,73 @@
+/*
+loadpipe.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOADPIPE_H_
+#define LOADPIPE_H_
+
+#include <stdint.h>
+
+// Load pipeline on cores 1 - 3 for the windowed writes (QRpiWinWrite)
+
+#define LOADPIPE_WORKERS 3
+#define LOADPIPE_SLOTS 8 // packets in the pipeline
+#define LOADPIPE_DATA_LEN 1040 // a gdb packet (1024) + '#' and checksum
+
+// slot states
+#define LOADPIPE_FREE 0
+#define LOADPIPE_RAW 1 // received, for the worker
+#define LOADPIPE_DONE 2 // processed, for the ack and reply
+
+// slot results
+#define LOADPIPE_OK 0
+#define LOADPIPE_BADSUM 1 // checksum error
+#define LOADPIPE_ERR 2 // malformed packet
+
+typedef struct {
+	uint32_t state; // shared between the cores - atomic accesses
+	uint32_t worker; // core that handles the slot
+	int len; // payload length
+	char data[LOADPIPE_DATA_LEN]; // payload, '#', checksum digits, nul
+	uint32_t seq; // sequence number, from core 0
+	int status; // result: LOADPIPE_OK, ...
+} loadpipe_slot_t;
+
+// 1 if the packets go through the pipeline
+int loadpipe_active();
+
+// The slot to receive the next packet into, 0 if none free
+loadpipe_slot_t *loadpipe_next_free();
+
+// Gives the received packet in the slot to a worker. Returns -1 and
+// turns the pipeline off if no worker is up.
+int loadpipe_submit(loadpipe_slot_t *slot);
+
+// The oldest submitted slot if processed, 0 if none
+loadpipe_slot_t *loadpipe_next_done();
+
+// Frees the slot got with loadpipe_next_done()
+void loadpipe_release(loadpipe_slot_t *slot);
+
+// number of slots submitted and not released
+int loadpipe_pending();
+
+// monitor loadpipe [on|off]
+int loadpipe_mon_cmd(char *args);
+
+#endif /* LOADPIPE_H_ */
@@ -0,0 +1,129 @@
+/*
+memdump.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compressed memory reads (qXfer:rpi-mem:read:addr,len:offset,length).
+// The stream is a sequence of block records: u32 info, data.
+// Each MEMDUMP_BLOCK bytes of memory (the last block may be shorter)
+// are LZ4-compressed, or stored raw if they don't compress (MEMDUMP_RAW
+// in info). The block is compressed only when the host has read the
+// previous one, so nothing needs to be buffered beyond one block.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "gdb.h"
+#include "compress.h"
+#include "memdump.h"
+
+#define MEMDUMP_REC_SIZE 4 // info
+
+static int md_active;
+static uint32_t md_start;
+static uint32_t md_end;
+static uint32_t md_addr; // next block to compress
+
+// the current chunk of the stream
+static uint8_t md_win[MEMDUMP_REC_SIZE + MEMDUMP_BLOCK];
+static uint32_t md_win_offs; // stream offset of md_win
+static uint32_t md_win_len;
+
+static uint32_t md_block[MEMDUMP_BLOCK / 4]; // the block being compressed
+
+static void md_put32(uint8_t *p, uint32_t val)
+{
+	p[0] = (uint8_t)(val & 0xff);
+	p[1] = (uint8_t)((val >> 8) & 0xff);
+	p[2] = (uint8_t)((val >> 16) & 0xff);
+	p[3] = (uint8_t)((val >> 24) & 0xff);
+}
+
+// fills md_win with the next block
+// returns 0 if the stream is complete
+static int md_next_chunk()
+{
+	uint32_t i, size;
+	int len;
+
+	md_win_offs += md_win_len;
+	md_win_len = 0;
+	if (md_addr >= md_end)
+	{
+		return 0;
+	}
+	size = md_end - md_addr;
+	if (size > MEMDUMP_BLOCK)
+	{
+		size = MEMDUMP_BLOCK;
+	}
+	// as gdb would see it - without breakpoints
+	gdb_copy_mem(md_addr, (uint8_t *)md_block, size);
+	md_addr += size;
+	len = lz_compress((uint8_t *)md_block, (int)size,
+			md_win + MEMDUMP_REC_SIZE, (int)size - 1);
+	if (len < 0)
+	{
+		for (i=0; i<size; i++)
+		{
+			md_win[MEMDUMP_REC_SIZE + i] = ((uint8_t *)md_block)[i];
+		}
+		len = (int)size;
+		md_put32(md_win, MEMDUMP_RAW | (uint32_t)len);
+	}
+	else
+	{
+		md_put32(md_win, (uint32_t)len);
+	}
+	md_win_len = MEMDUMP_REC_SIZE + (uint32_t)len;
+	return 1;
+}
+
+int memdump_read(unsigned int addr, unsigned int len, unsigned int offset,
+		unsigned char **data)
+{
+	if ((offset == 0) || !md_active || (addr != md_start)
+			|| (addr + len != md_end))
+	{
+		// no peripherals - reads could have side effects
+		if ((offset != 0) || (len == 0) || (addr + len < addr)
+				|| (addr + len > PERIPH_BASE))
+		{
+			md_active = 0;
+			return -1;
+		}
+		md_start = addr;
+		md_end = addr + len;
+		md_addr = addr;
+		md_win_offs = 0;
+		md_win_len = 0;
+		md_active = 1;
+	}
+	if (offset == md_win_offs + md_win_len)
+	{
+		if (!md_next_chunk())
+		{
+			return 0;
+		}
+	}
+	if ((offset < md_win_offs) || (offset >= md_win_offs + md_win_len))
+	{
+		return -1; // can't go back to earlier chunks
+	}
+	*data = md_win + (offset - md_win_offs);
+	return (int)(md_win_len - (offset - md_win_offs));
+}
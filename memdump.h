@@ -0,0 +1,38 @@
+/*
+memdump.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMDUMP_H_
+#define MEMDUMP_H_
+
+#define MEMDUMP_BLOCK 4096
+
+// block record info-word
+#define MEMDUMP_RAW (1 << 31) // block is stored uncompressed
+#define MEMDUMP_LEN_MASK 0xffff
+
+// Gives the compressed stream of memory area addr, len from offset
+// onwards. Offset 0 or a new area starts a new stream. The stream is
+// generated on the fly, so offsets must advance sequentially
+// (re-reading the latest chunk is OK).
+// returns number of bytes available at *data, 0 at the end, -1 on error
+int memdump_read(unsigned int addr, unsigned int len, unsigned int offset,
+		unsigned char **data);
+
+#endif /* MEMDUMP_H_ */
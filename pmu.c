@@ -0,0 +1,257 @@
+/*
+pmu.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Performance monitor unit use.
+// Execution budget: the counter is preset to -budget, so that it overflows
+// when the budget is used up. The overflow interrupt is routed to core 0
+// through the same exception (IRQ/FIQ) as the UART0 interrupt, and the
+// stub serial interrupt handler stops the debuggee.
+// The interrupt is asynchronous, so the stop comes a few instructions
+// (the interrupt latency) after the overflow. The exact amount counted
+// is reported with pmu_budget_used(). Also the stub's own exit and entry
+// paths get counted.
+// Instructions are counted with event counter 0 and cycles with PMCCNTR.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "pmu.h"
+
+#define PMU_CCNT_BIT (1 << 31) // cycle counter in enable/overflow registers
+#define PMU_CNT0_BIT (1 << 0) // event counter 0
+
+#define PMCR_E (1 << 0)
+
+static int pmu_kind = PMU_BUDGET_OFF;
+static uint32_t pmu_budget; // the whole budget
+static uint32_t pmu_left; // not yet used (while paused)
+static volatile uint32_t pmu_running; // counter enabled
+static volatile uint32_t pmu_expired;
+
+static inline uint32_t pmu_counter_bit()
+{
+	return (pmu_kind == PMU_BUDGET_CYCLES) ? PMU_CCNT_BIT : PMU_CNT0_BIT;
+}
+
+static inline uint32_t pmu_read_counter()
+{
+	uint32_t val;
+
+	if (pmu_kind == PMU_BUDGET_CYCLES)
+	{
+		asm volatile ("mrc p15, 0, %0, c9, c13, 0\n\t" : "=r" (val)); // PMCCNTR
+	}
+	else
+	{
+		asm volatile ("mcr p15, 0, %0, c9, c12, 5\n\t" :: "r" (0)); // PMSELR
+		asm volatile ("isb\n\t");
+		asm volatile ("mrc p15, 0, %0, c9, c13, 2\n\t" : "=r" (val)); // PMXEVCNTR
+	}
+	return val;
+}
+
+static inline void pmu_write_counter(uint32_t val)
+{
+	if (pmu_kind == PMU_BUDGET_CYCLES)
+	{
+		asm volatile ("mcr p15, 0, %0, c9, c13, 0\n\t" :: "r" (val)); // PMCCNTR
+	}
+	else
+	{
+		asm volatile ("mcr p15, 0, %0, c9, c12, 5\n\t" :: "r" (0)); // PMSELR
+		asm volatile ("isb\n\t");
+		asm volatile ("mcr p15, 0, %0, c9, c13, 2\n\t" :: "r" (val)); // PMXEVCNTR
+	}
+}
+
+// stop the counter and its interrupt
+static void pmu_stop()
+{
+	uint32_t bit = pmu_counter_bit();
+
+	asm volatile ("mcr p15, 0, %0, c9, c12, 2\n\t" :: "r" (bit)); // PMCNTENCLR
+	asm volatile ("mcr p15, 0, %0, c9, c14, 2\n\t" :: "r" (bit)); // PMINTENCLR
+	SYNC;
+	pmu_running = 0;
+}
+
+void pmu_budget_set(int kind, unsigned int count)
+{
+	if (pmu_running)
+	{
+		pmu_stop();
+	}
+	if (pmu_kind != PMU_BUDGET_OFF)
+	{
+		*((volatile uint32_t *)LOCAL_PMU_ROUTE_CLR) =
+				LOCAL_PMU_ROUTE_IRQ0 | LOCAL_PMU_ROUTE_FIQ0;
+	}
+	pmu_kind = kind;
+	pmu_budget = (uint32_t)count;
+	pmu_left = (uint32_t)count;
+	pmu_expired = 0;
+}
+
+void pmu_budget_resume()
+{
+	uint32_t bit;
+	uint32_t tmp;
+
+	if ((pmu_kind == PMU_BUDGET_OFF) || pmu_expired || (pmu_left == 0))
+	{
+		return;
+	}
+	bit = pmu_counter_bit();
+	if (pmu_kind == PMU_BUDGET_INSNS)
+	{
+		asm volatile ("mcr p15, 0, %0, c9, c12, 5\n\t" :: "r" (0)); // PMSELR
+		asm volatile ("isb\n\t");
+		asm volatile ("mcr p15, 0, %0, c9, c13, 1\n\t" :: "r" (PMU_EVT_INST_RETIRED)); // PMXEVTYPER
+	}
+	pmu_write_counter(0 - pmu_left); // overflows when the budget is used
+	asm volatile ("mcr p15, 0, %0, c9, c12, 3\n\t" :: "r" (bit)); // PMOVSR (clear)
+	// the interrupt goes where the stub gets its serial interrupts
+	*((volatile uint32_t *)LOCAL_PMU_ROUTE_SET) =
+			(rpi2_uart0_excmode == RPI2_UART0_FIQ)
+			? LOCAL_PMU_ROUTE_FIQ0 : LOCAL_PMU_ROUTE_IRQ0;
+	asm volatile ("mcr p15, 0, %0, c9, c14, 1\n\t" :: "r" (bit)); // PMINTENSET
+	asm volatile ("mrc p15, 0, %0, c9, c12, 0\n\t" : "=r" (tmp)); // PMCR
+	asm volatile ("mcr p15, 0, %0, c9, c12, 0\n\t" :: "r" (tmp | PMCR_E));
+	pmu_running = 1;
+	asm volatile ("mcr p15, 0, %0, c9, c12, 1\n\t" :: "r" (bit)); // PMCNTENSET
+	SYNC;
+}
+
+void pmu_budget_pause()
+{
+	uint32_t val;
+
+	if (!pmu_running)
+	{
+		return;
+	}
+	pmu_stop();
+	val = pmu_read_counter();
+	if (pmu_expired)
+	{
+		// counted past the overflow
+		pmu_left = 0;
+		pmu_budget += val;
+	}
+	else
+	{
+		pmu_left = 0 - val;
+	}
+}
+
+int pmu_budget_check()
+{
+	uint32_t ovf;
+	uint32_t src;
+
+	if (!pmu_running)
+	{
+		return 0;
+	}
+	src = (rpi2_uart0_excmode == RPI2_UART0_FIQ)
+			? *((volatile uint32_t *)LOCAL_CORE0_FIQ_SRC)
+			: *((volatile uint32_t *)LOCAL_CORE0_IRQ_SRC);
+	if (!(src & LOCAL_SRC_PMU))
+	{
+		return 0;
+	}
+	asm volatile ("mrc p15, 0, %0, c9, c12, 3\n\t" : "=r" (ovf)); // PMOVSR
+	if (!(ovf & pmu_counter_bit()))
+	{
+		return 0;
+	}
+	asm volatile ("mcr p15, 0, %0, c9, c12, 3\n\t" :: "r" (ovf & pmu_counter_bit()));
+	pmu_expired = 1;
+	pmu_budget_pause();
+	return 1;
+}
+
+int pmu_budget_kind()
+{
+	return pmu_kind;
+}
+
+unsigned int pmu_budget_used()
+{
+	return pmu_budget - pmu_left;
+}
+
+unsigned int pmu_budget_left()
+{
+	return pmu_left;
+}
+
+int pmu_cycles_enable()
+{
+	uint32_t tmp;
+
+	if (pmu_kind == PMU_BUDGET_CYCLES)
+	{
+		return -1;
+	}
+	asm volatile ("mrc p15, 0, %0, c9, c12, 0\n\t" : "=r" (tmp)); // PMCR
+	asm volatile ("mcr p15, 0, %0, c9, c12, 0\n\t" :: "r" (tmp | PMCR_E));
+	asm volatile ("mcr p15, 0, %0, c9, c12, 1\n\t" :: "r" (PMU_CCNT_BIT)); // PMCNTENSET
+	SYNC;
+	return 0;
+}
+
+void pmu_events_start(const unsigned int *events, int count)
+{
+	uint32_t tmp;
+	uint32_t bits = 0;
+	int i;
+
+	for (i=0; i<count; i++)
+	{
+		asm volatile ("mcr p15, 0, %0, c9, c12, 5\n\t" :: "r" (i + 1)); // PMSELR
+		asm volatile ("isb\n\t");
+		asm volatile ("mcr p15, 0, %0, c9, c13, 1\n\t" :: "r" (events[i])); // PMXEVTYPER
+		asm volatile ("mcr p15, 0, %0, c9, c13, 2\n\t" :: "r" (0)); // PMXEVCNTR
+		bits |= 1 << (i + 1);
+	}
+	asm volatile ("mrc p15, 0, %0, c9, c12, 0\n\t" : "=r" (tmp)); // PMCR
+	asm volatile ("mcr p15, 0, %0, c9, c12, 0\n\t" :: "r" (tmp | PMCR_E));
+	asm volatile ("mcr p15, 0, %0, c9, c12, 1\n\t" :: "r" (bits)); // PMCNTENSET
+	SYNC;
+}
+
+void pmu_events_stop(unsigned int *counts, int count)
+{
+	uint32_t bits = 0;
+	int i;
+
+	for (i=0; i<count; i++)
+	{
+		bits |= 1 << (i + 1);
+	}
+	asm volatile ("mcr p15, 0, %0, c9, c12, 2\n\t" :: "r" (bits)); // PMCNTENCLR
+	SYNC;
+	for (i=0; i<count; i++)
+	{
+		asm volatile ("mcr p15, 0, %0, c9, c12, 5\n\t" :: "r" (i + 1)); // PMSELR
+		asm volatile ("isb\n\t");
+		asm volatile ("mrc p15, 0, %0, c9, c13, 2\n\t" : "=r" (counts[i])); // PMXEVCNTR
+	}
+}
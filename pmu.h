@@ -0,0 +1,67 @@
+/*
+pmu.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PMU_H_
+#define PMU_H_
+
+// execution budget kinds
+#define PMU_BUDGET_OFF 0
+#define PMU_BUDGET_INSNS 1
+#define PMU_BUDGET_CYCLES 2
+
+// PMU event numbers (ARMv7 common events)
+#define PMU_EVT_L1I_CACHE_REFILL 0x01
+#define PMU_EVT_L1D_CACHE_REFILL 0x03
+#define PMU_EVT_INST_RETIRED 0x08
+#define PMU_EVT_L2D_CACHE_REFILL 0x17
+
+// event counters for measurements in the stub (1 - 3, 0 is the budget's)
+#define PMU_NUM_EVENTS 3
+
+// Sets the execution budget (kind = PMU_BUDGET_*) for the next 'continue'.
+// The budget is kept over other stops until it runs out.
+void pmu_budget_set(int kind, unsigned int count);
+
+// Starts counting the budget - called just before returning to the debuggee
+void pmu_budget_resume();
+
+// Stops counting - called when the debuggee stops for any reason
+void pmu_budget_pause();
+
+// Called from the stub interrupt handler.
+// returns 1 if the budget ran out (the debuggee should stop)
+int pmu_budget_check();
+
+// budget kind, and the amount counted / left
+int pmu_budget_kind();
+unsigned int pmu_budget_used();
+unsigned int pmu_budget_left();
+
+// Starts the cycle counter free-running for measuring the stub itself.
+// returns -1 if a cycle budget has the counter
+int pmu_cycles_enable();
+
+// Zeroes and starts event counters 1 - count with the given events
+void pmu_events_start(const unsigned int *events, int count);
+
+// Reads event counters 1 - count, and stops them
+void pmu_events_stop(unsigned int *counts, int count);
+
+#endif /* PMU_H_ */
@@ -22,12 +22,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "util.h"
 #include "rpi2.h"
 #include "log.h"
+#include "pmu.h"
+#include "hyp.h"
+#include "boottime.h"
 
 extern void serial_irq(); // this shouldn't be public, so it's not in serial.h
 extern int serial_raw_puts(char *str); // used for debugging
 // extern void serial_enable_ctrlc(); // used for debugging
 extern volatile uint32_t gdb_dyn_debug;
 extern char __hivec;
+extern char __code_begin;
 // for logging via 'O'-packets
 extern void gdb_send_text_packet(char *msg, unsigned int msglen);
 
@@ -60,6 +64,7 @@ unsigned int rpi2_uart_clock;
 unsigned int rpi2_neon_used;
 unsigned int rpi2_neon_enable;
 unsigned int rpi2_debug_leds;
+unsigned int rpi2_boot_info; // ram and clock already from rpi2_get_boot_info()
 
 // query variable
 unsigned int rpi2_query_vars[3];
@@ -71,13 +76,16 @@ unsigned int rpi2_uart0_baud;
 unsigned int rpi2_use_mmu;
 unsigned int rpi2_use_hw_debug;
 unsigned int rpi2_print_dbg_info;
+unsigned int rpi2_step_masked;
+unsigned int rpi2_use_hyp;
 
 volatile rpi2_reg_context_t rpi2_reg_context;
 volatile __attribute__ ((aligned (8))) rpi2_neon_ctx_t rpi2_neon_context;
 
 
 // for mailbox
-#define MBOX_BUFF_SIZE (1024 + 16)
+// room for the command line and the other boot-time tags (see rpi2_get_boot_info)
+#define MBOX_BUFF_SIZE (1024 + 64)
 volatile __attribute__ ((aligned (16))) uint8_t rpi2_mbox_buff[MBOX_BUFF_SIZE];
 
 // MMU-stuff
@@ -107,6 +115,7 @@ typedef struct
 #define MMU_SECT_ATTR_NORMAL 0x00090c0a
 #define MMU_SECT_ATTR_DEV 0x00090c06
 #define MMU_SECT_ATTR_ORD 0x00090c02
+#define MMU_SECT_ATTR_NC 0x00091c02 // normal, non-cacheable (TEX = 001)
 
 // One segment of strictly ordered RAM to support
 // RPi 3 property mailbox use - and maybe something else
@@ -144,15 +153,15 @@ volatile uint32_t rpi2_sigint_flag; // flag: this is SIGINT-case
 volatile uint32_t rpi2_exc_reason;
 uint32_t rpi2_upper_vec_address;
 volatile uint32_t rpi2_pabt_reroute;
+volatile uint32_t rpi2_semihost_svc; // flag to svc handler: semihosting call
 
 // exception handling stuff
-// at the moment, SVC-stuff are used for all sychronous exceptions:
-// reset, und, svc, aux
-volatile rpi2_reg_context_t rpi2_irq_context;
-volatile rpi2_reg_context_t rpi2_fiq_context;
-volatile rpi2_reg_context_t rpi2_dabt_context;
-volatile rpi2_reg_context_t rpi2_pabt_context;
-volatile rpi2_reg_context_t rpi2_svc_context;
+// all exception handlers that enter gdb save the debuggee context
+// straight into rpi2_reg_context - the one frame gdb uses and the
+// exception return restores from - so nothing is copied in between
+
+// entry/exit cycle stamps (PMCCNTR) of the latest stop - see rpi2_exc_bench
+volatile unsigned int rpi2_exc_cycles[4];
 
 // for debugging
 #define DBG_TMP_SZ 16
@@ -178,6 +187,7 @@ void rpi2_unhandled_dabt() __attribute__ ((naked));
 void rpi2_irq_handler() __attribute__ ((naked));
 void rpi2_fiq_handler() __attribute__ ((naked));
 void rpi2_pabt_handler() __attribute__ ((naked));
+void rpi2_dabt_handler();
 
 // exception re-routing
 void rpi2_unhandled_irq() __attribute__ ((naked));
@@ -190,6 +200,14 @@ void rpi2_reroute_exc_dabt() __attribute__ ((naked));
 void rpi2_reroute_exc_aux() __attribute__ ((naked));
 void rpi2_reroute_exc_irq() __attribute__ ((naked));
 void rpi2_reroute_exc_fiq() __attribute__ ((naked));
+void rpi2_trace_exc_und() __attribute__ ((naked));
+void rpi2_trace_exc_svc() __attribute__ ((naked));
+void rpi2_trace_exc_pabt() __attribute__ ((naked));
+void rpi2_trace_exc_dabt() __attribute__ ((naked));
+void rpi2_trace_exc_irq() __attribute__ ((naked));
+void rpi2_trace_exc_fiq() __attribute__ ((naked));
+void rpi2_fiq_sigint() __attribute__ ((naked));
+void rpi2_detached_fiq() __attribute__ ((naked));
 
 // processor context store/restore
 void write_context() __attribute__ ((naked));
@@ -536,6 +554,10 @@ void write_context()
 			"@push {r12, lr}\n\t"
 			"@ldr r12, =rpi2_reg_context\n\t"
 			"stmia r12, {r0 - r11}\n\t"
+			"mrc p15, 0, r1, c9, c13, 0 @ PMCCNTR - entry stamp\n\t"
+			"movw r2, #:lower16:rpi2_exc_cycles\n\t"
+			"movt r2, #:upper16:rpi2_exc_cycles\n\t"
+			"str r1, [r2]\n\t"
 			"mov r0, r12\n\t"
 			"pop {r1, r2}\n\t"
 			"str r1, [r0, #4*12] @ original R12\n\t"
@@ -843,7 +865,7 @@ void rpi2_timer_handler2(uint32_t stack_frame_addr, uint32_t exc_addr)
 	util_word_to_hex(scratchpad, exc_cpsr);
 	serial_raw_puts(scratchpad);
 	serial_raw_puts("\r\n");
-	rpi2_dump_context(&rpi2_svc_context);
+	rpi2_dump_context(&rpi2_reg_context);
 
 	while (1); // hang
 }
@@ -976,7 +998,9 @@ void rpi2_trap_handler()
 
 	if (rpi2_dgb_enabled)
 	{
+		asm volatile ("mrc p15, 0, %0, c9, c13, 0\n\t" : "=r" (rpi2_exc_cycles[1]));
 		gdb_trap_handler();
+		asm volatile ("mrc p15, 0, %0, c9, c13, 0\n\t" : "=r" (rpi2_exc_cycles[2]));
 	}
 }
 
@@ -1004,13 +1028,52 @@ void rpi2_reroute_exc_und()
 	);
 }
 
+// semihosting SVCs are taken by the stub even if the debuggee has
+// its own SVC handler
 void rpi2_reroute_exc_svc()
 {
 #ifdef DEBUG_EXCEPTIONS
 	naked_debug();
 #endif
 	asm volatile(
+			"str sp, svc_sp_store2\n\t"
+			"movw sp, #:lower16:__svc_stack\n\t"
+			"movt sp, #:upper16:__svc_stack\n\t"
+			"dsb\n\t"
+			"push {r0, r1}\n\t"
+			"mrs r0, spsr\n\t"
+			"tst r0, #0x20 @ thumb?\n\t"
+			"bne 1f\n\t"
+			"ldr r0, [lr, #-4] @ svc instruction (ARM)\n\t"
+			"bic r0, #0xff000000 @ svc number\n\t"
+			"movw r1, #0x3456 @ semihosting svc\n\t"
+			"movt r1, #0x12\n\t"
+			"cmp r0, r1\n\t"
+			"beq 2f\n\t"
+			"b 3f\n\t"
+
+			"1: @ thumb\n\t"
+			"ldrh r0, [lr, #-2] @ svc instruction (thumb)\n\t"
+			"movw r1, #0xdfab @ semihosting svc\n\t"
+			"cmp r0, r1\n\t"
+			"beq 2f\n\t"
+
+			"3: @ not semihosting - re-route\n\t"
+			"pop {r0, r1}\n\t"
+			"ldr sp, svc_sp_store2\n\t"
 			"mov pc, #8 @ jump to low vector\n\t"
+
+			"2: @ semihosting\n\t"
+			"movw r0, #:lower16:rpi2_semihost_svc\n\t"
+			"movt r0, #:upper16:rpi2_semihost_svc\n\t"
+			"mov r1, #16 @ RPI2_TRAP_SEMIHOST\n\t"
+			"str r1, [r0]\n\t"
+			"pop {r0, r1}\n\t"
+			"ldr sp, svc_sp_store2\n\t"
+			"b rpi2_svc_handler\n\t"
+
+			"svc_sp_store2:\n\t"
+			".int 0\n\t"
 	);
 }
 
@@ -1057,6 +1120,274 @@ void rpi2_reroute_exc_fiq()
 
 
 
+// Tracing vector entries (see trace.c): record the exception on the
+// exception mode stack and go on to the normal upper vector handler.
+// All registers are preserved. The stack is free at this point, because
+// the handlers set their stack pointer to the top of the stack, too.
+// The entry continues to the handler that was in the jump table when
+// tracing was switched on (name_next), so it also works in UART FIQ mode.
+#define RPI2_TRACE_ENTRY(name, stack, type) \
+void name() \
+{ \
+	asm volatile ( \
+			"str sp, 1f\n\t" \
+			"movw sp, #:lower16:" #stack "\n\t" \
+			"movt sp, #:upper16:" #stack "\n\t" \
+			"push {r0 - r3, r12, lr} @ 6 words keeps 8-byte alignment\n\t" \
+			"mov r0, #" #type "\n\t" \
+			"mov r1, lr\n\t" \
+			"mrs r2, spsr\n\t" \
+			"bl trace_record\n\t" \
+			"pop {r0 - r3, r12, lr}\n\t" \
+			"ldr sp, 1f\n\t" \
+			"ldr pc, " #name "_next\n\t" \
+			"1: .int 0 @ sp store\n\t" \
+			".globl " #name "_next\n" \
+			#name "_next: .int 0 @ chained handler\n\t" \
+	); \
+}
+
+RPI2_TRACE_ENTRY(rpi2_trace_exc_und, __und_stack, 1)
+RPI2_TRACE_ENTRY(rpi2_trace_exc_svc, __svc_stack, 2)
+RPI2_TRACE_ENTRY(rpi2_trace_exc_pabt, __abrt_stack, 3)
+RPI2_TRACE_ENTRY(rpi2_trace_exc_dabt, __abrt_stack, 4)
+RPI2_TRACE_ENTRY(rpi2_trace_exc_irq, __irq_stack, 6)
+RPI2_TRACE_ENTRY(rpi2_trace_exc_fiq, __fiq_stack, 7)
+
+extern uint32_t rpi2_trace_exc_und_next;
+extern uint32_t rpi2_trace_exc_svc_next;
+extern uint32_t rpi2_trace_exc_pabt_next;
+extern uint32_t rpi2_trace_exc_dabt_next;
+extern uint32_t rpi2_trace_exc_irq_next;
+extern uint32_t rpi2_trace_exc_fiq_next;
+
+// jump table slots that get a tracing entry
+static const int rpi2_trace_exc[] =
+{
+	RPI2_EXC_UNDEF, RPI2_EXC_SVC, RPI2_EXC_PABT,
+	RPI2_EXC_DABT, RPI2_EXC_IRQ, RPI2_EXC_FIQ
+};
+static uint32_t rpi2_trace_saved[8]; // jump table before tracing
+static int rpi2_trace_is_on = 0;
+
+// switch the upper vector jump table between the tracing entries and
+// the handlers that were there before - no run-time cost when tracing
+// is off. The previous handlers are saved rather than assumed, because
+// in UART FIQ mode the IRQ and FIQ slots hold the UART FIQ handlers.
+void rpi2_trace_vectors(int on)
+{
+	// the jump table follows the 8 vector instructions
+	volatile uint32_t *tbl = (volatile uint32_t *)(rpi2_upper_vec_address + 32);
+	uint32_t entry[8];
+	volatile uint32_t *next[8];
+	int i, exc;
+
+	if ((on != 0) == rpi2_trace_is_on)
+		return;
+
+	entry[RPI2_EXC_UNDEF] = (uint32_t)rpi2_trace_exc_und;
+	next[RPI2_EXC_UNDEF] = &rpi2_trace_exc_und_next;
+	entry[RPI2_EXC_SVC] = (uint32_t)rpi2_trace_exc_svc;
+	next[RPI2_EXC_SVC] = &rpi2_trace_exc_svc_next;
+	entry[RPI2_EXC_PABT] = (uint32_t)rpi2_trace_exc_pabt;
+	next[RPI2_EXC_PABT] = &rpi2_trace_exc_pabt_next;
+	entry[RPI2_EXC_DABT] = (uint32_t)rpi2_trace_exc_dabt;
+	next[RPI2_EXC_DABT] = &rpi2_trace_exc_dabt_next;
+	entry[RPI2_EXC_IRQ] = (uint32_t)rpi2_trace_exc_irq;
+	next[RPI2_EXC_IRQ] = &rpi2_trace_exc_irq_next;
+	entry[RPI2_EXC_FIQ] = (uint32_t)rpi2_trace_exc_fiq;
+	next[RPI2_EXC_FIQ] = &rpi2_trace_exc_fiq_next;
+
+	for (i = 0; i < sizeof(rpi2_trace_exc) / sizeof(rpi2_trace_exc[0]); i++)
+	{
+		exc = rpi2_trace_exc[i];
+		if (on)
+		{
+			// the chain target must be in place before the slot is switched
+			rpi2_trace_saved[exc] = tbl[exc];
+			*next[exc] = rpi2_trace_saved[exc];
+			SYNC;
+			tbl[exc] = entry[exc];
+		}
+		else
+		{
+			tbl[exc] = rpi2_trace_saved[exc];
+		}
+	}
+	rpi2_trace_is_on = (on != 0);
+	SYNC;
+}
+
+
+// Detached run: the debuggee gets its own vectors back (VBAR = 0) and
+// runs without the stub in the exception path. Only the low FIQ vector
+// is borrowed for the hook that stops it again - the FIQ has one source
+// only and it is the stub's already (UART0 in FIQ-mode).
+static uint32_t rpi2_detach_hook; // RPI2_DETACH_*, armed at next return
+static uint32_t rpi2_detach_pin; // GPIO for RPI2_DETACH_GPIO
+static uint32_t rpi2_detach_armed; // hook in place
+static uint32_t rpi2_detach_imsc; // UART0 interrupt mask to restore
+static uint32_t rpi2_detach_vec[2]; // low FIQ vector and its jump address
+
+// select the hook - takes effect when the debuggee is resumed
+void rpi2_detach_run(unsigned int hook, unsigned int pin)
+{
+	rpi2_detach_hook = hook;
+	rpi2_detach_pin = (hook == RPI2_DETACH_GPIO) ? pin : 0xffffffff;
+}
+
+static void rpi2_detach_gpio(uint32_t enable)
+{
+	uint32_t bank = (rpi2_detach_pin >> 5) << 2;
+	uint32_t mask = 1 << (rpi2_detach_pin & 31);
+	volatile uint32_t *fsel = (volatile uint32_t *)(GPFSEL0 + (rpi2_detach_pin / 10) * 4);
+
+	if (enable)
+	{
+		*fsel &= ~(7 << ((rpi2_detach_pin % 10) * 3)); // input
+		// pull-up - BCM2835 ARM Peripherals ch 6.1
+		*((volatile uint32_t *)GPPUD) = 2;
+		delay(150);
+		*((volatile uint32_t *)(GPPUDCLK0 + bank)) = mask;
+		delay(150);
+		*((volatile uint32_t *)GPPUD) = 0;
+		*((volatile uint32_t *)(GPPUDCLK0 + bank)) = 0;
+		*((volatile uint32_t *)(GPEDS0 + bank)) = mask; // stale events
+		*((volatile uint32_t *)(GPFEN0 + bank)) |= mask;
+	}
+	else
+	{
+		*((volatile uint32_t *)(GPFEN0 + bank)) &= ~mask;
+		*((volatile uint32_t *)(GPEDS0 + bank)) = mask;
+	}
+	SYNC;
+}
+
+// called at the end of gdb_exception_handler(), interrupts masked
+static void rpi2_detach_arm()
+{
+	uint32_t src;
+	volatile uint32_t *lowvec = (volatile uint32_t *)0;
+
+	if (rpi2_use_hyp && hyp_active)
+	{
+		// the debug hypervisor gives the vectors back on every return
+		rpi2_detach_hook = RPI2_DETACH_NONE;
+		return;
+	}
+
+	// no ctrl-C while detached: the only UART interrupt is the break
+	*((volatile uint32_t *)IRC_FIQCTRL) &= ~(1 << 7);
+	*((volatile uint32_t *)IRC_DIS2) = (1 << 25);
+	rpi2_detach_imsc = *((volatile uint32_t *)UART0_IMSC);
+	if (rpi2_detach_hook == RPI2_DETACH_BREAK)
+	{
+		*((volatile uint32_t *)UART0_ICR) = (1 << 9);
+		*((volatile uint32_t *)UART0_IMSC) = (1 << 9); // BEIM
+		src = 57; // UART
+	}
+	else
+	{
+		*((volatile uint32_t *)UART0_IMSC) = 0;
+		rpi2_detach_gpio(1);
+		// gpio_int[0..2] by pin bank
+		src = 49 + ((rpi2_detach_pin < 28) ? 0 : (rpi2_detach_pin < 46) ? 1 : 2);
+	}
+
+	// borrow the low FIQ vector: ldr pc, [pc, #24]
+	rpi2_detach_vec[0] = lowvec[7];
+	rpi2_detach_vec[1] = lowvec[15];
+	lowvec[7] = 0xe59ff018;
+	lowvec[15] = (uint32_t)(&rpi2_detached_fiq);
+	rpi2_flush_address((unsigned int)&lowvec[7]);
+	rpi2_flush_address((unsigned int)&lowvec[15]);
+
+	*((volatile uint32_t *)IRC_FIQCTRL) = ((1 << 7) | src);
+	rpi2_reg_context.reg.cpsr &= ~(1<<6); // enable fiq
+
+	asm volatile (
+			"mcr p15, 0, %[reg], c12, c0, 0 @ VBAR\n\t"
+			"dsb\n\t"
+			"isb\n\t"
+			::[reg] "r" (0):
+	);
+	rpi2_detach_hook = RPI2_DETACH_NONE;
+	rpi2_detach_armed = 1;
+}
+
+// restore the stub's vectors and the UART interrupts
+static void rpi2_detach_disarm()
+{
+	volatile uint32_t *lowvec = (volatile uint32_t *)0;
+
+	*((volatile uint32_t *)IRC_FIQCTRL) &= ~(1 << 7);
+	if (rpi2_detach_pin != 0xffffffff)
+	{
+		rpi2_detach_gpio(0);
+	}
+	lowvec[7] = rpi2_detach_vec[0];
+	lowvec[15] = rpi2_detach_vec[1];
+	rpi2_flush_address((unsigned int)&lowvec[7]);
+	rpi2_flush_address((unsigned int)&lowvec[15]);
+
+	*((volatile uint32_t *)UART0_ICR) = 0x7ff;
+	*((volatile uint32_t *)UART0_IMSC) = rpi2_detach_imsc;
+	if (rpi2_uart0_excmode == RPI2_UART0_FIQ)
+	{
+		*((volatile uint32_t *)IRC_FIQCTRL) = ((1 << 7) | 57);
+	}
+	else
+	{
+		*((volatile uint32_t *)IRC_EN2) = (1 << 25);
+	}
+
+	asm volatile (
+			"mcr p15, 0, %[reg], c12, c0, 0 @ VBAR\n\t"
+			"dsb\n\t"
+			"isb\n\t"
+			::[reg] "r" (rpi2_upper_vec_address):
+	);
+	rpi2_detach_armed = 0;
+}
+
+// from rpi2_detached_fiq: 2 = hook fired, stop the debuggee
+uint32_t rpi2_detached_check()
+{
+	uint32_t bank, mask;
+
+	if (!rpi2_detach_armed)
+	{
+		return 1;
+	}
+	if (rpi2_detach_pin == 0xffffffff)
+	{
+		if (!(*((volatile uint32_t *)UART0_MIS) & (1 << 9)))
+		{
+			return 1;
+		}
+		*((volatile uint32_t *)UART0_ICR) = (1 << 9);
+		// drop the break null-character(s)
+		while (!(*((volatile uint32_t *)UART0_FR) & (1 << 4)))
+		{
+			(void)*((volatile uint32_t *)UART0_DR);
+		}
+	}
+	else
+	{
+		bank = (rpi2_detach_pin >> 5) << 2;
+		mask = 1 << (rpi2_detach_pin & 31);
+		if (!(*((volatile uint32_t *)(GPEDS0 + bank)) & mask))
+		{
+			return 1;
+		}
+	}
+	rpi2_detach_disarm();
+	rpi2_sigint_flag = 1;
+	exception_extra = RPI2_REASON_REATTACH;
+	rpi2_exc_reason = RPI2_REASON_REATTACH;
+	return 2;
+}
+
 // The exception handlers are attributed as 'naked'so that C function prologue
 // doesn't disturb the stack before the exception stack frame is pushed
 // into the stack, because the prologue would change the register values, and
@@ -1072,51 +1403,19 @@ void rpi2_reroute_exc_fiq()
 // upper level handler for gdb entry
 void gdb_exception_handler()
 {
-	volatile rpi2_reg_context_t *ctx;
-	int i;
 	uint32_t tmp;
 
 #ifdef DEBUG_GDB_EXC
+	int i;
 	//uint32_t exc_cpsr;
 	char *pp;
 	static char scratchpad[16]; // scratchpad
 #endif
 
-	switch (exception_info)
-	{
-	case RPI2_EXC_RESET:
-		ctx = &rpi2_svc_context;
-		break;
-	case RPI2_EXC_UNDEF:
-		ctx = &rpi2_svc_context;
-		break;
-	case RPI2_EXC_SVC:
-		ctx = &rpi2_svc_context;
-		break;
-	case RPI2_EXC_PABT:
-		ctx = &rpi2_pabt_context;
-		break;
-	case RPI2_EXC_DABT:
-		ctx = &rpi2_dabt_context;
-		break;
-	case RPI2_EXC_AUX:
-		ctx = &rpi2_svc_context;
-		break;
-	case RPI2_EXC_IRQ:
-		ctx = &rpi2_irq_context;
-		break;
-	case RPI2_EXC_FIQ:
-		ctx = &rpi2_fiq_context;
-		break;
-	default:
-		ctx = &rpi2_svc_context;
-		break;
-	}
-	// copy irq context to reg context for returning
-	// to original program that was interrupted by CTRL-C
-	for (i=0; i<18; i++)
+	if (rpi2_detach_armed)
 	{
-		rpi2_reg_context.storage[i] = ctx->storage[i];
+		// stopped some other way while detached (unhandled exception)
+		rpi2_detach_disarm();
 	}
 
 #ifdef RPI2_NEON_SUPPORTED
@@ -1210,10 +1509,7 @@ void gdb_exception_handler()
 	util_word_to_hex(scratchpad, exc_cpsr);
 	serial_raw_puts(scratchpad);
 #endif
-	serial_raw_puts("\r\nctx: ");
-	util_word_to_hex(scratchpad, (unsigned int)ctx);
-	serial_raw_puts(scratchpad);
-	serial_raw_puts(" info: ");
+	serial_raw_puts("\r\ninfo: ");
 	util_word_to_hex(scratchpad, (unsigned int)exception_info);
 	serial_raw_puts(scratchpad);
 	serial_raw_puts(" extra: ");
@@ -1268,6 +1564,11 @@ void gdb_exception_handler()
 			rpi2_reg_context.reg.cpsr &= ~(1<<7); // enable irq
 		}
 	}
+
+	if (rpi2_detach_hook != RPI2_DETACH_NONE)
+	{
+		rpi2_detach_arm(); // last thing before returning to the debuggee
+	}
 }
 
 // for debugging
@@ -1293,6 +1594,15 @@ void show_go(uint32_t retaddr)
 // the gdb "entry"
 void rpi2_gdb_exception()
 {
+	// in HYP mode, make sure the stub's vectors are in use
+	asm volatile (
+			"ldr r0, =hyp_active\n\t"
+			"ldr r0, [r0]\n\t"
+			"cmp r0, #0\n\t"
+			"beq 1f\n\t"
+			"hvc #2 @ HYP_HVC_ENTER\n\t"
+			"1:\n\t"
+	);
 	// switch to PABT
 	asm volatile (
 			"mrs r0, cpsr\n\t"
@@ -1321,6 +1631,9 @@ void rpi2_gdb_exception()
 			"pop {r0 - r4, lr}\n\t"
 #endif
 			"push {r0, r1}\n\t"
+			"ldr r1, =rpi2_exc_cycles\n\t"
+			"mrc p15, 0, r0, c9, c13, 0 @ PMCCNTR - exit stamp\n\t"
+			"str r0, [r1, #12]\n\t"
 			"ldr r0, =rpi2_use_hw_debug\n\t"
 			"ldr r1, [r0]\n\t"
 			"cmp r1, #0\n\t"
@@ -1333,6 +1646,7 @@ void rpi2_gdb_exception()
 			"isb\n\t"
 			"2: \n\t"
 			"pop {r0, r1}\n\t"
+			HYP_RESUME_DEBUGGEE
 			"subs pc, lr, #0\n\t"
 	);
 }
@@ -1350,7 +1664,7 @@ void rpi2_reset_handler()
 			"movt sp, #:upper16:__svc_stack\n\t"
 			"dsb\n\t"
 			"push {r12, lr} @ popped in write_context\n\t"
-			"ldr r12, =rpi2_svc_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 	write_context();
 
@@ -1368,7 +1682,7 @@ void rpi2_reset_handler()
 
 			"@ our mode\n\t"
 			"ldr r0, rst_sp_store\n\t"
-			"ldr r1, =rpi2_svc_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1: @ context stored\n\t"
@@ -1422,7 +1736,7 @@ void rpi2_undef_handler2(uint32_t stack_frame_addr, uint32_t exc_addr)
 	util_word_to_hex(scratchpad, exc_cpsr);
 	serial_raw_puts(scratchpad);
 	serial_raw_puts("\r\n");
-	rpi2_dump_context(&rpi2_svc_context);
+	rpi2_dump_context(&rpi2_reg_context);
 }
 #endif
 
@@ -1439,7 +1753,7 @@ void rpi2_undef_handler()
 			"movt sp, #:upper16:__und_stack\n\t"
 			"dsb\n\t"
 			"push {r12, lr} @ popped in write_context\n\t"
-			"ldr r12, =rpi2_svc_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 			"sub lr, #4 @ on return, skip the instruction\n\t"
 	);
 	write_context();
@@ -1458,7 +1772,7 @@ void rpi2_undef_handler()
 
 			"@ our mode\n\t"
 			"ldr r0, und_sp_store\n\t"
-			"ldr r1, =rpi2_svc_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1: @ context stored\n\t"
@@ -1519,7 +1833,7 @@ void rpi2_svc_handler2(uint32_t stack_frame_addr, uint32_t exc_addr)
 	util_word_to_hex(scratchpad, exc_cpsr);
 	serial_raw_puts(scratchpad);
 	serial_raw_puts("\r\n");
-	rpi2_dump_context(&rpi2_svc_context);
+	rpi2_dump_context(&rpi2_reg_context);
 }
 #endif
 
@@ -1537,7 +1851,7 @@ void rpi2_svc_handler()
 			"movt sp, #:upper16:__svc_stack\n\t"
 			"dsb\n\t"
 			"push {r12, lr} @ popped in write_context\n\t"
-			"ldr r12, =rpi2_svc_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 	write_context();
 
@@ -1555,7 +1869,7 @@ void rpi2_svc_handler()
 
 			"@ our mode\n\t"
 			"ldr r0, svc_sp_store\n\t"
-			"ldr r1, =rpi2_svc_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1: @ context stored\n\t"
@@ -1575,8 +1889,11 @@ void rpi2_svc_handler()
 			"mov r1, #2 @ RPI2_EXC_SVC\n\t"
 			"str r1, [r0]\n\t"
 			"ldr r0, =exception_extra\n\t"
-			"mov r1, #0 @ nothing\n\t"
+			"ldr r2, =rpi2_semihost_svc\n\t"
+			"ldr r1, [r2] @ RPI2_TRAP_SEMIHOST or nothing\n\t"
 			"str r1, [r0]\n\t"
+			"mov r1, #0\n\t"
+			"str r1, [r2]\n\t"
 			"ldr r0, =rpi2_gdb_exception\n\t"
 			"mov pc, r0\n\t"
 
@@ -1619,7 +1936,7 @@ void rpi2_aux_handler2(uint32_t stack_frame_addr, uint32_t exc_addr)
 	util_word_to_hex(scratchpad, exc_cpsr);
 	serial_raw_puts(scratchpad);
 	serial_raw_puts("\r\n");
-	rpi2_dump_context(&rpi2_svc_context);
+	rpi2_dump_context(&rpi2_reg_context);
 }
 #endif
 
@@ -1637,7 +1954,7 @@ void rpi2_aux_handler()
 			"movt sp, #:upper16:__svc_stack\n\t"
 			"dsb\n\t"
 			"push {r12, lr} @ popped in write_context\n\t"
-			"ldr r12, =rpi2_svc_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 	write_context();
 
@@ -1655,7 +1972,7 @@ void rpi2_aux_handler()
 
 			"@ our mode\n\t"
 			"ldr r0, aux_sp_store\n\t"
-			"ldr r1, =rpi2_svc_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1: @ context stored\n\t"
@@ -1731,7 +2048,7 @@ void rpi2_dabt_handler2(uint32_t stack_frame_addr, uint32_t exc_addr)
 	util_word_to_hex(scratchpad, dbgdscr);
 	serial_raw_puts(scratchpad);
 	serial_raw_puts("\r\n");
-	rpi2_dump_context(&rpi2_dabt_context);
+	rpi2_dump_context(&rpi2_reg_context);
 }
 #endif
 
@@ -1749,7 +2066,7 @@ void rpi2_unhandled_dabt()
 			"dsb\n\t"
 			"push {r12, lr} @ popped in write_context\n\t"
 			"sub lr, #8 @ fix return address\n\t"
-			"ldr r12, =rpi2_dabt_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 	write_context();
 
@@ -1767,7 +2084,7 @@ void rpi2_unhandled_dabt()
 
 			"@ our mode\n\t"
 			"ldr r0, dabt_sp_store\n\t"
-			"ldr r1, =rpi2_dabt_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1: @ context stored\n\t"
@@ -1836,7 +2153,7 @@ void rpi2_dabt_handler()
 			"bne dabt_other\n\t"
 			"and r0, #0x0f\n\t"
 			"cmp r0, #0x2 @ debug event\n\t"
-			"bne dabt_other\n\t"
+			"bne dabt_access\n\t"
 			"mrc p14, 0, r0, c0, c2, 2 @ read dbgdscr\n\t"
 			"dsb\n\t"
 			"ldr r1, =rpi2_dbg_rec\n\t"
@@ -1848,6 +2165,7 @@ void rpi2_dabt_handler()
 
 			"@ watchpoint\n\t"
 			"mov r3, #6 @ RPI2_TRAP_WATCH\n\t"
+			"dabt_ours:\n\t"
 			"ldr r0, =exception_extra\n\t"
 			"str r3, [r0]\n\t"
 			"ldr r0, =exception_info\n\t"
@@ -1863,7 +2181,7 @@ void rpi2_dabt_handler()
 
 	asm volatile (
 			"push {r12, lr} @ popped in write_context\n\t"
-			"ldr r12, =rpi2_dabt_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 	// store processor context
 	write_context();
@@ -1882,7 +2200,7 @@ void rpi2_dabt_handler()
 
 			"@ our mode\n\t"
 			"ldr r0, dabt_sp_store2\n\t"
-			"ldr r1, =rpi2_dabt_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1:\n\t"
@@ -1899,6 +2217,16 @@ void rpi2_dabt_handler()
 			"b rpi2_gdb_exception\n\t"
 	);
 	asm volatile (
+			"dabt_access: @ permission fault with access trace on?\n\t"
+			"and r0, #0x0d\n\t"
+			"cmp r0, #0x0d @ section or page permission fault\n\t"
+			"bne dabt_other\n\t"
+			"ldr r0, =acctrace_active\n\t"
+			"ldr r0, [r0]\n\t"
+			"cmp r0, #0\n\t"
+			"beq dabt_other\n\t"
+			"mov r3, #17 @ RPI2_TRAP_ACCESS\n\t"
+			"b dabt_ours\n\t"
 			"dabt_other: @ not ours - re-route\n\t"
 			"pop {r0, r1, lr}\n\t"
 			"msr cpsr_fsxc, r0\n\t"
@@ -1964,6 +2292,18 @@ uint32_t rpi2_serial_handler(uint32_t stack_pointer, uint32_t exc_addr)
 		}
 	}
 
+	if ((retval == 0) && (!rpi2_sigint_flag))
+	{
+		if (pmu_budget_check())
+		{
+			// run-for budget used up - stop like with ctrl-C
+			rpi2_sigint_flag = 1;
+			exception_extra = RPI2_REASON_BUDGET;
+			rpi2_exc_reason = RPI2_REASON_BUDGET;
+			retval = 2; // don't return - goto gdb
+		}
+	}
+
 	if (retval == 0)
 	{
 		if (rpi2_uart0_excmode != RPI2_UART0_FIQ)
@@ -2026,7 +2366,7 @@ uint32_t rpi2_serial_handler(uint32_t stack_pointer, uint32_t exc_addr)
 		serial_raw_puts(scratchpad);
 		serial_raw_puts("\r\n");
 #ifdef DEBUG_CTRLC
-		rpi2_dump_context(&rpi2_irq_context);
+		rpi2_dump_context(&rpi2_reg_context);
 #endif
 	}
 #endif
@@ -2044,7 +2384,7 @@ void rpi2_unhandled_irq()
 			"movt sp, #:upper16:__irq_stack\n\t"
 			"dsb\n\t"
 			"push {r12, lr} @ popped in write_context\n\t"
-			"ldr r12, =rpi2_irq_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 			"sub lr, #4 @ fix return address\n\t"
 	);
 	// store processor context
@@ -2064,7 +2404,7 @@ void rpi2_unhandled_irq()
 
 			"@ our mode\n\t"
 			"ldr r0, irq_sp_store1\n\t"
-			"ldr r1, =rpi2_irq_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1:\n\t"
@@ -2135,7 +2475,7 @@ void rpi2_irq_handler()
 			"pop {r0 - r12}\n\t"
 			"sub lr, #4 @ fix return address\n\t"
 			"push {r12, lr}\n\t"
-			"ldr r12, =rpi2_irq_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 // store processor context
 write_context();
@@ -2154,7 +2494,7 @@ write_context();
 
 			"@ our mode\n\t"
 			"ldr r0, irq_sp_store2\n\t"
-			"ldr r1, =rpi2_irq_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"3: \n\t"
@@ -2181,7 +2521,7 @@ void rpi2_unhandled_fiq()
 			"dsb\n\t"
 			"push {r12, lr} @ popped in write_context\n\t"
 			"sub lr, #4 @ fix return address\n\t"
-			"ldr r12, =rpi2_fiq_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 	write_context();
 
@@ -2199,7 +2539,7 @@ void rpi2_unhandled_fiq()
 
 			"@ our mode\n\t"
 			"ldr r0, fiq_sp_store1\n\t"
-			"ldr r1, =rpi2_fiq_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1:\n\t"
@@ -2217,6 +2557,90 @@ void rpi2_unhandled_fiq()
 	);
 }
 
+// ctrl-C (or run-for budget) seen in HYP mode, or the detached-run hook
+// hyp.c and rpi2_detached_fiq enter here in FIQ mode,
+// lr = interrupted address (no offset)
+void rpi2_fiq_sigint()
+{
+	asm volatile (
+			"str sp, fiq_sigint_sp_store\n\t"
+			"@ switch to our stack\n\t"
+			"movw sp, #:lower16:__fiq_stack\n\t"
+			"movt sp, #:upper16:__fiq_stack\n\t"
+			"dsb\n\t"
+			"push {r12, lr} @ popped in write_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
+	);
+	write_context();
+
+	asm volatile (
+			"@ fix sp in the context, if needed\n\t"
+			"mrs r0, spsr @ interrupted mode\n\t"
+			"mrs r2, cpsr @ our mode\n\t"
+			"dsb\n\t"
+			"mov r1, #0xf @ all valid modes have bit 4 set\n\t"
+			"and r0, r1\n\t"
+			"and r2, r1\n\t"
+			"@ our own mode?\n\t"
+			"cmp r0, r2\n\t"
+			"bne 1f @ not our own mode, no fix needed\n\t"
+
+			"@ our mode\n\t"
+			"ldr r0, fiq_sigint_sp_store\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
+			"str r0, [r1, #13*4]\n\t"
+
+			"1:\n\t"
+			"ldr r0, =exception_info\n\t"
+			"mov r1, #7 @ RPI2_EXC_FIQ\n\t"
+			"str r1, [r0]\n\t"
+			"ldr r0, =rpi2_gdb_exception\n\t"
+			"mov pc, r0\n\t"
+
+			"fiq_sigint_sp_store:\n\t"
+			".int 0\n\t"
+			".ltorg @ literal pool\n\t"
+	);
+}
+
+// low FIQ vector entry while detached - see rpi2_detach_arm()
+void rpi2_detached_fiq()
+{
+	asm volatile (
+			"str sp, detached_sp_store\n\t"
+			"movw sp, #:lower16:__fiq_stack\n\t"
+			"movt sp, #:upper16:__fiq_stack\n\t"
+			"dsb\n\t"
+			"push {r0 - r12}\n\t"
+			"mrs r0, cpsr\n\t"
+			"push {r0, r1, lr} @ r1 to keep sp double word aligned\n\t"
+			"bl rpi2_detached_check\n\t"
+			"cmp r0, #2\n\t"
+			"beq 1f @ hook fired\n\t"
+
+			"pop {r0, r1, lr}\n\t"
+			"msr cpsr_fsxc, r0\n\t"
+			"dsb\n\t"
+			"isb\n\t"
+			"pop {r0 - r12}\n\t"
+			"ldr sp, detached_sp_store\n\t"
+			"subs pc, lr, #4\n\t"
+
+			"1:\n\t"
+			"pop {r0, r1, lr}\n\t"
+			"msr cpsr_fsxc, r0\n\t"
+			"dsb\n\t"
+			"isb\n\t"
+			"pop {r0 - r12}\n\t"
+			"ldr sp, detached_sp_store\n\t"
+			"sub lr, #4 @ fix return address\n\t"
+			"b rpi2_fiq_sigint\n\t"
+
+			"detached_sp_store:\n\t"
+			".int 0\n\t"
+	);
+}
+
 void rpi2_fiq_handler()
 {
 	asm volatile (
@@ -2274,7 +2698,7 @@ void rpi2_fiq_handler()
 			"pop {r0 - r12}\n\t"
 			"sub lr, #4 @ fix return address\n\t"
 			"push {r12, lr}\n\t"
-			"ldr r12, =rpi2_fiq_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 // store processor context
 write_context();
@@ -2293,7 +2717,7 @@ write_context();
 
 			"@ our mode\n\t"
 			"ldr r0, fiq_sp_store2\n\t"
-			"ldr r1, =rpi2_fiq_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"3: \n\t"
@@ -2401,7 +2825,7 @@ void rpi2_pabt_handler2(uint32_t stack_frame_addr, uint32_t exc_addr)
 	util_word_to_hex(scratchpad, (unsigned int)rpi2_sigint_flag);
 	serial_raw_puts(scratchpad);
 	serial_raw_puts("\r\n");
-	rpi2_dump_context(&rpi2_pabt_context);
+	rpi2_dump_context(&rpi2_reg_context);
 
 #if 0
 	// if we were in debug-state
@@ -2464,7 +2888,7 @@ void rpi2_pabt_handler2(uint32_t stack_frame_addr, uint32_t exc_addr)
 	{
 		serial_raw_puts("\r\nBKPT\r\n");
 		serial_raw_puts("ret_addr: ");
-		util_word_to_hex(scratchpad, rpi2_pabt_context.reg.r15);
+		util_word_to_hex(scratchpad, rpi2_reg_context.reg.r15);
 		serial_raw_puts(scratchpad);
 		serial_raw_puts("\r\n");
 	}
@@ -2480,7 +2904,7 @@ void rpi2_pabt_handler2(uint32_t stack_frame_addr, uint32_t exc_addr)
 	serial_raw_puts(scratchpad);
 	serial_raw_puts(" =flag\r\n");
 	serial_raw_puts(" SPSR: ");
-	util_word_to_hex(scratchpad, rpi2_pabt_context.reg.cpsr);
+	util_word_to_hex(scratchpad, rpi2_reg_context.reg.cpsr);
 	serial_raw_puts(scratchpad);
 	//rpi2_reg_context.reg.cpsr &= ~(1<<8); // enable irqs (fishy)
 #endif
@@ -2501,7 +2925,7 @@ void rpi2_unhandled_pabt()
 			"dsb\n\t"
 			"sub lr, #4 @ gdb wants fixed address\n\t"
 			"push {r12, lr} @ popped in write_context\n\t"
-			"ldr r12, =rpi2_pabt_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 	// store processor context
 	write_context();
@@ -2520,7 +2944,7 @@ void rpi2_unhandled_pabt()
 
 			"@ our mode\n\t"
 			"ldr r0, pabt_sp_store1\n\t"
-			"ldr r1, =rpi2_pabt_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"1:\n\t"
@@ -2564,7 +2988,7 @@ void rpi2_unhandled_pabt()
 			"str r1, [r0]\n\t"
 #if 0
 			"@ fix return address\n\t"
-			"ldr r0, =rpi2_pabt_context\n\t"
+			"ldr r0, =rpi2_reg_context\n\t"
 			"ldr r1, [r0, #15*4]\n\t"
 			"sub r1, #4 @ fix address to exception address\n\t"
 			"str r1, [r0, #15*4]\n\t"
@@ -2655,6 +3079,18 @@ void rpi2_pabt_handler()
 			"cmp r1, r0\n\t"
 			"moveq r3, #0xf @ RPI2_TRAP_INITIAL\n\t"
 			"beq 2f @ our bkpt\n\t"
+			"movw r0, #0x0a7b @ semihosting bkpt 0xab\n\t"
+			"movt r0, #0xe120\n\t"
+			"cmp r1, r0\n\t"
+			"moveq r3, #16 @ RPI2_TRAP_SEMIHOST\n\t"
+			"beq 2f @ our bkpt\n\t"
+			"@ PABT return offset is 4 also in thumb state\n\t"
+			"sub r0, lr, #4 @ exception address\n\t"
+			"ldrh r1, [r0] @ get instruction\n\t"
+			"movw r0, #0xbeab @ semihosting bkpt 0xab thumb\n\t"
+			"cmp r1, r0\n\t"
+			"moveq r3, #16 @ RPI2_TRAP_SEMIHOST\n\t"
+			"beq 2f @ our bkpt\n\t"
 			"@ for thumb,the exception offset is just 2\n\t"
 			"sub r0, lr, #2 @ exception address\n\t"
 			"ldrh r1, [r0] @ get instruction\n\t"
@@ -2690,7 +3126,7 @@ void rpi2_pabt_handler()
 );
 	asm volatile (
 			"push {r12, lr} @ popped in write_context\n\t"
-			"ldr r12, =rpi2_pabt_context\n\t"
+			"ldr r12, =rpi2_reg_context\n\t"
 	);
 	// store processor context
 	write_context();
@@ -2709,7 +3145,7 @@ void rpi2_pabt_handler()
 
 			"@ our mode\n\t"
 			"ldr r0, pabt_sp_store2\n\t"
-			"ldr r1, =rpi2_pabt_context\n\t"
+			"ldr r1, =rpi2_reg_context\n\t"
 			"str r0, [r1, #13*4]\n\t"
 
 			"3:\n\t"
@@ -2738,6 +3174,7 @@ void rpi2_pabt_handler()
 			"dsb\n\t"
 			"isb\n\t"
 			"pop {r0 - r12}\n\t"
+			HYP_RESUME_DEBUGGEE
 			"ldr sp, pabt_sp_store2\n\t"
 			"subs pc, lr, #0\n\t"
 
@@ -2759,6 +3196,7 @@ void rpi2_pabt_handler()
 			"ldr r1, [r5, #4]\n\t"
 			"pop {r5, lr}\n\t"
 			"@ return \n\t"
+			HYP_RESUME_DEBUGGEE
 			"ldr sp, pabt_sp_store2\n\t"
 			"subs pc, lr, #0\n\t"
 	);
@@ -3344,6 +3782,55 @@ void rpi2_get_cmdline(char *line)
 	line[linelen-1] = '\0';
 }
 
+// ARM RAM, UART clock and the command line with one property call
+// instead of three - the firmware takes its time with each of them
+void rpi2_get_boot_info(char *line)
+{
+	uint32_t i, linelen;
+	uint32_t request, response;
+	volatile uint32_t *buff = (volatile uint32_t *)rpi2_mbox_buff;
+
+	buff[0] = MBOX_BUFF_SIZE;
+	buff[1] = 0; // request
+	buff[2] = 0x00010005; // get ARM memory
+	buff[3] = 2*4;
+	buff[4] = 0;
+	buff[5] = 0;
+	buff[6] = 0;
+	buff[7] = 0x00030002; // get clock rate
+	buff[8] = 2*4;
+	buff[9] = 4;
+	buff[10] = CLOCK_UART;
+	buff[11] = 0;
+	buff[12] = 0x00050001; // get command line
+	buff[13] = 1024;
+	buff[14] = 0;
+	for (i=15; i<15+256; i++) buff[i] = 0;
+	buff[15+256] = 0; // end tag
+
+	request = (uint32_t)(buff);
+	request &= ((~0) << 4);
+	request |= 8; // channel for property tags
+	SYNC;
+	while ( (*((volatile uint32_t *)MBOX0_STATUS)) == (uint32_t)MBOX_STATUS_FULL);
+	*((volatile uint32_t *)MBOX1_WRITE) = request;
+	do {
+		SYNC;
+		while (*((volatile uint32_t *)MBOX0_STATUS) == (uint32_t)MBOX_STATUS_EMPTY);
+		response = *((volatile uint32_t *)MBOX0_READ);
+	} while ((response & 0xf) != 8);
+
+	rpi2_arm_ramstart = buff[5];
+	rpi2_arm_ramsize = buff[6];
+	rpi2_uart_clock = (buff[10] == CLOCK_UART) ? buff[11] : 0;
+
+	linelen = buff[14] & 0x7fffffff;
+	if (linelen > 1023) linelen = 1023;
+	for (i=0; i<linelen; i++) line[i] = ((volatile char *)&buff[15])[i];
+	line[linelen] = '\0';
+	rpi2_boot_info = 1;
+}
+
 void rpi2_set_vectors()
 {
 	int i;
@@ -3503,6 +3990,102 @@ void rpi2_invalidate_tlbs()
 	asm volatile ("dsb\n\tisb\n\t" ::: "memory");
 }
 
+// for run-time changes to the translation table (acctrace.c)
+volatile unsigned int *rpi2_mmu_table()
+{
+	return master_xlat_tbl;
+}
+
+// makes the translation table changes visible
+// the tables are in write-through memory, so no cleaning is needed
+void rpi2_mmu_update()
+{
+	asm volatile ("dsb\n\t" ::: "memory");
+	asm volatile ("mcr p15, 0, %0, c8, c7, 0\n\t" :: "r" (0)); // TLBIALL
+	asm volatile ("mcr p15, 0, %0, c7, c5, 6\n\t" :: "r" (0)); // BPIALL
+	SYNC;
+}
+
+// drops the cache lines of a range (the stub's memory is write-through)
+static void rpi2_invalidate_range(uint32_t start, uint32_t end)
+{
+	uint32_t addr;
+
+	for (addr = start; addr < end; addr += 32)
+	{
+		asm volatile ("mcr p15, 0, %0, c7, c6, 1\n\t" :: "r" (addr)); // DCIMVAC
+	}
+	asm volatile ("mcr p15, 0, %0, c7, c5, 0\n\t" :: "r" (0)); // ICIALLU
+	SYNC;
+}
+
+// small page descriptor with the attributes of a section descriptor
+uint32_t rpi2_mmu_page_desc(uint32_t sect, uint32_t addr)
+{
+	return (addr & 0xfffff000) | 2
+			| (sect & 0xc) // C, B
+			| ((sect >> 4) & 1) // XN
+			| (((sect >> 10) & 3) << 4) // AP[1:0]
+			| (((sect >> 12) & 7) << 6) // TEX
+			| (((sect >> 15) & 1) << 9) // AP[2]
+			| (((sect >> 16) & 3) << 10); // S, nG
+}
+
+// The stub (at most 512 kB, see loader.ld) fits in one section. Its pages
+// are mapped with a coarse page table, so that the debuggee's code and
+// data in the rest of the section stay as they were.
+#define RPI2_STUB_SECTS 1
+static __attribute__ ((aligned (1024))) uint32_t rpi2_stub_pages[RPI2_STUB_SECTS][256];
+static uint32_t rpi2_stub_sect_desc[RPI2_STUB_SECTS]; // the original sections
+static int rpi2_stub_nc = 0; // flag: the stub's pages are non-cacheable
+
+// Maps the stub's own code and data pages as normal non-cacheable memory
+// (on = 0), so that a stop doesn't evict the debuggee's cache lines,
+// or back to cacheable (on = 1). Only TEX, C and B of the stub's pages
+// change. The stub's lines are dropped both ways - none get left behind
+// to go stale. The pages shared with the debuggee (the first and last
+// one, if the stub doesn't end at a page boundary) go non-cacheable too.
+void rpi2_stub_cacheable(int on)
+{
+	uint32_t start = (uint32_t)&__code_begin & ~31;
+	uint32_t end = (uint32_t)&__hivec + 64;
+	uint32_t meg, addr, desc;
+	int i, n;
+
+	if (!rpi2_use_mmu || ((on == 0) == rpi2_stub_nc))
+	{
+		return;
+	}
+	rpi2_invalidate_range(start, end);
+	for (meg = start >> 20, n = 0; (meg <= ((end - 1) >> 20)) && (n < RPI2_STUB_SECTS);
+			meg++, n++)
+	{
+		if (on)
+		{
+			master_xlat_tbl[meg] = rpi2_stub_sect_desc[n];
+			continue;
+		}
+		desc = master_xlat_tbl[meg];
+		rpi2_stub_sect_desc[n] = desc;
+		for (i=0; i<256; i++)
+		{
+			addr = (meg << 20) | (i << 12);
+			rpi2_stub_pages[n][i] = rpi2_mmu_page_desc(desc, addr);
+			if ((addr + 0x1000 > start) && (addr < end))
+			{
+				// normal non-cacheable: TEX = 001, C = 0, B = 0
+				rpi2_stub_pages[n][i] = (rpi2_stub_pages[n][i] & ~0x1cc) | 0x40;
+			}
+		}
+		// coarse page table entry: NS and domain from the section
+		master_xlat_tbl[meg] = (uint32_t)rpi2_stub_pages[n] | 1 | ((desc >> 16) & 8)
+				| (desc & 0x1e0);
+	}
+	rpi2_mmu_update();
+	rpi2_invalidate_range(start, end);
+	rpi2_stub_nc = (on == 0);
+}
+
 // enable MMU and caches
 void rpi2_enable_mmu()
 {
@@ -3607,8 +4190,11 @@ void rpi2_init()
 
 	rpi2_debuggee_running = 0;
 	gdb_dyn_debug = 0;
-	rpi2_arm_ramsize = rpi2_get_arm_ram(&rpi2_arm_ramstart);
-	rpi2_uart_clock = rpi2_get_clock(CLOCK_UART);
+	if (!rpi2_boot_info)
+	{
+		rpi2_arm_ramsize = rpi2_get_arm_ram(&rpi2_arm_ramstart);
+		rpi2_uart_clock = rpi2_get_clock(CLOCK_UART);
+	}
 
 #if 0
 	serial_enable_ctrlc();
@@ -3744,6 +4330,7 @@ void rpi2_init()
 			rpi2_neon_used = 1;
 		}
 	}
+	boottime_mark("debug-hw");
 	cpsr_store = rpi2_disable_save_ints();
 	rpi2_set_vectors();
 	if (rpi2_use_mmu)
@@ -3752,6 +4339,7 @@ void rpi2_init()
 		rpi2_invalidate_caches();
 	}
 	rpi2_restore_ints(cpsr_store);
+	boottime_mark(rpi2_use_mmu ? "vectors+mmu" : "vectors");
 
 	if (rpi2_use_hw_debug)
 	{
@@ -3761,6 +4349,7 @@ void rpi2_init()
 		asm volatile ("mcr p14, 0, %[val], c0, c2, 2\n\t" ::[val] "r" (tmp1) :);
 		SYNC;
 	}
+	hyp_init();
 }
 
 #if 0
@@ -54,6 +54,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 // system timer low
 #define SYSTMR_CLO 0x3f003004
+// system timer high
+#define SYSTMR_CHI 0x3f003008
 
 // The GPIO registers base address.
 #define GPIO_BASE (PERIPH_BASE + 0x200000)
@@ -67,6 +69,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define GPIO_CLRREG1 (GPIO_BASE + 0x2c)	// The GPIO clear register (for pin 47)
 #define GPIO47_MASK (1 << 15)	// The GPIO47 output mask (for pin 47)
 
+#define GPFSEL0 (GPIO_BASE + 0x00)	// The GPIO function select (pins 0-9)
+#define GPEDS0 (GPIO_BASE + 0x40)	// The GPIO event detect status
+#define GPFEN0 (GPIO_BASE + 0x58)	// The GPIO falling edge detect enable
 #define GPPUD (GPIO_BASE + 0x94)	// Pull up/down for all GPIO pins
 #define GPPUDCLK0 (GPIO_BASE + 0x98) // Pull up/down for specific GPIO pin
 #define GPPUDCLK1 (GPIO_BASE + 0x9C) // Pull up/down for specific GPIO pin
@@ -134,6 +139,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define MBOX1_WRITE (MBOX_BASE + 0xA0)
 #define MBOX1_STATUS (MBOX_BASE + 0xB8)
 
+// BCM2836 local peripherals (per-core interrupt routing)
+#define LOCAL_BASE 0x40000000
+#define LOCAL_PMU_ROUTE_SET (LOCAL_BASE + 0x10)
+#define LOCAL_PMU_ROUTE_CLR (LOCAL_BASE + 0x14)
+#define LOCAL_CORE0_IRQ_SRC (LOCAL_BASE + 0x60)
+#define LOCAL_CORE0_FIQ_SRC (LOCAL_BASE + 0x70)
+#define LOCAL_PMU_ROUTE_IRQ0 (1 << 0) // core 0 IRQ
+#define LOCAL_PMU_ROUTE_FIQ0 (1 << 4) // core 0 FIQ
+#define LOCAL_SRC_PMU (1 << 9)
+
 #define MBOX_STATUS_FULL (1 << 31)
 #define MBOX_STATUS_EMPTY (1 << 30)
 
@@ -183,6 +198,11 @@ typedef struct
 #define RPI2_INITIAL_BKPT 0xe127ff7d
 #define RPI2_USER_BKPT_ARM 0xe127ff7f
 #define RPI2_USER_BKPT_THUMB 0xbebe
+// semihosting: bkpt 0xab, svc 0x123456 (ARM) and svc 0xab (thumb)
+#define RPI2_SEMIHOST_BKPT_ARM 0xe1200a7b
+#define RPI2_SEMIHOST_BKPT_THUMB 0xbeab
+#define RPI2_SEMIHOST_SVC_ARM 0x123456
+#define RPI2_SEMIHOST_SVC_THUMB 0xdfab
 
 // exception_extra values used in PABT
 #define RPI2_EXTRA_NOTHING 0
@@ -206,14 +226,34 @@ typedef struct
 #define RPI2_TRAP_LOGN 14
 // our initial breakpoint
 #define RPI2_TRAP_INITIAL 15
+// semihosting call (PABT and SVC)
+#define RPI2_TRAP_SEMIHOST 16
+// permission fault in an access traced page (DABT)
+#define RPI2_TRAP_ACCESS 17
 
 // for special traps to gdb
 #define RPI2_REASON_SIGINT 2
 #define RPI2_REASON_HW_EXC 30
 #define RPI2_REASON_SW_EXC 31
+#define RPI2_REASON_BUDGET 36 // run-for budget used up
+#define RPI2_REASON_REATTACH 37 // detached-run hook fired
+
+// detached-run hooks
+#define RPI2_DETACH_NONE 0 // plain detach, the stub's vectors stay
+#define RPI2_DETACH_BREAK 1 // UART0 break condition
+#define RPI2_DETACH_GPIO 2 // falling edge on a GPIO pin
 
 #define SYNC asm volatile ("dsb\n\tisb\n\t":::"memory")
 
+// Index handoff between the stub and its interrupt handler on the same
+// core: the core sees its own accesses in order, so only the compiler
+// must not move the data accesses over them - no barrier instructions.
+// Not for sharing with the other cores.
+#define LOAD_ACQUIRE(x) ({ __typeof__(x) v__ = __atomic_load_n(&(x), __ATOMIC_RELAXED); \
+		__atomic_signal_fence(__ATOMIC_ACQUIRE); v__; })
+#define STORE_RELEASE(x, v) do { __atomic_signal_fence(__ATOMIC_RELEASE); \
+		__atomic_store_n(&(x), (v), __ATOMIC_RELAXED); } while (0)
+
 // exception info
 typedef struct
 {
@@ -247,6 +287,9 @@ extern unsigned int rpi2_uart0_baud;
 extern unsigned int rpi2_use_mmu;
 extern unsigned int rpi2_use_hw_debug;
 extern unsigned int rpi2_print_dbg_info;
+extern unsigned int rpi2_step_masked; // step with IRQ/FIQ masked
+extern unsigned int rpi2_use_hyp; // debuggee under the stub in HYP mode
+extern unsigned int rpi2_strict_start; // strictly ordered ram start address
 
 // register context
 // for lr in exception, see pages B1-1172 and B1-1173 of
@@ -277,6 +320,9 @@ typedef union reg_ctx {
 
 extern volatile rpi2_reg_context_t rpi2_reg_context;
 
+// PMCCNTR at: exception entry, gdb entry, gdb exit, exception return
+extern volatile unsigned int rpi2_exc_cycles[4];
+
 typedef struct neon_ctx {
 	unsigned long long storage[32]; // 256 bytes
 	unsigned int fpscr;
@@ -299,16 +345,23 @@ void rpi2_disable_ints();
 void rpi2_enable_ints();
 void set_gdb_enabled(unsigned int state);
 void rpi2_get_cmdline(char *line);
+void rpi2_get_boot_info(char *line);
 
 void rpi2_set_vectors();
 void rpi2_enable_mmu();
 void rpi2_flush_address(unsigned int addr);
 void rpi2_invalidate_caches();
+volatile unsigned int *rpi2_mmu_table();
+void rpi2_mmu_update();
+uint32_t rpi2_mmu_page_desc(uint32_t sect, uint32_t addr);
+void rpi2_stub_cacheable(int on);
 void rpi2_trap();
 void rpi2_gdb_trap();
 void rpi2_init();
 void rpi2_set_trap(void *address, int kind);
 void rpi2_pend_trap();
+void rpi2_trace_vectors(int on);
+void rpi2_detach_run(unsigned int hook, unsigned int pin);
 
 void rpi2_timer_kick();
 void rpi2_timer_start();
@@ -0,0 +1,235 @@
+# rpi_mux.py
+#
+# Copyright (C) 2015 Juha Aaltonen
+#
+# This file is part of standalone gdb stub for Raspberry Pi 2B.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+# Channel demultiplexer (QRpiChannels). Turns on the channel frames in the
+# stub, passes the gdb traffic through to a TCP port and the channels to
+# TCP ports of their own and/or to files:
+#   python3 rpi_mux.py /dev/ttyUSB0 -f 2:trace.bin
+# and then 'target remote :2159' in gdb and, for example, 'nc localhost 2161'
+# for channel 1. The debuggee writes to channel N with semihosting
+# SYS_WRITE to the handle it got with SYS_OPEN ":chanN".
+# Needs pyserial.
+
+import argparse
+import select
+import socket
+import time
+import serial
+
+CHAN_ESC = 0x10
+CHAN_NUM = 4
+
+# gdb packet framing of the stub's output
+OUT, DATA, SUM1, SUM2, FRAME = range(5)
+
+def frame(lead, payload):
+	return lead + payload + b"#%02x" % (sum(payload) & 0xff)
+
+class Splitter:
+	"""Splits the stub's output into gdb bytes and channel frames."""
+
+	def __init__(self):
+		self.state = OUT
+		self.frame = bytearray()
+		self.bad = 0
+
+	def feed(self, data):
+		"""Returns (gdb bytes, list of (channel, data))."""
+		gdb = bytearray()
+		frames = []
+		for c in data:
+			if self.state == FRAME:
+				self.frame.append(c)
+				if len(self.frame) >= 3 and len(self.frame) == self.frame[2] + 4:
+					payload = bytes(self.frame[3:-1])
+					if sum(payload) & 0xff == self.frame[-1]:
+						frames.append((self.frame[1], payload))
+					else:
+						self.bad += 1
+					self.state = OUT
+				continue
+			if self.state == OUT:
+				if c == CHAN_ESC:
+					self.frame = bytearray([c])
+					self.state = FRAME
+					continue
+				if c in b"$%":
+					self.state = DATA
+			elif self.state == DATA:
+				if c == ord("#"):
+					self.state = SUM1
+			elif self.state == SUM1:
+				self.state = SUM2
+			else:
+				self.state = OUT
+			gdb.append(c)
+		return bytes(gdb), frames
+
+class Channel:
+	"""Sinks of one channel: TCP clients and a file."""
+
+	def __init__(self, num, port, path):
+		self.num = num
+		self.clients = []
+		self.file = open(path, "ab") if path else None
+		self.srv = None
+		if port:
+			self.srv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+			self.srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+			self.srv.bind(("localhost", port))
+			self.srv.listen(4)
+		self.bytes = 0
+
+	def write(self, data):
+		self.bytes += len(data)
+		if self.file:
+			self.file.write(data)
+			self.file.flush()
+		for conn in self.clients[:]:
+			try:
+				conn.sendall(data)
+			except OSError:
+				self.drop(conn)
+
+	def drop(self, conn):
+		self.clients.remove(conn)
+		conn.close()
+
+class Mux:
+
+	def __init__(self, ser, gdb_port, channels):
+		self.ser = ser
+		self.split = Splitter()
+		self.channels = channels
+		self.srv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		self.srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.srv.bind(("localhost", gdb_port))
+		self.srv.listen(1)
+		self.gdb = None
+
+	def stub_request(self, payload):
+		"""Sends a packet to the stub and waits for the reply."""
+		self.ser.write(frame(b"$", payload))
+		rx = b""
+		end = time.time() + 2.0
+		while time.time() < end:
+			gdb, frames = self.split.feed(self.ser.read(64))
+			self.to_channels(frames)
+			rx += gdb
+			start = rx.find(b"$")
+			if start >= 0 and rx.find(b"#", start) >= 0:
+				self.ser.write(b"+")
+				return rx[start + 1:rx.find(b"#", start)]
+		return None
+
+	def to_channels(self, frames):
+		for (num, data) in frames:
+			if num in self.channels:
+				self.channels[num].write(data)
+
+	def stub_input(self, data):
+		gdb, frames = self.split.feed(data)
+		if gdb and self.gdb:
+			self.gdb.sendall(gdb)
+		self.to_channels(frames)
+
+	def run(self):
+		while True:
+			inputs = [self.ser, self.srv]
+			for ch in self.channels.values():
+				inputs += ch.clients
+				if ch.srv:
+					inputs.append(ch.srv)
+			if self.gdb:
+				inputs.append(self.gdb)
+			ready, _, _ = select.select(inputs, [], [])
+			for sock in ready:
+				if sock is self.ser:
+					self.stub_input(self.ser.read(max(1, self.ser.in_waiting)))
+				elif sock is self.srv:
+					conn, _ = self.srv.accept()
+					if self.gdb:
+						conn.close() # one gdb at a time
+					else:
+						self.gdb = conn
+						print("gdb connected")
+				elif sock is self.gdb:
+					data = self.gdb.recv(4096)
+					if data:
+						self.ser.write(data)
+					else:
+						self.gdb.close()
+						self.gdb = None
+						print("gdb disconnected")
+				else:
+					self.channel_socket(sock)
+
+	def channel_socket(self, sock):
+		for ch in self.channels.values():
+			if sock is ch.srv:
+				conn, _ = ch.srv.accept()
+				ch.clients.append(conn)
+				print("channel %d: client connected" % ch.num)
+			elif sock in ch.clients:
+				# the channels are one-way, the input is discarded
+				if not sock.recv(4096):
+					ch.drop(sock)
+
+def main():
+	ap = argparse.ArgumentParser(description="Channel demultiplexer for rpi_stub")
+	ap.add_argument("port")
+	ap.add_argument("-b", "--baud", type=int, default=115200)
+	ap.add_argument("-l", "--listen", type=int, default=2159,
+			help="TCP port for gdb (default 2159), channel N is on port + N")
+	ap.add_argument("-n", "--no-sockets", action="store_true",
+			help="no TCP ports for the channels")
+	ap.add_argument("-f", "--file", action="append", default=[],
+			metavar="N:PATH", help="append channel N to file PATH")
+	args = ap.parse_args()
+
+	files = {}
+	for spec in args.file:
+		num, path = spec.split(":", 1)
+		files[int(num)] = path
+	channels = {}
+	for num in range(1, CHAN_NUM + 1):
+		port = None if args.no_sockets else args.listen + num
+		if port or num in files:
+			channels[num] = Channel(num, port, files.get(num))
+
+	ser = serial.Serial(args.port, args.baud, timeout=0.05)
+	mux = Mux(ser, args.listen, channels)
+	if mux.stub_request(b"QRpiChannels:1") != b"OK":
+		print("stub doesn't support QRpiChannels, just forwarding gdb")
+	print("gdb on port %d" % args.listen)
+	try:
+		mux.run()
+	except KeyboardInterrupt:
+		pass
+	finally:
+		if mux.gdb is None:
+			mux.stub_request(b"QRpiChannels:0")
+		for ch in channels.values():
+			print("channel %d: %d bytes" % (ch.num, ch.bytes))
+		if mux.split.bad:
+			print("%d bad frames" % mux.split.bad)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,245 @@
+# rpi_proxy.py
+#
+# Copyright (C) 2015 Juha Aaltonen
+#
+# This file is part of standalone gdb stub for Raspberry Pi 2B.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+# Caching gdb proxy (QRpiStopPush). Turns on the stop-time context push in
+# the stub and answers gdb's register and memory reads after a stop from
+# what the stub pushed, instead of a serial round trip for each:
+#   python3 rpi_proxy.py /dev/ttyUSB0
+# and then in gdb 'target remote :2159'.
+# Needs pyserial.
+
+import argparse
+import select
+import socket
+import time
+import serial
+
+# how long a cached read waits for the rest of the push (seconds)
+PUSH_WAIT = 0.2
+
+def frame(lead, payload):
+	return lead + payload + b"#%02x" % (sum(payload) & 0xff)
+
+class Parser:
+	"""Splits a byte stream into acks, interrupts and '$'/'%' packets."""
+
+	def __init__(self):
+		self.rx = bytearray()
+
+	def feed(self, data):
+		"""Returns a list of (kind, payload); kind is one of + - ^C $ %."""
+		self.rx += data
+		out = []
+		while self.rx:
+			c = self.rx[:1]
+			if c in (b"+", b"-"):
+				out.append((c.decode(), None))
+				del self.rx[:1]
+			elif c == b"\x03":
+				out.append(("^C", None))
+				del self.rx[:1]
+			elif c in (b"$", b"%"):
+				hash_pos = self.rx.find(b"#")
+				if hash_pos < 0 or len(self.rx) < hash_pos + 3:
+					break
+				payload = bytes(self.rx[1:hash_pos])
+				try:
+					good = int(self.rx[hash_pos + 1:hash_pos + 3], 16) == \
+						sum(payload) & 0xff
+				except ValueError:
+					good = False
+				del self.rx[:hash_pos + 3]
+				out.append((c.decode() if good else "bad" + c.decode(), payload))
+			else:
+				# noise
+				del self.rx[:1]
+		return out
+
+class Cache:
+	"""Target context pushed at the last stop."""
+
+	def __init__(self):
+		self.clear()
+
+	def clear(self):
+		self.regs = None
+		self.mem = []
+		self.complete = False
+
+	def add(self, payload):
+		fields = payload.split(b":", 2)
+		if fields[1:2] == [b"g"]:
+			self.regs = fields[2]
+		elif fields[1:2] == [b"m"]:
+			try:
+				addr, length = (int(x, 16) for x in fields[2][:17].split(b","))
+				self.mem.append((addr, bytes.fromhex(fields[2][18:].decode())))
+			except ValueError:
+				pass
+		elif fields[1:2] == [b"end"]:
+			self.complete = True
+
+	def lookup(self, payload):
+		"""Returns the reply to 'g' or 'maddr,len' or None if not cached."""
+		if payload == b"g":
+			return self.regs
+		if payload[:1] == b"m":
+			try:
+				addr, length = (int(x, 16) for x in payload[1:].split(b","))
+			except ValueError:
+				return None
+			for (base, data) in self.mem:
+				if base <= addr and addr + length <= base + len(data):
+					return data[addr - base:addr - base + length].hex().encode()
+		return None
+
+def read_only(payload):
+	"""Packets that don't change the target state keep the cache."""
+	if payload[:1] in (b"g", b"m", b"p", b"?"):
+		return True
+	return payload[:1] == b"q" and not payload.startswith(b"qRcmd")
+
+class Proxy:
+
+	def __init__(self, ser, stack, code):
+		self.ser = ser
+		self.stack = stack
+		self.code = code
+		self.stub_rx = Parser()
+		self.cache = Cache()
+		self.pending = False # push may still be coming
+		self.to_stub = b""   # last packet to the stub, resent on '-'
+		self.to_gdb = b""    # last packet to gdb, resent on '-'
+		self.conn = None
+		self.hits = 0
+		self.misses = 0
+
+	def enable_push(self):
+		"""Sends QRpiStopPush and waits for the reply."""
+		self.ser.write(frame(b"$", b"QRpiStopPush:%x,%x" % (self.stack, self.code)))
+		end = time.time() + 2.0
+		while time.time() < end:
+			for (kind, payload) in self.stub_rx.feed(self.ser.read(64)):
+				if kind == "$":
+					self.ser.write(b"+")
+					if payload != b"OK":
+						print("stub doesn't support QRpiStopPush, just forwarding")
+					return
+		print("no reply to QRpiStopPush, just forwarding")
+
+	def gdb_send(self, payload):
+		self.to_gdb = frame(b"$", payload)
+		self.conn.sendall(self.to_gdb)
+
+	def stub_input(self, data):
+		for (kind, payload) in self.stub_rx.feed(data):
+			if kind == "-":
+				self.ser.write(self.to_stub)
+			elif kind == "$":
+				self.ser.write(b"+")
+				if payload[:1] in (b"T", b"S"):
+					self.cache.clear()
+					self.pending = True
+				if self.conn:
+					self.gdb_send(payload)
+			elif kind == "bad$":
+				self.ser.write(b"-")
+			elif kind == "%" and payload.startswith(b"RpiStop:"):
+				self.cache.add(payload)
+				if self.cache.complete:
+					self.pending = False
+			# '+' acks and other notifications are dropped
+
+	def wait_push(self):
+		end = time.time() + PUSH_WAIT
+		while self.pending and time.time() < end:
+			self.stub_input(self.ser.read(max(1, self.ser.in_waiting)))
+		self.pending = False
+
+	def gdb_packet(self, payload):
+		if payload[:1] in (b"g", b"m"):
+			if self.pending:
+				self.wait_push()
+			reply = self.cache.lookup(payload)
+			if reply is not None:
+				self.hits += 1
+				self.gdb_send(reply)
+				return
+			self.misses += 1
+		if not read_only(payload):
+			self.cache.clear()
+			self.pending = False
+		self.to_stub = frame(b"$", payload)
+		self.ser.write(self.to_stub)
+
+	def gdb_input(self, parser, data):
+		for (kind, payload) in parser.feed(data):
+			if kind == "-":
+				self.conn.sendall(self.to_gdb)
+			elif kind == "^C":
+				self.ser.write(b"\x03")
+			elif kind == "$":
+				self.conn.sendall(b"+")
+				self.gdb_packet(payload)
+			elif kind == "bad$":
+				self.conn.sendall(b"-")
+
+	def serve(self, conn):
+		self.conn = conn
+		parser = Parser()
+		while True:
+			ready, _, _ = select.select([conn, self.ser], [], [])
+			if self.ser in ready:
+				self.stub_input(self.ser.read(max(1, self.ser.in_waiting)))
+			if conn in ready:
+				data = conn.recv(4096)
+				if not data:
+					break
+				self.gdb_input(parser, data)
+		self.conn = None
+
+def main():
+	ap = argparse.ArgumentParser(description="Caching gdb proxy for rpi_stub")
+	ap.add_argument("port")
+	ap.add_argument("-b", "--baud", type=int, default=115200)
+	ap.add_argument("-l", "--listen", type=int, default=2159,
+			help="TCP port for gdb (default 2159)")
+	ap.add_argument("-s", "--stack", type=lambda s: int(s, 0), default=256,
+			help="stack bytes to push from sp (default 256)")
+	ap.add_argument("-c", "--code", type=lambda s: int(s, 0), default=64,
+			help="code bytes to push around pc (default 64)")
+	args = ap.parse_args()
+
+	ser = serial.Serial(args.port, args.baud, timeout=0.05)
+	proxy = Proxy(ser, args.stack, args.code)
+	proxy.enable_push()
+	srv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	srv.bind(("localhost", args.listen))
+	srv.listen(1)
+	while True:
+		print("waiting for gdb on port %d" % args.listen)
+		conn, _ = srv.accept()
+		proxy.serve(conn)
+		conn.close()
+		print("gdb disconnected: %d reads from the cache, %d from the target" %
+				(proxy.hits, proxy.misses))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,362 @@
+# rpi_stub.py
+#
+# Copyright (C) 2015 Juha Aaltonen
+#
+# This file is part of standalone gdb stub for Raspberry Pi 2B.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Host side helpers for the stub. Load into gdb with:
+#   (gdb) source rpi_stub.py
+
+import struct
+import gdb
+
+# fetch size per packet (the reply is escaped binary)
+XFER_CHUNK = 0x300
+
+def send_packet(pkt):
+	reply = gdb.selected_inferior().connection.send_packet(pkt)
+	if isinstance(reply, str):
+		reply = reply.encode('latin-1')
+	return reply
+
+def unescape(data):
+	out = bytearray()
+	i = 0
+	while i < len(data):
+		if data[i] == 0x7d:
+			i += 1
+			out.append(data[i] ^ 0x20)
+		else:
+			out.append(data[i])
+		i += 1
+	return bytes(out)
+
+def lz4_block_decode(src, out_len):
+	dst = bytearray()
+	i = 0
+	while i < len(src):
+		token = src[i]
+		i += 1
+		lit = token >> 4
+		if lit == 15:
+			while True:
+				b = src[i]
+				i += 1
+				lit += b
+				if b != 255:
+					break
+		dst += src[i:i + lit]
+		i += lit
+		if i >= len(src):
+			break # last sequence has only literals
+		offset = src[i] | (src[i + 1] << 8)
+		i += 2
+		mlen = token & 15
+		if mlen == 15:
+			while True:
+				b = src[i]
+				i += 1
+				mlen += b
+				if b != 255:
+					break
+		mlen += 4
+		start = len(dst) - offset
+		for k in range(mlen): # may overlap
+			dst.append(dst[start + k])
+	if len(dst) != out_len:
+		raise gdb.GdbError("corrupted page in core dump")
+	return bytes(dst)
+
+def xfer_read(obj, annex=""):
+	"""Reads a whole qXfer object from the stub."""
+	data = bytearray()
+	while True:
+		reply = send_packet("qXfer:%s:read:%s:%x,%x" % (obj, annex, len(data), XFER_CHUNK))
+		if reply[:1] == b'l':
+			data += unescape(reply[1:])
+			return bytes(data)
+		if reply[:1] != b'm':
+			raise gdb.GdbError("qXfer:%s failed: %s" % (obj, reply.decode('latin-1')))
+		data += unescape(reply[1:])
+
+# multi-area memory access (qRpiMemRead / QRpiMemWrite)
+# limits from the stub packet buffer (1024 bytes)
+MULTI_MAX_REQ = 1000
+MULTI_MAX_REPLY = (1024 - 5) // 2
+
+def _batches(items, req_len, reply_len):
+	batch = []
+	req = reply = 0
+	for item in items:
+		r, n = req_len(item), reply_len(item)
+		if batch and (req + r > MULTI_MAX_REQ or reply + n > MULTI_MAX_REPLY):
+			yield batch
+			batch = []
+			req = reply = 0
+		batch.append(item)
+		req += r
+		reply += n
+	if batch:
+		yield batch
+
+def read_multi(areas):
+	"""Reads a list of (addr, length) areas with as few round trips as
+possible. Returns a list of bytes objects in the same order."""
+	result = []
+	for batch in _batches(areas, lambda a: 20, lambda a: a[1]):
+		pkt = "qRpiMemRead:" + ";".join("%x,%x" % (a, n) for (a, n) in batch)
+		reply = send_packet(pkt)
+		if reply == b"":
+			# old stub - one area at a time
+			inf = gdb.selected_inferior()
+			result += [bytes(inf.read_memory(a, n)) for (a, n) in batch]
+			continue
+		if reply[:1] == b"E":
+			raise gdb.GdbError("qRpiMemRead failed: %s" % reply.decode())
+		data = bytes.fromhex(reply.decode())
+		pos = 0
+		for (a, n) in batch:
+			result.append(data[pos:pos + n])
+			pos += n
+	return result
+
+def write_multi(areas):
+	"""Writes a list of (addr, bytes) areas with as few round trips as
+possible."""
+	for batch in _batches(areas, lambda a: 20 + 2 * len(a[1]), lambda a: 0):
+		pkt = "QRpiMemWrite:" + ";".join("%x,%x:%s" % (a, len(d), d.hex())
+				for (a, d) in batch)
+		reply = send_packet(pkt)
+		if reply == b"":
+			inf = gdb.selected_inferior()
+			for (a, d) in batch:
+				inf.write_memory(a, d)
+		elif reply != b"OK":
+			raise gdb.GdbError("QRpiMemWrite failed: %s" % reply.decode())
+
+class RpiReadMulti(gdb.Command):
+	"""Read several memory areas in one exchange: rpi-read-multi ADDR LEN...
+Prints each area in hex."""
+
+	def __init__(self):
+		super(RpiReadMulti, self).__init__("rpi-read-multi", gdb.COMMAND_DATA)
+
+	def invoke(self, arg, from_tty):
+		argv = gdb.string_to_argv(arg)
+		if len(argv) == 0 or len(argv) % 2:
+			raise gdb.GdbError("usage: rpi-read-multi ADDR LEN [ADDR LEN]...")
+		areas = [(int(gdb.parse_and_eval(argv[i])), int(gdb.parse_and_eval(argv[i + 1])))
+				for i in range(0, len(argv), 2)]
+		for ((a, n), data) in zip(areas, read_multi(areas)):
+			print("0x%08x: %s" % (a, data.hex()))
+
+# call stack unwound on the target (qRpiBacktrace)
+def backtrace(max_frames=0):
+	"""Returns the call stack of the stopped debuggee as a list of
+(pc, sp) tuples, the innermost first."""
+	pkt = "qRpiBacktrace"
+	if max_frames:
+		pkt += ":%x" % max_frames
+	reply = send_packet(pkt)
+	if reply == b"E02":
+		# qSymbol didn't give the table location - try the symbols here
+		try:
+			start = int(gdb.parse_and_eval("&__exidx_start"))
+			end = int(gdb.parse_and_eval("&__exidx_end"))
+		except gdb.error:
+			raise gdb.GdbError("no .ARM.exidx table (__exidx_start/__exidx_end)")
+		gdb.execute("monitor unwind-tables 0x%x 0x%x" % (start, end), to_string=True)
+		reply = send_packet(pkt)
+	if reply == b"" or reply[:1] == b"E":
+		raise gdb.GdbError("qRpiBacktrace failed: %s" % reply.decode())
+	return [tuple(int(x, 16) for x in f.split(","))
+			for f in reply.decode().split(";")]
+
+class RpiBacktrace(gdb.Command):
+	"""Backtrace unwound on the target: rpi-bt [MAX]
+The stub walks the stack with the program's EHABI tables (.ARM.exidx),
+so the whole backtrace comes in one packet."""
+
+	def __init__(self):
+		super(RpiBacktrace, self).__init__("rpi-bt", gdb.COMMAND_STACK)
+
+	def invoke(self, arg, from_tty):
+		max_frames = int(gdb.parse_and_eval(arg)) if arg else 0
+		for (n, (pc, sp)) in enumerate(backtrace(max_frames)):
+			name = "??"
+			block = gdb.block_for_pc(pc)
+			while block is not None and block.function is None:
+				block = block.superblock
+			if block is not None:
+				name = block.function.print_name
+			sal = gdb.find_pc_line(pc)
+			where = ""
+			if sal.symtab is not None:
+				where = " at %s:%d" % (sal.symtab.filename, sal.line)
+			print("#%-2d 0x%08x in %s (sp=0x%08x)%s" % (n, pc, name, sp, where))
+
+# execution budget (monitor run-for) and bisection with it
+class RpiRestart(gdb.Parameter):
+	"""Command that puts the debuggee back to its starting state for
+rpi-bisect. The default reloads the program."""
+	set_doc = "Set the restart command for rpi-bisect."
+	show_doc = "Show the restart command for rpi-bisect."
+
+	def __init__(self):
+		super(RpiRestart, self).__init__("rpi-restart", gdb.COMMAND_RUNNING,
+				gdb.PARAM_STRING)
+		self.value = "load"
+
+def run_for(count, kind):
+	"""Runs the debuggee from the current state for about count
+instructions/cycles. Returns the amount actually executed."""
+	gdb.execute("monitor run-for %d %s" % (count, kind), to_string=True)
+	gdb.execute("continue", to_string=True)
+	out = gdb.execute("monitor run-for", to_string=True)
+	gdb.execute("monitor run-for off", to_string=True)
+	words = out.split()
+	if len(words) < 3 or words[1] != "used:":
+		raise gdb.GdbError("rpi-bisect: unexpected run-for state: " + out)
+	return int(words[2])
+
+class RpiBisect(gdb.Command):
+	"""Find when an expression becomes true: rpi-bisect LO HI EXPR [cycles]
+The program is restarted with the 'rpi-restart' command (default 'load')
+and run for a budget of instructions (or cycles) before EXPR is evaluated.
+EXPR must be false after LO and true after HI instructions. The run must
+be repeatable and the restart must restore the memory that EXPR uses."""
+
+	def __init__(self):
+		super(RpiBisect, self).__init__("rpi-bisect", gdb.COMMAND_RUNNING)
+
+	def invoke(self, arg, from_tty):
+		argv = gdb.string_to_argv(arg)
+		kind = "insns"
+		if len(argv) == 4 and argv[3] in ("insns", "cycles"):
+			kind = argv.pop()
+		if len(argv) != 3:
+			raise gdb.GdbError("usage: rpi-bisect LO HI EXPR [insns|cycles]")
+		lo = int(gdb.parse_and_eval(argv[0]))
+		hi = int(gdb.parse_and_eval(argv[1]))
+		restart = gdb.parameter("rpi-restart")
+		runs = 0
+		while hi - lo > 1:
+			mid = (lo + hi) // 2
+			gdb.execute(restart, to_string=True)
+			used = run_for(mid, kind)
+			runs += 1
+			# the stop comes a bit after the budget - use what was counted
+			if bool(gdb.parse_and_eval(argv[2])):
+				hi = max(lo + 1, min(used, hi - 1))
+			else:
+				lo = min(hi - 1, max(used, lo + 1))
+			print("%d runs: between %d and %d %s" % (runs, lo, hi, kind))
+		print("'%s' becomes true after %d %s" % (argv[2], hi, kind))
+
+class RpiCoredump(gdb.Command):
+	"""Write a core file of the debuggee: rpi-coredump FILE [ADDR LEN]...
+The dump is compressed on the target. Without ranges, all RAM below
+the stub is dumped. Load with 'set osabi GNU/Linux' and 'core FILE'."""
+
+	def __init__(self):
+		super(RpiCoredump, self).__init__("rpi-coredump", gdb.COMMAND_FILES)
+
+	def invoke(self, arg, from_tty):
+		argv = gdb.string_to_argv(arg)
+		if len(argv) < 1:
+			raise gdb.GdbError("usage: rpi-coredump FILE [ADDR LEN]...")
+		gdb.execute("monitor coredump " + " ".join(argv[1:]), to_string=True)
+		stream = xfer_read("rpi-core")
+		if stream[:8] != b"RPICORE1":
+			raise gdb.GdbError("bad core dump header")
+		prefix_len = struct.unpack_from("<I", stream, 8)[0]
+		prefix = stream[12:12 + prefix_len]
+		# PT_LOAD segments: vaddr -> file offset
+		phoff, = struct.unpack_from("<I", prefix, 28)
+		phnum, = struct.unpack_from("<H", prefix, 44)
+		segs = []
+		end = prefix_len
+		for n in range(phnum):
+			p_type, p_offset, p_vaddr, p_paddr, p_filesz = \
+				struct.unpack_from("<5I", prefix, phoff + 32 * n)
+			if p_type == 1:
+				segs.append((p_vaddr, p_filesz, p_offset))
+				end = max(end, p_offset + p_filesz)
+		pages = 0
+		with open(argv[0], "wb") as f:
+			f.write(prefix)
+			f.truncate(end) # zero pages stay as holes
+			i = 12 + prefix_len
+			while True:
+				vaddr, info = struct.unpack_from("<II", stream, i)
+				i += 8
+				if vaddr == 0xffffffff:
+					break
+				size = info & 0xffff
+				page = stream[i:i + size]
+				i += size
+				if not (info & (1 << 31)):
+					page = lz4_block_decode(page, 4096)
+				for (start, length, offset) in segs:
+					if start <= vaddr < start + length:
+						f.seek(offset + vaddr - start)
+						f.write(page)
+						break
+				pages += 1
+		print("%d bytes transferred, %d non-zero pages" % (len(stream), pages))
+
+# compressed memory reads (qXfer:rpi-mem)
+MEMDUMP_BLOCK = 4096
+
+def read_compressed(addr, length):
+	"""Reads a memory area, LZ4-compressed on the target."""
+	stream = xfer_read("rpi-mem", "%x,%x" % (addr, length))
+	out = bytearray()
+	i = 0
+	while len(out) < length:
+		info, = struct.unpack_from("<I", stream, i)
+		i += 4
+		size = info & 0xffff
+		block = stream[i:i + size]
+		i += size
+		if info & (1 << 31):
+			out += block
+		else:
+			out += lz4_block_decode(block, min(MEMDUMP_BLOCK, length - len(out)))
+	return bytes(out), len(stream)
+
+class RpiDump(gdb.Command):
+	"""Dump memory to a file, compressed on the target: rpi-dump FILE ADDR LEN"""
+
+	def __init__(self):
+		super(RpiDump, self).__init__("rpi-dump", gdb.COMMAND_DATA)
+
+	def invoke(self, arg, from_tty):
+		argv = gdb.string_to_argv(arg)
+		if len(argv) != 3:
+			raise gdb.GdbError("usage: rpi-dump FILE ADDR LEN")
+		addr = int(gdb.parse_and_eval(argv[1]))
+		length = int(gdb.parse_and_eval(argv[2]))
+		data, sent = read_compressed(addr, length)
+		with open(argv[0], "wb") as f:
+			f.write(data)
+		print("%d bytes dumped, %d bytes transferred" % (len(data), sent))
+
+RpiCoredump()
+RpiDump()
+RpiReadMulti()
+RpiBacktrace()
+RpiRestart()
+RpiBisect()
@@ -0,0 +1,215 @@
+# rpi_upload.py
+#
+# Copyright (C) 2015 Juha Aaltonen
+#
+# This file is part of standalone gdb stub for Raspberry Pi 2B.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+# Pipelined program upload (QRpiWinWrite). Writes the loadable segments of
+# an ELF file, or a raw binary, with several packets in flight, so the UART
+# is kept busy in both directions. Run it before gdb connects:
+#   python3 rpi_upload.py /dev/ttyUSB0 prog.elf
+# and then in gdb 'file prog.elf' and 'target remote /dev/ttyUSB0' - no 'load'.
+# Needs pyserial.
+
+import argparse
+import struct
+import sys
+import time
+import serial
+
+# payload limit from the stub packet buffer (1024 bytes)
+MAX_PAYLOAD = 1000
+# the stub's UART receive ring (SER_RX_BUFF_SIZE in serial.c) - the packets
+# in flight must fit in it, or the ring overruns and they have to be resent
+RX_RING = 4096
+# resend the oldest unacked packet if nothing comes in this time (seconds)
+RESEND_TIMEOUT = 1.0
+MAX_RESENDS = 10
+
+def read_segments(path, addr):
+	"""Returns the areas to write as a list of (addr, bytes)."""
+	with open(path, "rb") as f:
+		image = f.read()
+	if image[:4] != b"\x7fELF":
+		if addr is None:
+			raise SystemExit("%s: not an ELF file, give the load address" % path)
+		return [(addr, image)]
+	phoff, = struct.unpack_from("<I", image, 28)
+	phentsize, phnum = struct.unpack_from("<HH", image, 42)
+	segs = []
+	for n in range(phnum):
+		p_type, p_offset, p_vaddr, p_paddr, p_filesz = \
+			struct.unpack_from("<5I", image, phoff + phentsize * n)
+		if p_type == 1 and p_filesz > 0:
+			# load address, as in gdb 'load'
+			segs.append((p_paddr, image[p_offset:p_offset + p_filesz]))
+	return segs
+
+def escape_byte(b):
+	if b in (0x23, 0x24, 0x2a, 0x7d): # '#', '$', '*', '}'
+		return bytes((0x7d, b ^ 0x20))
+	return bytes((b,))
+
+def make_packets(segs):
+	"""Splits the areas into QRpiWinWrite packets. Sequence number = index."""
+	packets = []
+	for (addr, data) in segs:
+		pos = 0
+		while pos < len(data):
+			# header length with the longest numbers
+			room = MAX_PAYLOAD - len("QRpiWinWrite:ffffffff,ffffffff,ffffffff:")
+			body = bytearray()
+			n = 0
+			while pos + n < len(data):
+				esc = escape_byte(data[pos + n])
+				if len(body) + len(esc) > room:
+					break
+				body += esc
+				n += 1
+			head = "QRpiWinWrite:%x,%x,%x:" % (len(packets), addr + pos, n)
+			packets.append(head.encode() + bytes(body))
+			pos += n
+	return packets
+
+class Link:
+	"""Packet framing on the serial line."""
+
+	def __init__(self, port, baud):
+		self.ser = serial.Serial(port, baud, timeout=0.05)
+		self.rx = bytearray()
+
+	def send(self, payload):
+		csum = sum(payload) & 0xff
+		self.ser.write(b"$" + payload + b"#%02x" % csum)
+
+	def reply(self, timeout):
+		"""Returns the next good reply payload, or None on timeout."""
+		end = time.time() + timeout
+		while True:
+			# '+' acks of our packets (and noise) before '$' are dropped
+			start = self.rx.find(b"$")
+			del self.rx[:start if start >= 0 else len(self.rx)]
+			hash_pos = self.rx.find(b"#")
+			if start >= 0 and hash_pos >= 0 and len(self.rx) >= hash_pos + 3:
+				payload = bytes(self.rx[1:hash_pos])
+				csum = bytes(self.rx[hash_pos + 1:hash_pos + 3])
+				del self.rx[:hash_pos + 3]
+				try:
+					good = int(csum, 16) == sum(payload) & 0xff
+				except ValueError:
+					good = False
+				self.ser.write(b"+" if good else b"-")
+				if good:
+					return payload
+				continue
+			if time.time() > end:
+				return None
+			self.rx += self.ser.read(max(1, self.ser.in_waiting))
+
+def parse_ack(reply):
+	"""A<base>[;N<seq>...][;W<size>] -> (base, [nak seqs], window)"""
+	base, naks, window = None, [], None
+	for field in reply.decode("latin-1").split(";"):
+		if field[:1] == "A":
+			base = int(field[1:], 16)
+		elif field[:1] == "N":
+			naks.append(int(field[1:], 16))
+		elif field[:1] == "W":
+			window = int(field[1:], 16)
+	return base, naks, window
+
+def monitor(link, cmd):
+	"""Runs a monitor command, returns True if it succeeded."""
+	link.send(b"qRcmd," + cmd.encode().hex().encode())
+	while True:
+		reply = link.reply(RESEND_TIMEOUT)
+		if reply is None or reply[:1] == b"E":
+			return False
+		if reply == b"OK":
+			return True
+		# the console output ('O' packets) is skipped
+
+def upload(link, packets, window):
+	for tries in range(3):
+		link.send(b"QRpiWinStart")
+		reply = link.reply(RESEND_TIMEOUT)
+		if reply is not None:
+			break
+	if not reply or reply[:1] != b"A":
+		raise SystemExit("the stub doesn't support QRpiWinWrite (reply %r)" % reply)
+	_, _, stub_window = parse_ack(reply)
+	window = min(window, stub_window)
+	total = len(packets)
+	base = 0 # all before this are acked
+	nxt = 0 # next packet not sent yet
+	resends = 0
+	stalls = 0
+	while base < total:
+		# '$', '#' and the checksum digits come with each packet
+		inflight = sum(len(p) + 4 for p in packets[base:nxt])
+		while nxt < total and nxt < base + window and \
+				(nxt == base or inflight + len(packets[nxt]) + 4 <= RX_RING):
+			link.send(packets[nxt])
+			inflight += len(packets[nxt]) + 4
+			nxt += 1
+		reply = link.reply(RESEND_TIMEOUT)
+		if reply is None:
+			# lost packet or lost reply - resend the oldest
+			stalls += 1
+			if stalls > MAX_RESENDS:
+				raise SystemExit("no reply from the stub")
+			link.send(packets[base])
+			resends += 1
+			continue
+		if reply[:1] != b"A":
+			raise SystemExit("write failed: %s" % reply.decode("latin-1"))
+		stalls = 0
+		ack, naks, _ = parse_ack(reply)
+		base = max(base, ack)
+		for seq in naks:
+			if base <= seq < nxt:
+				link.send(packets[seq])
+				resends += 1
+	return resends
+
+def main():
+	ap = argparse.ArgumentParser(description="Pipelined upload to rpi_stub")
+	ap.add_argument("port")
+	ap.add_argument("file")
+	ap.add_argument("-b", "--baud", type=int, default=115200)
+	ap.add_argument("-a", "--addr", type=lambda s: int(s, 0),
+			help="load address of a raw binary")
+	ap.add_argument("-w", "--window", type=int, default=4,
+			help="packets in flight (default 4, as many as fit in the stub's "
+			"%d-byte receive ring)" % RX_RING)
+	ap.add_argument("-p", "--pipeline", action="store_true",
+			help="write on the stub's other cores (monitor loadpipe on)")
+	args = ap.parse_args()
+
+	segs = read_segments(args.file, args.addr)
+	packets = make_packets(segs)
+	size = sum(len(d) for (a, d) in segs)
+	link = Link(args.port, args.baud)
+	if args.pipeline and not monitor(link, "loadpipe on"):
+		print("the stub couldn't start the load pipeline, writing on core 0")
+	start = time.time()
+	resends = upload(link, packets, max(1, args.window))
+	secs = time.time() - start
+	print("%d bytes in %d packets, %.2f s (%.0f bytes/s), %d resent" %
+			(size, len(packets), secs, size / max(secs, 0.001), resends))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,387 @@
+/*
+semihost.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// ARM semihosting
+// The semihosting calls (svc 0x123456, thumb svc 0xab or bkpt 0xab)
+// are translated into gdb File-I/O requests. The debuggee buffers are
+// given to gdb as such, so gdb moves the file data with X-packets
+// (and x-packets, if gdb supports binary upload) directly to/from
+// the debuggee memory - no copying or hex-conversion in the stub.
+// Calls that don't need the host are handled here, and so are the
+// writes to the channel handles (":chan1" - ":chan4", see chan.c).
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "semihost.h"
+#include "chan.h"
+#include "log.h"
+
+// gdb File-I/O open flags and mode
+#define FIO_O_RDONLY 0x0
+#define FIO_O_WRONLY 0x1
+#define FIO_O_RDWR 0x2
+#define FIO_O_APPEND 0x8
+#define FIO_O_CREAT 0x200
+#define FIO_O_TRUNC 0x400
+#define FIO_MODE_DEFAULT 0x1a4 // 0644
+
+// offset of st_size (64-bit big-endian) in gdb File-I/O struct stat
+#define FIO_STAT_SIZE_OFFS 28
+#define FIO_STAT_LEN 64
+
+// open modes "r", "rb", "r+", "r+b", "w", "wb", "w+", "w+b", "a", ...
+static const uint32_t semihost_open_flags[12] =
+{
+	FIO_O_RDONLY, FIO_O_RDONLY,
+	FIO_O_RDWR, FIO_O_RDWR,
+	FIO_O_WRONLY | FIO_O_CREAT | FIO_O_TRUNC, FIO_O_WRONLY | FIO_O_CREAT | FIO_O_TRUNC,
+	FIO_O_RDWR | FIO_O_CREAT | FIO_O_TRUNC, FIO_O_RDWR | FIO_O_CREAT | FIO_O_TRUNC,
+	FIO_O_WRONLY | FIO_O_CREAT | FIO_O_APPEND, FIO_O_WRONLY | FIO_O_CREAT | FIO_O_APPEND,
+	FIO_O_RDWR | FIO_O_CREAT | FIO_O_APPEND, FIO_O_RDWR | FIO_O_CREAT | FIO_O_APPEND
+};
+
+static int semihost_op = -1; // pending operation, -1 = none
+static uint32_t semihost_count; // requested byte count of read/write
+static int semihost_errno = 0; // errno from the last 'F'-reply
+static uint32_t semihost_status = 0; // exit status
+
+// gdb writes the results of some calls here (readc, fstat, gettimeofday)
+static volatile uint8_t semihost_buff[FIO_STAT_LEN];
+
+// append ',' (or other separator) and a hex number to a request
+static int semihost_add_param(char *packet, char *sep, uint32_t value, int max)
+{
+	char scratchpad[16];
+
+	util_append_str(packet, sep, max);
+	util_word_to_hex(scratchpad, value);
+	return util_append_str(packet, scratchpad, max);
+}
+
+// big-endian word from gdb File-I/O structures
+static uint32_t semihost_get_be32(volatile uint8_t *p)
+{
+	return (((uint32_t)p[0]) << 24) | (((uint32_t)p[1]) << 16)
+			| (((uint32_t)p[2]) << 8) | ((uint32_t)p[3]);
+}
+
+// build request, returns SEMIHOST_DONE if handled locally
+int semihost_request(char *packet, int max, int *len)
+{
+	uint32_t op;
+	uint32_t *param;
+	uint32_t tmp;
+	char *p;
+	int retval = SEMIHOST_FILEIO;
+
+	// bkpt-style call stops at the bkpt - step over it
+	if (exception_info == RPI2_EXC_PABT)
+	{
+		if (rpi2_reg_context.reg.cpsr & (1 << 5)) // thumb
+		{
+			rpi2_reg_context.reg.r15 += 2;
+		}
+		else
+		{
+			rpi2_reg_context.reg.r15 += 4;
+		}
+	}
+
+	op = rpi2_reg_context.reg.r0;
+	param = (uint32_t *)rpi2_reg_context.reg.r1;
+	semihost_op = (int)op;
+	*len = 0;
+	packet[0] = '\0';
+
+	LOG_PR_VAL("semihosting op: ", op);
+	LOG_PR_VAL_CONT(" param: ", (unsigned int)param);
+	LOG_NEWLINE();
+
+	switch (op)
+	{
+	case SEMIHOST_SYS_OPEN:
+		// {path, mode, path length}
+		p = (char *)param[0];
+		if ((param[2] == 3) && (util_cmp_substr(p, ":tt") == 3))
+		{
+			// console: stdin for reading, stdout for writing, stderr for appending
+			if (param[1] < 4) rpi2_reg_context.reg.r0 = 0;
+			else if (param[1] < 8) rpi2_reg_context.reg.r0 = 1;
+			else rpi2_reg_context.reg.r0 = 2;
+			retval = SEMIHOST_DONE;
+			break;
+		}
+		if ((param[2] == 6) && (util_cmp_substr(p, ":chan") == 5)
+				&& (p[5] >= '1') && (p[5] < '1' + CHAN_NUM))
+		{
+			rpi2_reg_context.reg.r0 = CHAN_HANDLE_BASE + (p[5] - '0');
+			retval = SEMIHOST_DONE;
+			break;
+		}
+		if (param[1] > 11)
+		{
+			rpi2_reg_context.reg.r0 = (uint32_t)(-1);
+			retval = SEMIHOST_DONE;
+			break;
+		}
+		util_str_copy(packet, "Fopen", max);
+		semihost_add_param(packet, ",", param[0], max);
+		semihost_add_param(packet, "/", param[2] + 1, max); // with the end-nul
+		semihost_add_param(packet, ",", semihost_open_flags[param[1]], max);
+		*len = semihost_add_param(packet, ",", FIO_MODE_DEFAULT, max);
+		break;
+	case SEMIHOST_SYS_CLOSE:
+		if (param[0] > CHAN_HANDLE_BASE)
+		{
+			rpi2_reg_context.reg.r0 = 0;
+			retval = SEMIHOST_DONE;
+			break;
+		}
+		util_str_copy(packet, "Fclose", max);
+		*len = semihost_add_param(packet, ",", param[0], max);
+		break;
+	case SEMIHOST_SYS_WRITEC:
+		// r1 points to the character
+		util_str_copy(packet, "Fwrite,1", max);
+		semihost_add_param(packet, ",", (uint32_t)param, max);
+		*len = semihost_add_param(packet, ",", 1, max);
+		break;
+	case SEMIHOST_SYS_WRITE0:
+		// r1 points to the string
+		util_str_copy(packet, "Fwrite,1", max);
+		semihost_add_param(packet, ",", (uint32_t)param, max);
+		*len = semihost_add_param(packet, ",", util_str_len((char *)param), max);
+		break;
+	case SEMIHOST_SYS_WRITE:
+		// {fd, buffer, count}
+		if (param[0] > CHAN_HANDLE_BASE)
+		{
+			// queued without stopping - returns the count not written
+			rpi2_reg_context.reg.r0 = param[2] - (uint32_t)chan_write(
+					(int)(param[0] - CHAN_HANDLE_BASE), (char *)param[1], (int)param[2]);
+			retval = SEMIHOST_DONE;
+			break;
+		}
+		semihost_count = param[2];
+		util_str_copy(packet, "Fwrite", max);
+		semihost_add_param(packet, ",", param[0], max);
+		semihost_add_param(packet, ",", param[1], max);
+		*len = semihost_add_param(packet, ",", param[2], max);
+		break;
+	case SEMIHOST_SYS_READ:
+		// {fd, buffer, count}
+		semihost_count = param[2];
+		util_str_copy(packet, "Fread", max);
+		semihost_add_param(packet, ",", param[0], max);
+		semihost_add_param(packet, ",", param[1], max);
+		*len = semihost_add_param(packet, ",", param[2], max);
+		break;
+	case SEMIHOST_SYS_READC:
+		util_str_copy(packet, "Fread,0", max);
+		semihost_add_param(packet, ",", (uint32_t)semihost_buff, max);
+		*len = semihost_add_param(packet, ",", 1, max);
+		break;
+	case SEMIHOST_SYS_ISERROR:
+		rpi2_reg_context.reg.r0 = (((int)param[0]) < 0) ? 1 : 0;
+		retval = SEMIHOST_DONE;
+		break;
+	case SEMIHOST_SYS_ISTTY:
+		util_str_copy(packet, "Fisatty", max);
+		*len = semihost_add_param(packet, ",", param[0], max);
+		break;
+	case SEMIHOST_SYS_SEEK:
+		// {fd, absolute position}
+		util_str_copy(packet, "Flseek", max);
+		semihost_add_param(packet, ",", param[0], max);
+		semihost_add_param(packet, ",", param[1], max);
+		*len = semihost_add_param(packet, ",", 0, max); // SEEK_SET
+		break;
+	case SEMIHOST_SYS_FLEN:
+		util_str_copy(packet, "Ffstat", max);
+		semihost_add_param(packet, ",", param[0], max);
+		*len = semihost_add_param(packet, ",", (uint32_t)semihost_buff, max);
+		break;
+	case SEMIHOST_SYS_REMOVE:
+		// {path, path length}
+		util_str_copy(packet, "Funlink", max);
+		semihost_add_param(packet, ",", param[0], max);
+		*len = semihost_add_param(packet, "/", param[1] + 1, max);
+		break;
+	case SEMIHOST_SYS_RENAME:
+		// {old path, old length, new path, new length}
+		util_str_copy(packet, "Frename", max);
+		semihost_add_param(packet, ",", param[0], max);
+		semihost_add_param(packet, "/", param[1] + 1, max);
+		semihost_add_param(packet, ",", param[2], max);
+		*len = semihost_add_param(packet, "/", param[3] + 1, max);
+		break;
+	case SEMIHOST_SYS_CLOCK:
+		// centiseconds
+		rpi2_reg_context.reg.r0 = *((volatile uint32_t *)SYSTMR_CLO) / 10000;
+		retval = SEMIHOST_DONE;
+		break;
+	case SEMIHOST_SYS_TIME:
+		util_str_copy(packet, "Fgettimeofday", max);
+		semihost_add_param(packet, ",", (uint32_t)semihost_buff, max);
+		*len = semihost_add_param(packet, ",", 0, max);
+		break;
+	case SEMIHOST_SYS_SYSTEM:
+		// {command, command length}
+		util_str_copy(packet, "Fsystem", max);
+		semihost_add_param(packet, ",", param[0], max);
+		*len = semihost_add_param(packet, "/", param[1] + 1, max);
+		break;
+	case SEMIHOST_SYS_ERRNO:
+		rpi2_reg_context.reg.r0 = (uint32_t)semihost_errno;
+		retval = SEMIHOST_DONE;
+		break;
+	case SEMIHOST_SYS_GET_CMDLINE:
+		// {buffer, buffer length} - no command line
+		if (param[1] > 0)
+		{
+			*((char *)param[0]) = '\0';
+		}
+		param[1] = 0;
+		rpi2_reg_context.reg.r0 = 0;
+		retval = SEMIHOST_DONE;
+		break;
+	case SEMIHOST_SYS_HEAPINFO:
+		// r1 points to a pointer to 4-word block - zeros = use defaults
+		param = (uint32_t *)param[0];
+		for (tmp = 0; tmp < 4; tmp++)
+		{
+			param[tmp] = 0;
+		}
+		retval = SEMIHOST_DONE;
+		break;
+	case SEMIHOST_SYS_EXIT:
+		// reason code in r1 (32-bit ARM)
+		semihost_status = ((uint32_t)param == SEMIHOST_APPLICATION_EXIT) ? 0 : 1;
+		retval = SEMIHOST_EXIT;
+		break;
+	case SEMIHOST_SYS_EXIT_EXTENDED:
+		// {reason, subcode}
+		semihost_status = (param[0] == SEMIHOST_APPLICATION_EXIT) ? param[1] : 1;
+		retval = SEMIHOST_EXIT;
+		break;
+	case SEMIHOST_SYS_ELAPSED:
+		// 64-bit tick count to {low, high}
+		do
+		{
+			tmp = *((volatile uint32_t *)SYSTMR_CHI);
+			param[0] = *((volatile uint32_t *)SYSTMR_CLO);
+			param[1] = *((volatile uint32_t *)SYSTMR_CHI);
+		} while (tmp != param[1]); // wrapped in between
+		rpi2_reg_context.reg.r0 = 0;
+		retval = SEMIHOST_DONE;
+		break;
+	case SEMIHOST_SYS_TICKFREQ:
+		rpi2_reg_context.reg.r0 = 1000000; // system timer: 1 MHz
+		retval = SEMIHOST_DONE;
+		break;
+	case SEMIHOST_SYS_TMPNAM:
+	default:
+		// not supported
+		rpi2_reg_context.reg.r0 = (uint32_t)(-1);
+		retval = SEMIHOST_DONE;
+		break;
+	}
+	if (retval != SEMIHOST_FILEIO)
+	{
+		semihost_op = -1; // nothing pending
+	}
+	return retval;
+}
+
+// 'F'-reply: convert File-I/O result to semihosting result
+void semihost_reply(int retcode, int err)
+{
+	semihost_errno = err;
+	switch (semihost_op)
+	{
+	case SEMIHOST_SYS_WRITEC:
+	case SEMIHOST_SYS_WRITE0:
+		// r0 is corrupted by these
+		break;
+	case SEMIHOST_SYS_WRITE:
+	case SEMIHOST_SYS_READ:
+		// number of bytes NOT transferred
+		if (retcode < 0)
+		{
+			rpi2_reg_context.reg.r0 = semihost_count;
+		}
+		else
+		{
+			rpi2_reg_context.reg.r0 = semihost_count - (uint32_t)retcode;
+		}
+		break;
+	case SEMIHOST_SYS_READC:
+		if (retcode == 1)
+		{
+			rpi2_reg_context.reg.r0 = (uint32_t)semihost_buff[0];
+		}
+		else
+		{
+			rpi2_reg_context.reg.r0 = (uint32_t)(-1);
+		}
+		break;
+	case SEMIHOST_SYS_SEEK:
+		rpi2_reg_context.reg.r0 = (retcode < 0) ? (uint32_t)(-1) : 0;
+		break;
+	case SEMIHOST_SYS_FLEN:
+		if (retcode == 0)
+		{
+			// lower word of the 64-bit size
+			rpi2_reg_context.reg.r0 =
+					semihost_get_be32(semihost_buff + FIO_STAT_SIZE_OFFS + 4);
+		}
+		else
+		{
+			rpi2_reg_context.reg.r0 = (uint32_t)(-1);
+		}
+		break;
+	case SEMIHOST_SYS_TIME:
+		if (retcode == 0)
+		{
+			rpi2_reg_context.reg.r0 = semihost_get_be32(semihost_buff); // tv_sec
+		}
+		else
+		{
+			rpi2_reg_context.reg.r0 = (uint32_t)(-1);
+		}
+		break;
+	default:
+		// open, close, istty, remove, rename, system
+		rpi2_reg_context.reg.r0 = (uint32_t)retcode;
+		break;
+	}
+	semihost_op = -1; // done
+}
+
+int semihost_pending()
+{
+	return (semihost_op >= 0);
+}
+
+unsigned int semihost_exit_status()
+{
+	return semihost_status;
+}
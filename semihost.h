@@ -0,0 +1,71 @@
+/*
+semihost.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SEMIHOST_H_
+#define SEMIHOST_H_
+
+// ARM semihosting operation numbers (in r0, parameter in r1)
+#define SEMIHOST_SYS_OPEN 0x01
+#define SEMIHOST_SYS_CLOSE 0x02
+#define SEMIHOST_SYS_WRITEC 0x03
+#define SEMIHOST_SYS_WRITE0 0x04
+#define SEMIHOST_SYS_WRITE 0x05
+#define SEMIHOST_SYS_READ 0x06
+#define SEMIHOST_SYS_READC 0x07
+#define SEMIHOST_SYS_ISERROR 0x08
+#define SEMIHOST_SYS_ISTTY 0x09
+#define SEMIHOST_SYS_SEEK 0x0a
+#define SEMIHOST_SYS_FLEN 0x0c
+#define SEMIHOST_SYS_TMPNAM 0x0d
+#define SEMIHOST_SYS_REMOVE 0x0e
+#define SEMIHOST_SYS_RENAME 0x0f
+#define SEMIHOST_SYS_CLOCK 0x10
+#define SEMIHOST_SYS_TIME 0x11
+#define SEMIHOST_SYS_SYSTEM 0x12
+#define SEMIHOST_SYS_ERRNO 0x13
+#define SEMIHOST_SYS_GET_CMDLINE 0x15
+#define SEMIHOST_SYS_HEAPINFO 0x16
+#define SEMIHOST_SYS_EXIT 0x18
+#define SEMIHOST_SYS_EXIT_EXTENDED 0x20
+#define SEMIHOST_SYS_ELAPSED 0x30
+#define SEMIHOST_SYS_TICKFREQ 0x31
+
+// ADP_Stopped_ApplicationExit - normal exit reason
+#define SEMIHOST_APPLICATION_EXIT 0x20026
+
+// semihost_request() return values
+#define SEMIHOST_DONE 0		// handled in the stub, result is in r0
+#define SEMIHOST_FILEIO 1	// File-I/O request built, wait for 'F'-reply
+#define SEMIHOST_EXIT 2		// debuggee exits
+
+// Builds a gdb File-I/O request ('Fopen,...') from the semihosting call
+// in rpi2_reg_context into packet. The request length is returned in len.
+int semihost_request(char *packet, int max, int *len);
+
+// Completes the pending semihosting call with gdb's 'F'-reply values
+void semihost_reply(int retcode, int err);
+
+// 1 if a File-I/O request is waiting for the 'F'-reply
+int semihost_pending();
+
+// exit status given with SYS_EXIT or SYS_EXIT_EXTENDED
+unsigned int semihost_exit_status();
+
+#endif /* SEMIHOST_H_ */
@@ -22,22 +22,41 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "rpi2.h"
 #include "serial.h"
 #include "util.h"
+#include "chan.h"
 
 // I/O buffers, we write to tail and read from head
 // buffers are post-incrementing
-#define SER_RX_BUFF_SIZE 1024
+// The buffers are plain memory: the producer publishes its index
+// (STORE_RELEASE) after the data and the consumer reads it (LOAD_ACQUIRE)
+// before the data - the interrupt handler runs on the same core, so
+// that's all the ordering needed. Barriers are only for the UART.
+#define SER_RX_BUFF_SIZE 4096 // 4 windowed write packets (rpi_upload.py)
 #define SER_TX_BUFF_SIZE 1024
 
-volatile int ser_rx_head;
-volatile int ser_rx_tail;
-volatile char ser_rx_buff[SER_RX_BUFF_SIZE];
+int ser_rx_head;
+int ser_rx_tail;
+char ser_rx_buff[SER_RX_BUFF_SIZE];
 
-volatile int ser_tx_head;
-volatile int ser_tx_tail;
-volatile char ser_tx_buff[SER_TX_BUFF_SIZE];
+int ser_tx_head;
+int ser_tx_tail;
+char ser_tx_buff[SER_TX_BUFF_SIZE];
 
-volatile uint32_t ser_rx_dropped_count;
-volatile uint32_t ser_rx_ovr_count;
+// gdb packet framing of the sent bytes - channel frames go only between
+// the packets
+#define SER_PKT_OUT 0
+#define SER_PKT_DATA 1
+#define SER_PKT_SUM1 2
+#define SER_PKT_SUM2 3
+static int ser_tx_pkt = SER_PKT_OUT;
+
+// channel frame being sent
+static char ser_frame[CHAN_FRAME_LEN];
+static int ser_frame_len = 0;
+static int ser_frame_pos = 0;
+
+// written in the interrupt handler, read with the interrupts disabled
+uint32_t ser_rx_dropped_count;
+uint32_t ser_rx_ovr_count;
 
 volatile int ser_handle_ctrlc = 0;
 void (*ser_ctrlc_handler)();
@@ -47,6 +66,7 @@ void serial_irq();
 void serial_rx();
 void serial_tx();
 void serial_poll();
+static int serial_tx_ready();
 
 /* delay() borrowed from OSDev.org */
 static inline void delay(int32_t count)
@@ -55,17 +75,15 @@ static inline void delay(int32_t count)
 		 : : [count]"r"(count) : "cc");
 }
 
+// cpsid takes effect at once, the memory clobber keeps
+// the ring accesses inside the section
 static inline uint32_t disable_save_ints()
 {
 	uint32_t status;
 	asm volatile (
 			"mrs %[var_reg], cpsr\n\t"
-			"dsb\n\t"
-			"isb\n\t"
 			"cpsid aif\n\t"
-			"dsb\n\t"
-			"isb\n\t"
-			:[var_reg] "=r" (status)::
+			:[var_reg] "=r" (status)::"memory"
 	);
 	return status;
 }
@@ -74,12 +92,51 @@ static inline void restore_ints(uint32_t status)
 {
 	asm volatile (
 			"msr cpsr_fsxc, %[var_reg]\n\t"
-			"dsb\n\t"
 			"isb\n\t"
-			::[var_reg] "r" (status):
+			::[var_reg] "r" (status):"memory"
 	);
 }
 
+// Copies up to n bytes to a ring, returns the count.
+// Only the producer writes the tail, only the consumer the head.
+static inline int ser_ring_put(char *ring, int size, int *head, int *tail,
+		const char *buf, int n)
+{
+	int h = LOAD_ACQUIRE(*head);
+	int t = *tail;
+	int cnt = 0;
+
+	while (cnt < n)
+	{
+		int next = (t + 1 == size) ? 0 : t + 1;
+		if (next == h)
+		{
+			break; // full
+		}
+		ring[t] = buf[cnt++];
+		t = next;
+	}
+	STORE_RELEASE(*tail, t);
+	return cnt;
+}
+
+// Copies up to n bytes from a ring, returns the count
+static inline int ser_ring_get(char *ring, int size, int *head, int *tail,
+		char *buf, int n)
+{
+	int h = *head;
+	int t = LOAD_ACQUIRE(*tail);
+	int cnt = 0;
+
+	while ((cnt < n) && (h != t))
+	{
+		buf[cnt++] = ring[h];
+		h = (h + 1 == size) ? 0 : h + 1;
+	}
+	STORE_RELEASE(*head, h);
+	return cnt;
+}
+
 unsigned int serial_get_rx_dropped()
 {
 	unsigned int retval;
@@ -417,73 +474,62 @@ void serial_start_tx()
 
 int serial_tx_free()
 {
-	if (ser_tx_tail > ser_tx_head)
+	int head = LOAD_ACQUIRE(ser_tx_head);
+
+	if (ser_tx_tail > head)
 	{
-		return (ser_tx_head + SER_TX_BUFF_SIZE - ser_tx_tail);
+		return (head + SER_TX_BUFF_SIZE - ser_tx_tail);
 	}
-	return (ser_tx_head - ser_tx_tail);
+	return (head - ser_tx_tail);
 }
 
 int serial_rx_used()
 {
-	if (ser_rx_head > ser_rx_tail)
+	int tail = LOAD_ACQUIRE(ser_rx_tail);
+
+	if (ser_rx_head > tail)
 	{
-		return (ser_rx_tail + SER_RX_BUFF_SIZE - ser_rx_head);
+		return (tail + SER_RX_BUFF_SIZE - ser_rx_head);
 	}
-	return (ser_rx_tail - ser_rx_head);
+	return (tail - ser_rx_head);
 }
 
 int serial_get_char()
 {
 	char ch;
 
-	SYNC;
-
-	if (ser_rx_tail == ser_rx_head)
+	if (LOAD_ACQUIRE(ser_rx_tail) == ser_rx_head)
 	{
 		serial_poll();
 	}
-	SYNC;
 
-	// if rx buffer is empty
-	if (ser_rx_tail == ser_rx_head)
+	// get character from ring buffer
+	if (ser_ring_get(ser_rx_buff, SER_RX_BUFF_SIZE, &ser_rx_head, &ser_rx_tail,
+			&ch, 1) == 0)
 	{
 		// no chars
 		return -1;
 	}
-	else
-	{
-		// get character from ring buffer
-		ch = ser_rx_buff[ser_rx_head++];
-		ser_rx_head %= SER_RX_BUFF_SIZE;
-		serial_poll();
-	}
-	SYNC;
+	serial_poll();
 	return (int) ch;
 }
 
 int serial_write_char(char c)
 {
-	if (ser_tx_tail + 1 == ser_tx_head)
-	{
-		serial_poll();
-	}
-	SYNC;
+	int cnt;
 
-	// if tx buffer is full
-	if (ser_tx_tail + 1 == ser_tx_head)
-	{
-		// don't write, return error
-		return -1;
-	}
-	else
+	// put character to ring buffer
+	cnt = ser_ring_put(ser_tx_buff, SER_TX_BUFF_SIZE, &ser_tx_head, &ser_tx_tail,
+			&c, 1);
+	if (cnt == 0)
 	{
-		// put character to ring buffer
-		ser_tx_buff[ser_tx_tail++] = c;
-		ser_tx_tail %= SER_TX_BUFF_SIZE;
+		// tx buffer is full - let it drain and retry
+		serial_poll();
+		cnt = ser_ring_put(ser_tx_buff, SER_TX_BUFF_SIZE, &ser_tx_head,
+				&ser_tx_tail, &c, 1);
 	}
-	SYNC;
-	return 0; // success
+	// if tx buffer is full, don't write, return error
+	return (cnt == 1) ? 0 : -1;
 }
 
 int serial_put_char(char c)
@@ -507,10 +553,9 @@ int serial_get_string(char *st, char delim, int n)
 	// This also takes care of negative n
 	while (m > 0)
 	{
-		SYNC;
-
 		// if rx buffer is empty
-		if (ser_rx_tail == ser_rx_head)
+		if (ser_ring_get(ser_rx_buff, SER_RX_BUFF_SIZE, &ser_rx_head,
+				&ser_rx_tail, st, 1) == 0)
 		{
 			if (tries-- == 0) break;
 
@@ -521,16 +566,12 @@ int serial_get_string(char *st, char delim, int n)
 		else
 		{
 			tries = 10;
-			// get character from ring buffer
-			*st = ser_rx_buff[ser_rx_head++];
-			ser_rx_head %= SER_RX_BUFF_SIZE;
 			// a character less to read
 			m--;
 			if (*(st++) == delim) break;
 			serial_poll();
 		}
 	}
-	SYNC;
 	return n - m; // characters actually got
 }
 
@@ -570,71 +611,94 @@ int serial_put_string(char *st, int n)
 // Read from the ring buffer
 int serial_read(char *buf, int n)
 {
-	int m = n; // count
+	int m = 0; // count
+	int cnt;
 
-	// Read one by one to let more characters to accumulate
+	// Take what there is, if empty, let more characters to accumulate
 	// This also takes care of negative n
-	while (m > 0)
+	while (m < n)
 	{
-		SYNC;
-
-		if (ser_rx_tail == ser_rx_head)
+		cnt = ser_ring_get(ser_rx_buff, SER_RX_BUFF_SIZE, &ser_rx_head,
+				&ser_rx_tail, buf + m, n - m);
+		if (cnt == 0)
 		{
 			serial_poll();
+			cnt = ser_ring_get(ser_rx_buff, SER_RX_BUFF_SIZE, &ser_rx_head,
+					&ser_rx_tail, buf + m, n - m);
+			if (cnt == 0)
+			{
+				// rx buffer is empty - quit reading
+				break;
+			}
 		}
-		SYNC;
-
-		// if rx buffer is empty
-		if (ser_rx_tail == ser_rx_head)
-		{
-			// quit reading
-			break;
-		}
-		else
-		{
-			// get character from ring buffer
-			*(buf++) = ser_rx_buff[ser_rx_head++];
-			ser_rx_head %= SER_RX_BUFF_SIZE;
-			// a character less to read
-			m--;
-		}
+		m += cnt;
 	}
-	SYNC;
-	return n - m; // characters actually got
+	return m; // characters actually got
 }
 
 // Write to the ring buffer
 int serial_write(char *buf, int n)
 {
-	int m = n; // count
-	if (n == 0) return 0;
-	// write one by one to let more space to emerge
-	while (m > 0)
-	{
+	int m = 0; // count
+	int cnt;
 
-		if (ser_tx_tail + 1 == ser_tx_head)
+	if (n <= 0) return 0;
+	// write what fits, if full, let more space to emerge
+	while (m < n)
+	{
+		cnt = ser_ring_put(ser_tx_buff, SER_TX_BUFF_SIZE, &ser_tx_head,
+				&ser_tx_tail, buf + m, n - m);
+		if (cnt == 0)
 		{
 			serial_poll();
+			cnt = ser_ring_put(ser_tx_buff, SER_TX_BUFF_SIZE, &ser_tx_head,
+					&ser_tx_tail, buf + m, n - m);
+			if (cnt == 0)
+			{
+				// tx buffer is full - quit writing
+				break;
+			}
 		}
-		SYNC;
-
-		// if tx buffer is full
-		if (ser_tx_tail + 1 == ser_tx_head)
-		{
-			// quit writing
-			break;
-		}
-		else
-		{
-			// put character to ring buffer
-			ser_tx_buff[ser_tx_tail++] = *(buf++);
-			ser_tx_tail %= SER_TX_BUFF_SIZE;
-			// a character less to write
-			m--;
-		}
+		m += cnt;
 	}
 	serial_start_tx();
-	return n - m; // characters actually written
+	return m; // characters actually written
+}
+
+// Per-byte cost of the ring copy, for 'monitor serbench': n bytes
+// (at most SER_TX_BUFF_SIZE - 1) through a scratch ring, the way the
+// driver does it now, or (legacy) as it did with volatile buffers and
+// indices and dsb + isb for each character.
+void serial_ring_bench(int legacy, char *buf, int n)
+{
+	static char ring[SER_TX_BUFF_SIZE];
+	static volatile char vring[SER_TX_BUFF_SIZE];
+	static int head, tail;
+	static volatile int vhead, vtail;
+	int i;
+
+	if (!legacy)
+	{
+		(void)ser_ring_put(ring, SER_TX_BUFF_SIZE, &head, &tail, buf, n);
+		(void)ser_ring_get(ring, SER_TX_BUFF_SIZE, &head, &tail, buf, n);
+		return;
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (vtail + 1 == vhead) break;
+		SYNC;
+		vring[vtail++] = buf[i];
+		vtail %= SER_TX_BUFF_SIZE;
+		SYNC;
+	}
+	for (i = 0; i < n; i++)
+	{
+		SYNC;
+		if (vtail == vhead) break;
+		buf[i] = vring[vhead++];
+		vhead %= SER_TX_BUFF_SIZE;
+		SYNC;
+	}
 }
 
 /* IRQ routines */
@@ -659,7 +723,7 @@ void serial_poll()
 			serial_irq();
 			status = *((volatile uint32_t *)UART0_MIS);
 		}
-		if (ser_tx_tail != ser_tx_head)
+		if (serial_tx_ready())
 		{
 			serial_irq();
 		}
@@ -714,14 +778,15 @@ void serial_rx()
 {
 	uint32_t ch;
 	uint32_t uart0_fr;
+	int head = LOAD_ACQUIRE(ser_rx_head);
+	int tail = ser_rx_tail;
+	int next = (tail + 1) % SER_RX_BUFF_SIZE;
 
-	SYNC;
 	// if buffer is full
-	if (ser_rx_tail + 1 == ser_rx_head)
+	if (next == head)
 	{
 		// if receive fifo is full
 		uart0_fr = *((volatile uint32_t *)UART0_FR);
-		asm volatile("dsb\n\t");
 		if (uart0_fr & (1 << 6))
 		{
 			// if we don't clear the interrupt, we'll be here all the time
@@ -780,11 +845,11 @@ void serial_rx()
 		}
 	}
 	// While buffer is not full
-	while (ser_rx_tail + 1 != ser_rx_head)
+	// (UART register accesses are in order without barriers)
+	while (next != head)
 	{
 		// If receive FIFO is empty
 		uart0_fr = *((volatile uint32_t *)UART0_FR);
-		asm volatile("dsb\n\t");
 		if (uart0_fr & (1 << 4))
 		{
 			// Quit reading
@@ -794,7 +859,6 @@ void serial_rx()
 		{
 			// Read char in ch
 			ch = *((volatile uint32_t *)UART0_DR);
-			asm volatile("dsb\n\t");
 			if (ch & 0x800) ser_rx_ovr_count++;
 			/* if BRK character (CTRL-C) */
 			/* It can't be handled if it doesn't fit into HW FIFO */
@@ -810,47 +874,101 @@ void serial_rx()
 				}
 			}
 			// Store in ring buffer
-			ser_rx_buff[ser_rx_tail++] = (char)(ch & 0xff);
-			ser_rx_tail %= SER_RX_BUFF_SIZE;
+			ser_rx_buff[tail] = (char)(ch & 0xff);
+			tail = next;
+			next = (tail + 1) % SER_RX_BUFF_SIZE;
 		}
 	}
-	SYNC;
+	STORE_RELEASE(ser_rx_tail, tail);
+	// done with the UART for now
+	asm volatile("dsb\n\t");
+}
+
+// follows the gdb packet framing of a sent byte
+static void serial_track_packet(char c)
+{
+	switch (ser_tx_pkt)
+	{
+	case SER_PKT_OUT:
+		if ((c == '$') || (c == '%'))
+		{
+			ser_tx_pkt = SER_PKT_DATA;
+		}
+		break;
+	case SER_PKT_DATA:
+		if (c == '#')
+		{
+			ser_tx_pkt = SER_PKT_SUM1;
+		}
+		break;
+	case SER_PKT_SUM1:
+		ser_tx_pkt = SER_PKT_SUM2;
+		break;
+	default:
+		ser_tx_pkt = SER_PKT_OUT;
+		break;
+	}
+}
+
+// 1 if serial_tx() has something it can send now
+static int serial_tx_ready()
+{
+	if ((ser_frame_pos < ser_frame_len)
+			|| (LOAD_ACQUIRE(ser_tx_tail) != ser_tx_head))
+	{
+		return 1;
+	}
+	return (ser_tx_pkt == SER_PKT_OUT) && chan_pending();
 }
 
 // Note: tx only reads tx_tail, and only tx writes tx_head
 // Even simultaneous read and write shouldn't cause problems
 // (Well, serial_start_tx() does too, if interrupts are not happening)
-// returns number of chars written, or -1 if buffer was empty on call
-// to make it usable also for polling
+// A channel frame, once started, is sent whole. Then gdb bytes go first,
+// and new frames only when there are none and no packet is half sent.
 void serial_tx()
 {
 	uint32_t ch;
 	uint32_t uart0_fr;
-	SYNC;
-	// While buffer is not empty
-	while (ser_tx_tail != ser_tx_head)
+	int head = ser_tx_head;
+	int tail = LOAD_ACQUIRE(ser_tx_tail);
+
+	while (1)
 	{
 		uart0_fr = *((volatile uint32_t *)UART0_FR);
-		asm volatile("dsb\n\t");
 		// If transmit FIFO is full
 		if (uart0_fr & (1 << 5))
 		{
 			// Quit transmitting
 			break;
 		}
-		else
+		if (ser_frame_pos < ser_frame_len)
+		{
+			ch = (uint32_t)ser_frame[ser_frame_pos++];
+		}
+		else if (tail != head)
 		{
 			// get char from ring buffer
-			ch = (uint32_t)ser_tx_buff[ser_tx_head++];
-			ser_tx_head %= SER_TX_BUFF_SIZE;
-			// Write ch in transmitter
-			*((volatile uint32_t *)UART0_DR) = ch;
-			asm volatile("dsb\n\t");
-
+			ch = (uint32_t)ser_tx_buff[head++];
+			head %= SER_TX_BUFF_SIZE;
+			serial_track_packet((char)ch);
+		}
+		else if ((ser_tx_pkt == SER_PKT_OUT)
+				&& ((ser_frame_len = chan_next_frame(ser_frame)) > 0))
+		{
+			ser_frame_pos = 0;
+			continue;
+		}
+		else
+		{
+			break;
 		}
+		// Write ch in transmitter
+		*((volatile uint32_t *)UART0_DR) = ch;
 	}
-	// if buffer is empty
-	if (ser_tx_tail == ser_tx_head)
+	STORE_RELEASE(ser_tx_head, head);
+	// if nothing more to send now
+	if (!serial_tx_ready())
 	{
 		// to keep continuous tx interrupts from happening
 		// when there is no data to send,
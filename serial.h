@@ -33,6 +33,7 @@ int serial_read(char *buf, int n);
 int serial_write(char *buf, int n);
 //void serial_enable_ctrlc(int enable);
 int serial_tx_free();
+void serial_start_tx(); // (re)starts sending the gdb ring and channel frames
 int serial_rx_used();
 
 // serial interrupt handler
@@ -41,6 +42,10 @@ void disable_uart0_ints();
 unsigned int serial_get_rx_dropped();
 unsigned int serial_get_rx_ovr();
 
+// n bytes through a scratch ring the way the driver copies them
+// (legacy: with volatile and barriers per character) - for benchmarking
+void serial_ring_bench(int legacy, char *buf, int n);
+
 // waits until transmit fifo is empty and writes the string
 // directly in the tx fifo and returns the number of chars
 // actually sent
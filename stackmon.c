@@ -0,0 +1,217 @@
+/*
+stackmon.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Stack high-water measurement.
+// The debuggee stacks are painted with a pattern on the target, and the
+// high-water mark is the lowest word that doesn't have the pattern any
+// more (stacks grow downwards). Nothing goes over the serial line but
+// the result.
+// The stub's own stacks are in .bss, which starts zeroed, so for them
+// zero is the 'pattern'. Zeros pushed to the stack can make the usage
+// look a bit smaller than it was.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "gdb.h"
+#include "stackmon.h"
+
+// stack symbols from loader.ld
+extern char stacks;
+extern char __fiq_stack;
+extern char __usrsys_stack;
+extern char __svc_stack;
+extern char __irq_stack;
+extern char __mon_stack;
+extern char __hyp_stack;
+extern char __und_stack;
+extern char __abrt_stack;
+extern char __gdb_stack;
+
+typedef struct {
+	uint32_t start;
+	uint32_t len;
+} stackmon_area_t;
+
+static stackmon_area_t stackmon_areas[STACKMON_MAX_AREAS];
+static int stackmon_num_areas;
+
+// fills words from p with pattern, a cache line (8 words) per stm
+static void stackmon_fill(uint32_t *p, uint32_t words, uint32_t pattern)
+{
+	uint32_t blocks = words >> 3;
+
+	if (blocks)
+	{
+		asm volatile (
+				"mov r4, %[val]\n\t"
+				"mov r5, r4\n\t"
+				"mov r6, r4\n\t"
+				"mov r7, r4\n\t"
+				"mov r8, r4\n\t"
+				"mov r9, r4\n\t"
+				"mov r10, r4\n\t"
+				"mov r12, r4\n\t"
+				"1:\n\t"
+				"stmia %[ptr]!, {r4 - r10, r12}\n\t"
+				"subs %[cnt], %[cnt], #1\n\t"
+				"bne 1b\n\t"
+				: [ptr] "+r" (p), [cnt] "+r" (blocks)
+				: [val] "r" (pattern)
+				: "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r12", "cc", "memory"
+		);
+	}
+	for (words &= 7; words; words--)
+	{
+		*(p++) = pattern;
+	}
+}
+
+// returns the number of bytes from the first non-pattern word to the end
+static uint32_t stackmon_used(uint32_t start, uint32_t len, uint32_t pattern)
+{
+	uint32_t *p = (uint32_t *)start;
+	uint32_t *end = (uint32_t *)(start + len);
+
+	// 4 words at a time while possible
+	while ((p + 4 <= end) && (p[0] == pattern) && (p[1] == pattern)
+			&& (p[2] == pattern) && (p[3] == pattern))
+	{
+		p += 4;
+	}
+	while ((p < end) && (*p == pattern))
+	{
+		p++;
+	}
+	return (uint32_t)end - (uint32_t)p;
+}
+
+// "name: start len used n (p%)"
+static void stackmon_report(char *name, uint32_t start, uint32_t len, uint32_t pattern)
+{
+	char line[80];
+	uint32_t used;
+
+	used = stackmon_used(start, len, pattern);
+	util_str_copy(line, name, 16);
+	util_append_str(line, " ", 80);
+	util_word_to_hex(line + util_str_len(line), start);
+	util_append_str(line, " len ", 80);
+	util_word_to_dec(line + util_str_len(line), len);
+	util_append_str(line, " used ", 80);
+	util_word_to_dec(line + util_str_len(line), used);
+	util_append_str(line, " (", 80);
+	util_word_to_dec(line + util_str_len(line), (len > 0) ? (used * 100) / len : 0);
+	util_append_str(line, (used == len) ? "%) - overflow?\n" : "%)\n", 80);
+	gdb_mon_print(line);
+}
+
+// reads "addr len" - the area is word-aligned inwards
+static int stackmon_get_area(char *args, uint32_t *start, uint32_t *len)
+{
+	unsigned int addr, size;
+	int i;
+
+	i = util_read_num(args, &addr);
+	if (i == 0) return -1;
+	args += i;
+	i = util_read_num(args, &size);
+	if (i == 0) return -1;
+	size -= (4 - (addr & 3)) & 3;
+	addr = (addr + 3) & ~3;
+	size &= ~3;
+	if ((size == 0) || (size & 0x80000000)) return -1;
+	*start = addr;
+	*len = size;
+	return 0;
+}
+
+int stackmon_paint_cmd(char *args)
+{
+	uint32_t start, len;
+	int i;
+
+	if (stackmon_get_area(args, &start, &len) < 0)
+	{
+		return -1;
+	}
+	stackmon_fill((uint32_t *)start, len >> 2, STACKMON_PATTERN);
+	for (i=0; i<stackmon_num_areas; i++)
+	{
+		if (stackmon_areas[i].start == start)
+		{
+			break;
+		}
+	}
+	if (i == STACKMON_MAX_AREAS)
+	{
+		gdb_mon_print("stackpaint: painted, but too many areas to remember\n");
+		return 0;
+	}
+	stackmon_areas[i].start = start;
+	stackmon_areas[i].len = len;
+	if (i == stackmon_num_areas)
+	{
+		stackmon_num_areas++;
+	}
+	return 0;
+}
+
+int stackmon_water_cmd(char *args)
+{
+	uint32_t start, len;
+	int i;
+
+	while (*args == ' ') args++;
+	if (*args != '\0')
+	{
+		if (stackmon_get_area(args, &start, &len) < 0)
+		{
+			return -1;
+		}
+		stackmon_report("stack", start, len, STACKMON_PATTERN);
+		return 0;
+	}
+	for (i=0; i<stackmon_num_areas; i++)
+	{
+		stackmon_report("stack", stackmon_areas[i].start, stackmon_areas[i].len,
+				STACKMON_PATTERN);
+	}
+	// the stub's own stacks
+	stackmon_report("stub fiq", (uint32_t)&stacks,
+			(uint32_t)&__fiq_stack - (uint32_t)&stacks, 0);
+	stackmon_report("stub usr/sys", (uint32_t)&__fiq_stack,
+			(uint32_t)&__usrsys_stack - (uint32_t)&__fiq_stack, 0);
+	stackmon_report("stub svc", (uint32_t)&__usrsys_stack,
+			(uint32_t)&__svc_stack - (uint32_t)&__usrsys_stack, 0);
+	stackmon_report("stub irq", (uint32_t)&__svc_stack,
+			(uint32_t)&__irq_stack - (uint32_t)&__svc_stack, 0);
+	stackmon_report("stub mon", (uint32_t)&__irq_stack,
+			(uint32_t)&__mon_stack - (uint32_t)&__irq_stack, 0);
+	stackmon_report("stub hyp", (uint32_t)&__mon_stack,
+			(uint32_t)&__hyp_stack - (uint32_t)&__mon_stack, 0);
+	stackmon_report("stub und", (uint32_t)&__hyp_stack,
+			(uint32_t)&__und_stack - (uint32_t)&__hyp_stack, 0);
+	stackmon_report("stub abrt", (uint32_t)&__und_stack,
+			(uint32_t)&__abrt_stack - (uint32_t)&__und_stack, 0);
+	stackmon_report("stub gdb", (uint32_t)&__abrt_stack,
+			(uint32_t)&__gdb_stack - (uint32_t)&__abrt_stack, 0);
+	return 0;
+}
@@ -0,0 +1,33 @@
+/*
+stackmon.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STACKMON_H_
+#define STACKMON_H_
+
+#define STACKMON_PATTERN 0x5a5aa5a5
+#define STACKMON_MAX_AREAS 8
+
+// monitor stackpaint addr len
+int stackmon_paint_cmd(char *args);
+
+// monitor stackwater [addr len]
+int stackmon_water_cmd(char *args);
+
+#endif /* STACKMON_H_ */
@@ -0,0 +1,214 @@
+/*
+trace.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Debuggee exception and interrupt trace.
+// When enabled, the upper vector jump table points to tracing entries
+// (rpi2_trace_exc_*) that call trace_record() and then go on to the
+// normal upper vector handlers. When disabled, the original jump table
+// is used, so tracing costs nothing then.
+// The ring keeps the latest TRACE_RING_SIZE events. A FIQ hitting while
+// an IRQ is being recorded can take the same slot - the counters stay right.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "gdb.h"
+#include "trace.h"
+
+static trace_rec_t trace_ring[TRACE_RING_SIZE];
+static volatile uint32_t trace_head; // total number of events recorded
+static uint32_t trace_exc_count[TRACE_NUM_EXC];
+static uint32_t trace_irq_count[TRACE_NUM_IRQ];
+static int trace_on;
+
+static char *trace_exc_names[TRACE_NUM_EXC] = {
+		"reset", "undef", "svc", "pabt", "dabt", "aux", "irq", "fiq"
+};
+
+void trace_record(unsigned int type, unsigned int lr, unsigned int spsr)
+{
+	trace_rec_t *rec;
+	uint32_t pend, i;
+
+	rec = &trace_ring[trace_head & (TRACE_RING_SIZE - 1)];
+	trace_head++;
+	rec->time = *((volatile uint32_t *)SYSTMR_CLO);
+	rec->type = type;
+	rec->pendb = *((volatile uint32_t *)IRC_PENDB);
+	rec->pend1 = *((volatile uint32_t *)IRC_PEND1);
+	rec->pend2 = *((volatile uint32_t *)IRC_PEND2);
+	// lr to the interrupted/faulting instruction
+	switch (type)
+	{
+	case RPI2_EXC_UNDEF:
+	case RPI2_EXC_SVC:
+		rec->pc = lr - ((spsr & 0x20) ? 2 : 4); // thumb/arm
+		break;
+	case RPI2_EXC_DABT:
+		rec->pc = lr - 8;
+		break;
+	default:
+		rec->pc = lr - 4;
+		break;
+	}
+	trace_exc_count[type & (TRACE_NUM_EXC - 1)]++;
+	if ((type == RPI2_EXC_IRQ) || (type == RPI2_EXC_FIQ))
+	{
+		for (pend = rec->pend1, i = 0; pend; pend >>= 1, i++)
+		{
+			if (pend & 1) trace_irq_count[i]++;
+		}
+		for (pend = rec->pend2, i = 32; pend; pend >>= 1, i++)
+		{
+			if (pend & 1) trace_irq_count[i]++;
+		}
+		for (pend = rec->pendb & 0xff, i = 64; pend; pend >>= 1, i++)
+		{
+			if (pend & 1) trace_irq_count[i]++;
+		}
+	}
+}
+
+void trace_enable(int on)
+{
+	trace_on = on;
+	rpi2_trace_vectors(on);
+}
+
+static void trace_clear()
+{
+	int i;
+
+	trace_head = 0;
+	for (i=0; i<TRACE_NUM_EXC; i++)
+	{
+		trace_exc_count[i] = 0;
+	}
+	for (i=0; i<TRACE_NUM_IRQ; i++)
+	{
+		trace_irq_count[i] = 0;
+	}
+}
+
+// prints "name value" with value in decimal
+static void trace_print_count(char *name, uint32_t val)
+{
+	char scratchpad[16];
+
+	gdb_mon_print(name);
+	gdb_mon_print(": ");
+	util_word_to_dec(scratchpad, val);
+	gdb_mon_print(scratchpad);
+	gdb_mon_print("\n");
+}
+
+static void trace_stats()
+{
+	int i;
+	char name[16];
+
+	gdb_mon_print(trace_on ? "trace: on\n" : "trace: off\n");
+	trace_print_count("events", trace_head);
+	for (i=0; i<TRACE_NUM_EXC; i++)
+	{
+		if (trace_exc_count[i])
+		{
+			trace_print_count(trace_exc_names[i], trace_exc_count[i]);
+		}
+	}
+	for (i=0; i<TRACE_NUM_IRQ; i++)
+	{
+		if (trace_irq_count[i])
+		{
+			// GPU IRQ n as 'irq n', ARM basic IRQ n as 'basic n'
+			util_str_copy(name, (i < 64) ? "irq " : "basic ", 16);
+			util_word_to_dec(name + util_str_len(name), (i < 64) ? i : i - 64);
+			trace_print_count(name, trace_irq_count[i]);
+		}
+	}
+}
+
+static void trace_dump(uint32_t count)
+{
+	uint32_t first, i;
+	trace_rec_t *rec;
+	char line[80];
+
+	if (count > trace_head) count = trace_head;
+	if (count > TRACE_RING_SIZE) count = TRACE_RING_SIZE;
+	first = trace_head - count;
+	gdb_mon_print("time(us)  type  pc        pendb    pend1    pend2\n");
+	for (i=first; i<first+count; i++)
+	{
+		rec = &trace_ring[i & (TRACE_RING_SIZE - 1)];
+		util_word_to_dec(line, rec->time);
+		util_append_str(line, "  ", 80);
+		util_append_str(line, trace_exc_names[rec->type & (TRACE_NUM_EXC - 1)], 80);
+		util_append_str(line, "  ", 80);
+		util_word_to_hex(line + util_str_len(line), rec->pc);
+		util_append_str(line, "  ", 80);
+		util_word_to_hex(line + util_str_len(line), rec->pendb);
+		util_append_str(line, " ", 80);
+		util_word_to_hex(line + util_str_len(line), rec->pend1);
+		util_append_str(line, " ", 80);
+		util_word_to_hex(line + util_str_len(line), rec->pend2);
+		util_append_str(line, "\n", 80);
+		gdb_mon_print(line);
+	}
+}
+
+int trace_mon_cmd(char *args)
+{
+	unsigned int count;
+	int len;
+
+	while (*args == ' ') args++;
+	if (util_str_cmp(args, "on") == 0)
+	{
+		trace_enable(1);
+	}
+	else if (util_str_cmp(args, "off") == 0)
+	{
+		trace_enable(0);
+	}
+	else if (util_str_cmp(args, "clear") == 0)
+	{
+		trace_clear();
+	}
+	else if ((util_str_cmp(args, "stats") == 0) || (*args == '\0'))
+	{
+		trace_stats();
+	}
+	else if (util_cmp_substr(args, "dump") == util_str_len("dump"))
+	{
+		args += util_str_len("dump");
+		len = util_read_num(args, &count);
+		if (len == 0)
+		{
+			count = 32;
+		}
+		trace_dump(count);
+	}
+	else
+	{
+		return -1;
+	}
+	return 0;
+}
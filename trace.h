@@ -0,0 +1,47 @@
+/*
+trace.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#define TRACE_RING_SIZE 256 // must be power of 2
+#define TRACE_NUM_EXC 8 // RPI2_EXC_RESET - RPI2_EXC_FIQ
+#define TRACE_NUM_IRQ 72 // GPU IRQs 0-63 + ARM basic IRQs 0-7
+
+typedef struct {
+	unsigned int time; // system timer (us)
+	unsigned int type; // RPI2_EXC_*
+	unsigned int pc; // interrupted instruction
+	unsigned int pendb; // IRC_PENDB
+	unsigned int pend1; // IRC_PEND1
+	unsigned int pend2; // IRC_PEND2
+} trace_rec_t;
+
+// Records an exception - called from the tracing vector entries
+// lr and spsr are the ones of the exception mode
+void trace_record(unsigned int type, unsigned int lr, unsigned int spsr);
+
+// Starts or stops tracing (installs the tracing vectors)
+void trace_enable(int on);
+
+// monitor trace on|off|clear|stats|dump [n]
+int trace_mon_cmd(char *args);
+
+#endif /* TRACE_H_ */
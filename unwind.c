@@ -0,0 +1,342 @@
+/*
+unwind.c
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Stack unwinding with the ARM EHABI tables (.ARM.exidx and .ARM.extab).
+// See "Exception Handling ABI for the ARM Architecture" (ARM IHI 0038).
+// The debuggee is loaded section by section, so there are no ELF headers
+// on the target - the table location comes from gdb (qSymbol) or from
+// 'monitor unwind-tables'.
+
+#include <stdint.h>
+#include "rpi2.h"
+#include "util.h"
+#include "gdb.h"
+#include "unwind.h"
+
+#define UNWIND_CANTUNWIND 1
+// unwind instructions of one function, more is not supported
+#define UNWIND_MAX_INSNS 64
+
+static uint32_t unwind_exidx_start = 0;
+static uint32_t unwind_exidx_end = 0;
+
+// only RAM is read - no aborts in the stub
+static int unwind_read(uint32_t addr, uint32_t *val)
+{
+	if ((addr & 3) || (addr >= PERIPH_BASE))
+	{
+		return -1;
+	}
+	*val = *((uint32_t *)addr);
+	return 0;
+}
+
+// sign-extended 31-bit place-relative offset
+static uint32_t unwind_prel31(uint32_t addr, uint32_t word)
+{
+	return addr + (uint32_t)(((int32_t)(word << 1)) >> 1);
+}
+
+int unwind_set_tables(uint32_t start, uint32_t end)
+{
+	if ((start & 3) || (end & 3) || (start >= end) || (end > PERIPH_BASE))
+	{
+		return -1;
+	}
+	unwind_exidx_start = start;
+	unwind_exidx_end = end;
+	return 0;
+}
+
+int unwind_have_tables()
+{
+	return (unwind_exidx_end != 0);
+}
+
+// the index entry of the function that contains pc (or 0)
+// the entries are sorted by the function start address
+static uint32_t unwind_find(uint32_t pc)
+{
+	uint32_t lo, hi, mid, entry;
+	uint32_t found = 0;
+
+	lo = 0;
+	hi = (unwind_exidx_end - unwind_exidx_start) >> 3;
+	while (lo < hi)
+	{
+		mid = (lo + hi) >> 1;
+		entry = unwind_exidx_start + (mid << 3);
+		if (unwind_prel31(entry, *((uint32_t *)entry)) <= pc)
+		{
+			found = entry;
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return found;
+}
+
+// collects the unwind instruction bytes of the index entry
+// returns the number of bytes or -1 if the function can't be unwound
+static int unwind_get_insns(uint32_t entry, uint8_t *insns)
+{
+	uint32_t word, addr;
+	int words, n = 0;
+
+	word = *((uint32_t *)(entry + 4));
+	if (word == UNWIND_CANTUNWIND)
+	{
+		return -1;
+	}
+	if (word & 0x80000000)
+	{
+		// compact model inline in the index, personality 0 only
+		if (word & 0x0f000000) return -1;
+		insns[n++] = (uint8_t)(word >> 16);
+		insns[n++] = (uint8_t)(word >> 8);
+		insns[n++] = (uint8_t)word;
+		return n;
+	}
+	addr = unwind_prel31(entry + 4, word); // .ARM.extab entry
+	if (unwind_read(addr, &word) < 0) return -1;
+	if (word & 0x80000000)
+	{
+		// compact model
+		if ((word & 0x0f000000) == 0)
+		{
+			insns[n++] = (uint8_t)(word >> 16);
+			insns[n++] = (uint8_t)(word >> 8);
+			insns[n++] = (uint8_t)word;
+			return n;
+		}
+		if ((word & 0x0f000000) > 0x02000000) return -1;
+		words = (word >> 16) & 0xff;
+	}
+	else
+	{
+		// generic personality routine (like __gxx_personality_v0):
+		// its data has the same layout as the long compact model
+		addr += 4;
+		if (unwind_read(addr, &word) < 0) return -1;
+		words = word >> 24;
+		insns[n++] = (uint8_t)(word >> 16);
+	}
+	insns[n++] = (uint8_t)(word >> 8);
+	insns[n++] = (uint8_t)word;
+	if (n + 4 * words > UNWIND_MAX_INSNS) return -1;
+	while (words-- > 0)
+	{
+		addr += 4;
+		if (unwind_read(addr, &word) < 0) return -1;
+		insns[n++] = (uint8_t)(word >> 24);
+		insns[n++] = (uint8_t)(word >> 16);
+		insns[n++] = (uint8_t)(word >> 8);
+		insns[n++] = (uint8_t)word;
+	}
+	return n;
+}
+
+// pops the registers in mask (bit n = rn) from vsp
+static int unwind_pop(uint32_t *vsp, uint32_t mask, uint32_t *regs)
+{
+	int i;
+	uint32_t sp = *vsp;
+
+	for (i=0; i<16; i++)
+	{
+		if (mask & (1 << i))
+		{
+			if (unwind_read(sp, &regs[i]) < 0) return -1;
+			sp += 4;
+		}
+	}
+	// a popped sp replaces vsp
+	*vsp = (mask & (1 << 13)) ? regs[13] : sp;
+	return 0;
+}
+
+// executes the unwind instructions on the virtual register set
+static int unwind_exec(uint8_t *insns, int n, uint32_t *regs)
+{
+	int i = 0, shift;
+	int pc_set = 0;
+	uint32_t vsp, op, mask, val;
+
+	vsp = regs[13];
+	while (i < n)
+	{
+		op = insns[i++];
+		if ((op & 0xc0) == 0x00)
+		{
+			// 00xxxxxx: vsp = vsp + (xxxxxx << 2) + 4
+			vsp += ((op & 0x3f) << 2) + 4;
+		}
+		else if ((op & 0xc0) == 0x40)
+		{
+			// 01xxxxxx: vsp = vsp - (xxxxxx << 2) - 4
+			vsp -= ((op & 0x3f) << 2) + 4;
+		}
+		else if ((op & 0xf0) == 0x80)
+		{
+			// 1000iiii iiiiiiii: pop r4-r15 under mask
+			if (i >= n) return -1;
+			mask = (((op & 0x0f) << 8) | insns[i++]) << 4;
+			if (mask == 0) return -1; // refuse to unwind
+			if (unwind_pop(&vsp, mask, regs) < 0) return -1;
+			if (mask & (1 << 15)) pc_set = 1;
+		}
+		else if ((op & 0xf0) == 0x90)
+		{
+			// 1001nnnn: vsp = rn
+			if (((op & 0x0f) == 13) || ((op & 0x0f) == 15)) return -1;
+			vsp = regs[op & 0x0f];
+		}
+		else if ((op & 0xf0) == 0xa0)
+		{
+			// 10100nnn: pop r4-r[4+nnn], 10101nnn: also r14
+			mask = ((1 << ((op & 0x07) + 1)) - 1) << 4;
+			if (op & 0x08) mask |= (1 << 14);
+			if (unwind_pop(&vsp, mask, regs) < 0) return -1;
+		}
+		else if (op == 0xb0)
+		{
+			break; // finish
+		}
+		else if (op == 0xb1)
+		{
+			// 10110001 0000iiii: pop r0-r3 under mask
+			if (i >= n) return -1;
+			mask = insns[i++];
+			if ((mask == 0) || (mask & 0xf0)) return -1;
+			if (unwind_pop(&vsp, mask, regs) < 0) return -1;
+		}
+		else if (op == 0xb2)
+		{
+			// 10110010 uleb128: vsp = vsp + 0x204 + (uleb128 << 2)
+			val = 0;
+			shift = 0;
+			do
+			{
+				if ((i >= n) || (shift > 28)) return -1;
+				op = insns[i++];
+				val |= (op & 0x7f) << shift;
+				shift += 7;
+			} while (op & 0x80);
+			vsp += 0x204 + (val << 2);
+		}
+		else if (op == 0xb3)
+		{
+			// 10110011 sssscccc: pop VFP double registers (FSTMFDX)
+			if (i >= n) return -1;
+			vsp += (((insns[i++] & 0x0f) + 1) << 3) + 4;
+		}
+		else if ((op & 0xf8) == 0xb8)
+		{
+			// 10111nnn: pop VFP d8-d[8+nnn] (FSTMFDX)
+			vsp += (((op & 0x07) + 1) << 3) + 4;
+		}
+		else if ((op == 0xc8) || (op == 0xc9))
+		{
+			// 1100100x sssscccc: pop VFP double registers (VPUSH)
+			if (i >= n) return -1;
+			vsp += ((insns[i++] & 0x0f) + 1) << 3;
+		}
+		else if ((op & 0xf8) == 0xd0)
+		{
+			// 11010nnn: pop VFP d8-d[8+nnn] (VPUSH)
+			vsp += ((op & 0x07) + 1) << 3;
+		}
+		else
+		{
+			return -1; // iWMMX or spare
+		}
+	}
+	regs[13] = vsp;
+	if (!pc_set)
+	{
+		regs[15] = regs[14];
+	}
+	return 0;
+}
+
+int unwind_backtrace(uint32_t *regs, unwind_frame_t *frames, int max)
+{
+	uint32_t r[16];
+	uint32_t entry, pc, sp;
+	uint8_t insns[UNWIND_MAX_INSNS];
+	int i, n = 0;
+
+	for (i=0; i<16; i++)
+	{
+		r[i] = regs[i];
+	}
+	while (n < max)
+	{
+		pc = r[15] & ~1;
+		sp = r[13];
+		frames[n].pc = pc;
+		frames[n].sp = sp;
+		n++;
+		if ((pc == 0) || !unwind_have_tables())
+		{
+			break;
+		}
+		// the return address may already be past the end of the caller
+		entry = unwind_find((n == 1) ? pc : pc - 2);
+		if (entry == 0) break;
+		i = unwind_get_insns(entry, insns);
+		if (i < 0) break;
+		if (unwind_exec(insns, i, r) < 0) break;
+		if (((r[15] & ~1) == pc) && (r[13] == sp)) break; // no progress
+	}
+	return n;
+}
+
+int unwind_mon_cmd(char *args)
+{
+	char scratchpad[16];
+	unsigned int start, end;
+	int i;
+
+	i = util_read_num(args, &start);
+	if (i == 0)
+	{
+		if (!unwind_have_tables())
+		{
+			gdb_mon_print("unwind tables not set\n");
+			return 0;
+		}
+		gdb_mon_print(".ARM.exidx: ");
+		util_word_to_hex(scratchpad, unwind_exidx_start);
+		gdb_mon_print(scratchpad);
+		gdb_mon_print(" - ");
+		util_word_to_hex(scratchpad, unwind_exidx_end);
+		gdb_mon_print(scratchpad);
+		gdb_mon_print("\n");
+		return 0;
+	}
+	args += i;
+	i = util_read_num(args, &end);
+	if (i == 0) return -1;
+	return unwind_set_tables(start, end);
+}
@@ -0,0 +1,48 @@
+/*
+unwind.h
+
+Copyright (C) 2015 Juha Aaltonen
+
+This file is part of standalone gdb stub for Raspberry Pi 2B.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef UNWIND_H_
+#define UNWIND_H_
+
+#include <stdint.h>
+
+// frames in one qRpiBacktrace reply
+#define UNWIND_MAX_FRAMES 32
+
+typedef struct {
+	uint32_t pc;
+	uint32_t sp;
+} unwind_frame_t;
+
+// sets the .ARM.exidx table location, returns -1 if it doesn't look right
+int unwind_set_tables(uint32_t start, uint32_t end);
+
+// 1 if the tables are known
+int unwind_have_tables();
+
+// Unwinds the call stack from the registers r0 - r15 using the EHABI
+// tables. The first frame is the starting point. Returns the number
+// of frames.
+int unwind_backtrace(uint32_t *regs, unwind_frame_t *frames, int max);
+
+// monitor unwind-tables [start end]
+int unwind_mon_cmd(char *args);
+
+#endif /* UNWIND_H_ */
@@ -407,6 +407,47 @@ int util_read_dec(char *str, int *result)
 	return i;
 }
 
+// reads an unsigned number (hex with '0x'-prefix or decimal)
+// skipping leading spaces
+// returns the number of characters read (0 = no number)
+int util_read_num(char *str, unsigned int *result)
+{
+	int i = 0;
+	int val;
+	unsigned int num = 0;
+
+	*result = 0;
+	while (*str == ' ')
+	{
+		str++;
+		i++;
+	}
+	if ((str[0] == '0') && ((str[1] == 'x') || (str[1] == 'X')))
+	{
+		str += 2;
+		if (util_hex_to_nib(*str) < 0) return 0; // only prefix
+		i += 2;
+		while ((val = util_hex_to_nib(*str)) >= 0)
+		{
+			num = (num << 4) | (unsigned int)val;
+			str++;
+			i++;
+		}
+	}
+	else
+	{
+		if ((*str < '0') || (*str > '9')) return 0; // not a number
+		while ((*str >= '0') && (*str <= '9'))
+		{
+			num = num * 10 + (unsigned int)(*str - '0');
+			str++;
+			i++;
+		}
+	}
+	*result = num;
+	return i;
+}
+
 // converts a word endianness (swaps bytes)
 void util_swap_bytes(unsigned int *src, unsigned int *dst)
 {
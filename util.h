@@ -90,6 +90,11 @@ int util_strip_zeros(char *src, char **dst);
 // returns a signed integer and the number of characters read
 int util_read_dec(char *str, int *result);
 
+// reads an unsigned number (hex with '0x'-prefix or decimal)
+// skipping leading spaces
+// returns the number of characters read (0 = no number)
+int util_read_num(char *str, unsigned int *result);
+
 // converts a word endianness (swaps bytes)
 void util_swap_bytes(unsigned int *src, unsigned int *dst);
 